@@ -1,6 +1,8 @@
 #ifndef ALU_HPP
 #define ALU_HPP
 
+#include <algorithm>
+#include <type_traits>
 #include <vector>
 
 #include "Muxes.hpp"
@@ -16,6 +18,9 @@ class HalfAdder : public Component
 
     void process();
 
+    // Add the same gates to a netlist, returning (sum, carry)
+    static Bus synthesize(Netlist& n, Net a, Net b);
+
   private:
     XOR _gate0;
     AND _gate1;
@@ -31,48 +36,225 @@ class FullAdder : public Component
 
     void process();
 
+    static Bus synthesize(Netlist& n, Net a, Net b, Net carry);
+
   private:
     HalfAdder _adder0, _adder1;
     OR _gate0;
 };
 
 
+// Reduce columns of bits, all of a column's bits having the same
+// weight, to two rows for a final adder. Wallace reduction uses 4:2
+// compressors (two full adders, with a carry passed sideways to the
+// next column) as far as it can. Dadda reduction uses the fewest full
+// and half adders that bring each stage down to the next Dadda height.
+// The reduction is planned once, so process() and synthesize() build
+// the same tree.
+//
+// Inputs are numbered column by column from weight 0, see input().
+// Outputs 0..W-1 are the first row by weight, W..2W-1 the second.
+// Carries out of the top column are dropped.
+
+enum class Reduction { Wallace, Dadda };
+
+class CompressorTree : public Component
+{
+  public:
+    CompressorTree() : Component(0, 0) {}
+    CompressorTree(const std::vector<int>& heights, Reduction reduction);
+
+    void process();
+
+    // Input channel of bit k in a column
+    int channel(int column, int k) const
+    {
+      return _offsets.at(column) + k;
+    }
+
+    Bus synthesize(Netlist& n, const Bus& inputs) const;
+
+    int inputs() const { return _inputs.size(); }
+    int width() const { return _offsets.size(); }
+    int stages() const { return _stages; }
+    int fullAdders() const { return _full.size(); }
+    int halfAdders() const { return _half.size(); }
+
+  private:
+    // A half adder if c is -1. Operands and results index _bits.
+    struct Step
+    {
+      int a, b, c;
+      int sum, carry;
+      int gate;
+    };
+
+    std::vector<int> _offsets;
+    std::vector<Step> _steps;
+    std::vector<int> _rows[2];
+    int _stages = 0;
+
+    std::vector<FullAdder> _full;
+    std::vector<HalfAdder> _half;
+    std::vector<Signal> _bits;
+};
+
+
+// One cell of a prefix carry network. It merges the (generate,
+// propagate) span ending at position high with the span below it that
+// ends at low. Positions count up from the least significant bit.
+
+struct PrefixCell
+{
+  int high, low;
+
+  // Only needed when a later cell reads the merged propagate
+  bool propagate;
+};
+
+
+// Carry architectures for WordAdder
+
+// A chain of full adders. Fewest gates, depth linear in N.
+struct RippleCarry {};
+
+// Blocks of about sqrt(N) bits added twice, once for each carry in,
+// with the real carry picking between them
+struct CarrySelect
+{
+  static int block(int width);
+};
+
+// Lookahead inside groups of four, group carries rippling between them
+struct CarryLookahead
+{
+  static std::vector<PrefixCell> network(int width);
+};
+
+// log2 N levels with a cell at nearly every position on each.
+// Shallowest, and the most gates.
+struct KoggeStone
+{
+  static std::vector<PrefixCell> network(int width);
+};
+
+// A tree up and back down, about 2N cells over 2 log2 N levels
+struct BrentKung
+{
+  static std::vector<PrefixCell> network(int width);
+};
+
+
 // Add two N-bit words
 // Two word inputs and a single word output
 
-template <int N>
+template <int N, typename Arch = RippleCarry>
 class WordAdder : public WordComponent<N>
 {
   public:
-    WordAdder() : WordComponent<N>(2, 1), _adders(N) {}
+    WordAdder();
  
     void process();
 
+    static Bus synthesize(Netlist& n, const Bus& a, const Bus& b);
+
+    // Add a whole array of operand pairs, out[i] = a[i] + b[i]
+    void processBatch(const std::vector<Word<N>>& a,
+                      const std::vector<Word<N>>& b,
+                      std::vector<Word<N>>& out) const;
+
   private:
+    void processRipple();
+    void processSelect();
+    void processPrefix();
+
+    // Ripple carry, or both chains of carry select
     std::vector<FullAdder> _adders;
+    std::vector<Multiplexer> _muxes;
+
+    // Prefix adders: a half adder per bit gives (propagate, generate),
+    // then AND/OR gates for each cell, then XORs for the sum
+    std::vector<PrefixCell> _cells;
+    std::vector<HalfAdder> _halfAdders;
+    std::vector<AND> _ands;
+    std::vector<OR> _ors;
+    std::vector<XOR> _sums;
+    std::vector<Signal> _generate, _propagate;
+};
+
+
+// Gates and depth of a synthesized adder, to compare architectures
+
+struct AdderReport
+{
+  int gates, depth;
+};
+
+template <int N, typename Arch>
+AdderReport adderReport();
+
+
+// Stands in for a member that a component's configuration doesn't use
+struct Unused {};
+
+
+// Ways to sum a multiplier's partial products
+
+// One row per bit of input 0, added in with a chain of N-1 adders
+struct ShiftAdd {};
+
+// A compressor tree down to two rows, then one fast adder
+struct Wallace
+{
+  static const Reduction reduction = Reduction::Wallace;
+};
+
+struct Dadda
+{
+  static const Reduction reduction = Reduction::Dadda;
 };
 
 
 // Parameterized on word size
 // Hard to explain the logic on this one, but I ended up making
 // a lot of drawings. 
+// The tree versions sum the same partial products by weight, with
+// Final as the architecture of the adder at the bottom.
 
-template <int N>
+template <int N, typename Tree = ShiftAdd, typename Final = KoggeStone>
 class WordMultiplier : public WordComponent<N>
 {
   public:
-    WordMultiplier() : 
-      WordComponent<N>(2, 1),
-      _gates((N*N+N)/2), // Geometric series!
-      _adders(N-1) {}
+    WordMultiplier();
 
     void process();
 
+    static Bus synthesize(Netlist& n, const Bus& a, const Bus& b);
+
+    // Multiply a whole array of operand pairs, out[i] = a[i] * b[i]
+    void processBatch(const std::vector<Word<N>>& a,
+                      const std::vector<Word<N>>& b,
+                      std::vector<Word<N>>& out) const;
+
   private:
+    static const bool shiftAdd = std::is_same<Tree, ShiftAdd>::value;
+
     std::vector<AND> _gates;
     std::vector<WordAdder<N>> _adders;
+
+    // One row of partial products per bit of input 0
+    std::vector<Word<N>> _rows;
+
+    // Or, a column per weight
+    std::conditional_t<shiftAdd, Unused, CompressorTree> _tree;
+    std::conditional_t<shiftAdd, Unused, WordAdder<N, Final>> _final;
 };
 
+
+// Column heights of the partial products of an N-bit product,
+// keeping the low N bits
+std::vector<int> partialProducts(int width);
+
 // Parameterized on word size
 template <int N>
 class ALU : public WordControlComponent<N>
@@ -83,6 +265,16 @@ class ALU : public WordControlComponent<N>
 
     void process();
 
+    // Controls are the two select nets
+    static Bus synthesize(Netlist& n, const Bus& a, const Bus& b,
+                          const Bus& controls);
+
+    // Apply the currently selected operation to a whole array of
+    // operand pairs, out[i] = a[i] op b[i]
+    void processBatch(const std::vector<Word<N>>& a,
+                      const std::vector<Word<N>>& b,
+                      std::vector<Word<N>>& out) const;
+
   private:
     WordAdder<N> _add;
     WordMultiplier<N> _mul;
@@ -140,8 +332,299 @@ void FullAdder::process()
   _outputs.at(1) = _gate0.output();
 }
 
-template <int N>
-void WordAdder<N>::process()
+CompressorTree::CompressorTree(const std::vector<int>& heights, Reduction reduction) :
+  Component(0, 2 * heights.size()),
+  _offsets(heights.size())
+{
+  int width = heights.size();
+  int slots = 0;
+
+  std::vector<std::vector<int>> columns(width);
+  for (auto w = 0; w < width; ++w)
+  {
+    _offsets.at(w) = slots;
+    for (auto k = 0; k < heights.at(w); ++k) columns.at(w).push_back(slots++);
+  }
+  _inputs.resize(slots);
+
+  // New bits get the next free number
+  int full = 0, half = 0;
+  auto add = [&](int a, int b, int c)
+  {
+    Step step = {a, b, c, slots, slots + 1, c < 0 ? half++ : full++};
+    slots += 2;
+    _steps.push_back(step);
+    return step;
+  };
+
+  // Sum stays in the column, carry goes up one unless it's off the top
+  auto place = [&](const Step& step, int w, std::vector<std::vector<int>>& next)
+  {
+    next.at(w).push_back(step.sum);
+    if (w + 1 < width) next.at(w + 1).push_back(step.carry);
+  };
+
+  auto tallest = [&]
+  {
+    size_t h = 0;
+    for (auto& column : columns) h = std::max(h, column.size());
+    return (int) h;
+  };
+
+  while (tallest() > 2)
+  {
+    std::vector<std::vector<int>> next(width);
+
+    if (reduction == Reduction::Wallace)
+    {
+      // Carries sideways from the first half of each 4:2 compressor in
+      // the column below, waiting to go in the second half of one here
+      std::vector<int> sideways, above;
+
+      for (auto w = 0; w < width; ++w)
+      {
+        auto& column = columns.at(w);
+        size_t i = 0;
+
+        for (; column.size() - i >= 4; i += 4)
+        {
+          Step first = add(column.at(i), column.at(i+1), column.at(i+2));
+          above.push_back(first.carry);
+
+          int c = -1;
+          if (!sideways.empty())
+          {
+            c = sideways.back();
+            sideways.pop_back();
+          }
+          place(add(first.sum, column.at(i+3), c), w, next);
+        }
+
+        // Whatever's left, with any sideways carries still unused
+        std::vector<int> rest(column.begin() + i, column.end());
+        rest.insert(rest.end(), sideways.begin(), sideways.end());
+
+        size_t j = 0;
+        for (; rest.size() - j >= 3; j += 3)
+        {
+          place(add(rest.at(j), rest.at(j+1), rest.at(j+2)), w, next);
+        }
+        for (; j < rest.size(); ++j) next.at(w).push_back(rest.at(j));
+
+        sideways.swap(above);
+        above.clear();
+      }
+    }
+    else
+    {
+      // Largest Dadda height (2, 3, 4, 6, 9, 13...) below the tallest column
+      int target = 2;
+      while (target * 3 / 2 < tallest()) target = target * 3 / 2;
+
+      for (auto w = 0; w < width; ++w)
+      {
+        auto& column = columns.at(w);
+        size_t i = 0;
+
+        // Carries from the column below count towards this one
+        int height = column.size() + next.at(w).size();
+
+        while (height > target)
+        {
+          if (height - target >= 2 && column.size() - i >= 3)
+          {
+            place(add(column.at(i), column.at(i+1), column.at(i+2)), w, next);
+            i += 3;
+            height -= 2;
+          }
+          else
+          {
+            place(add(column.at(i), column.at(i+1), -1), w, next);
+            i += 2;
+            height -= 1;
+          }
+        }
+
+        for (; i < column.size(); ++i) next.at(w).push_back(column.at(i));
+      }
+    }
+
+    columns.swap(next);
+    ++_stages;
+  }
+
+  for (auto w = 0; w < width; ++w)
+  {
+    auto& column = columns.at(w);
+    _rows[0].push_back(column.size() > 0 ? column.at(0) : -1);
+    _rows[1].push_back(column.size() > 1 ? column.at(1) : -1);
+  }
+
+  _full.resize(full);
+  _half.resize(half);
+  _bits.resize(slots);
+}
+
+void CompressorTree::process()
+{
+  std::copy(_inputs.begin(), _inputs.end(), _bits.begin());
+
+  for (auto& step : _steps)
+  {
+    if (step.c < 0)
+    {
+      HalfAdder& h = _half.at(step.gate);
+      h.input(0, _bits.at(step.a));
+      h.input(1, _bits.at(step.b));
+      h.process();
+      _bits.at(step.sum) = h.output(0);
+      _bits.at(step.carry) = h.output(1);
+    }
+    else
+    {
+      FullAdder& f = _full.at(step.gate);
+      f.input(0, _bits.at(step.a));
+      f.input(1, _bits.at(step.b));
+      f.input(2, _bits.at(step.c));
+      f.process();
+      _bits.at(step.sum) = f.output(0);
+      _bits.at(step.carry) = f.output(1);
+    }
+  }
+
+  int width = this->width();
+  for (auto r = 0; r < 2; ++r)
+  {
+    for (auto w = 0; w < width; ++w)
+    {
+      int bit = _rows[r].at(w);
+      _outputs.at(r * width + w) = bit < 0 ? 0 : _bits.at(bit);
+    }
+  }
+}
+
+std::vector<PrefixCell> finishNetwork(std::vector<PrefixCell> cells, int width)
+{
+  // Nothing uses the carry out of the top bit
+  cells.erase(std::remove_if(cells.begin(), cells.end(),
+    [&](const PrefixCell& c) { return c.high == width - 1; }), cells.end());
+
+  // Every cell reads the propagate at high, and the one at low too if
+  // it merges propagates itself
+  std::vector<bool> needed(width, false);
+  for (auto c = cells.rbegin(); c != cells.rend(); ++c)
+  {
+    c->propagate = needed.at(c->high);
+    needed.at(c->high) = true;
+    if (c->propagate) needed.at(c->low) = true;
+  }
+
+  return cells;
+}
+
+int CarrySelect::block(int width)
+{
+  int b = 1;
+  while (b * b < width) ++b;
+  return b;
+}
+
+std::vector<PrefixCell> CarryLookahead::network(int width)
+{
+  std::vector<PrefixCell> cells;
+
+  // Within a group, e.g. 3:2 and 1:0, then 2:0 and 3:0
+  for (auto b = 0; b < width; b += 4)
+  {
+    if (b + 3 < width) cells.push_back({b + 3, b + 2, false});
+    if (b + 1 < width) cells.push_back({b + 1, b, false});
+    if (b + 2 < width) cells.push_back({b + 2, b + 1, false});
+    if (b + 3 < width) cells.push_back({b + 3, b + 1, false});
+  }
+
+  // Group carries ripple, then every group fills in below its top
+  for (auto b = 4; b < width; b += 4)
+  {
+    cells.push_back({std::min(b + 3, width - 1), b - 1, false});
+  }
+  for (auto b = 4; b < width; b += 4)
+  {
+    for (auto i = b; i < std::min(b + 3, width - 1); ++i) cells.push_back({i, b - 1, false});
+  }
+
+  return finishNetwork(cells, width);
+}
+
+std::vector<PrefixCell> KoggeStone::network(int width)
+{
+  std::vector<PrefixCell> cells;
+
+  // Top down, so each level reads the level before it
+  for (auto d = 1; d < width; d *= 2)
+  {
+    for (auto i = width - 1; i >= d; --i) cells.push_back({i, i - d, false});
+  }
+
+  return finishNetwork(cells, width);
+}
+
+std::vector<PrefixCell> BrentKung::network(int width)
+{
+  std::vector<PrefixCell> cells;
+  int top = 1;
+
+  // Up: spans of 2, 4, 8... ending at 2d-1, 4d-1...
+  for (auto d = 1; d < width; d *= 2)
+  {
+    for (auto i = 2 * d - 1; i < width; i += 2 * d) cells.push_back({i, i - d, false});
+    top = d;
+  }
+
+  // Down: fill in the positions halfway between
+  for (auto d = top / 2; d >= 1; d /= 2)
+  {
+    for (auto i = 3 * d - 1; i < width; i += 2 * d) cells.push_back({i, i - d, false});
+  }
+
+  return finishNetwork(cells, width);
+}
+
+template <int N, typename Arch>
+WordAdder<N, Arch>::WordAdder() : WordComponent<N>(2, 1)
+{
+  if constexpr (std::is_same<Arch, RippleCarry>::value)
+  {
+    _adders.resize(N);
+  }
+  else if constexpr (std::is_same<Arch, CarrySelect>::value)
+  {
+    int b = std::min(CarrySelect::block(N), N);
+    int blocks = (N + b - 1) / b;
+    _adders.resize(2 * N - b);
+    _muxes.resize(N - b + blocks - 1);
+  }
+  else
+  {
+    _cells = Arch::network(N);
+    _halfAdders.resize(N);
+    _ands.resize(2 * _cells.size());
+    _ors.resize(_cells.size());
+    _sums.resize(N);
+    _generate.resize(N);
+    _propagate.resize(N);
+  }
+}
+
+template <int N, typename Arch>
+void WordAdder<N, Arch>::process()
+{
+  if constexpr (std::is_same<Arch, RippleCarry>::value) processRipple();
+  else if constexpr (std::is_same<Arch, CarrySelect>::value) processSelect();
+  else processPrefix();
+}
+
+template <int N, typename Arch>
+void WordAdder<N, Arch>::processRipple()
 {
   Word<N>& word0 = this->_inputs.at(0);
   Word<N>& word1 = this->_inputs.at(1);
@@ -164,40 +647,194 @@ void WordAdder<N>::process()
   } 
 } 
 
-template <int N>
-void WordMultiplier<N>::process()
+template <int N, typename Arch>
+void WordAdder<N, Arch>::processSelect()
 {
-  for (auto i = 0; i < N; ++i) // Rows
+  Word<N>& word0 = this->_inputs.at(0);
+  Word<N>& word1 = this->_inputs.at(1);
+  Word<N>& result = this->_outputs.at(0);
+
+  int b = std::min(CarrySelect::block(N), N);
+  Signal carry = 0;
+
+  for (auto start = 0, block = 0; start < N; start += b, ++block)
   {
-    std::vector<Signal> v0(N, 0); // Init to zeroes
+    int end = std::min(start + b, N);
 
-    for (auto j = N - 1; j >= i; --j) // Columns
+    // Adders [0, N) assume no carry in, [N, 2N-b) assume one
+    for (auto copy = 0; copy < (start == 0 ? 1 : 2); ++copy)
     {
-      // This turns a "square" index into a flattened "triangle"
-      auto index = N*i+j - ((i*i+i)/2);
-      AND& g = _gates.at(index);
-      g.input(0,this->_inputs.at(0).bit(N-i-1));
-      g.input(1,this->_inputs.at(1).bit(j));
-      g.process();
-      v0.at(j-i) = g.output(); // Fill result array 
+      for (auto pos = start; pos < end; ++pos)
+      {
+        FullAdder& a = _adders.at(copy ? N + pos - b : pos);
+        a.input(0, word0.bit(N-1-pos));
+        a.input(1, word1.bit(N-1-pos));
+        a.input(2, pos == start ? copy : _adders.at(copy ? N + pos - b - 1 : pos - 1).output(1));
+        a.process();
+      }
     }
 
-    // Create a word from the vector
-    Word<N> w0(v0);
+    if (start == 0)
+    {
+      for (auto pos = start; pos < end; ++pos) result.bit(N-1-pos) = _adders.at(pos).output(0);
+      carry = _adders.at(end - 1).output(1);
+      continue;
+    }
 
-    // Adder 0 takes input from first set of partial products
-    if (i == 0)
+    for (auto pos = start; pos < end; ++pos)
     {
-      _adders.at(i).input(0, w0);
-    } 
-    // Other adders take input from previous adder
-    else
+      Multiplexer& m = _muxes.at(pos - b);
+      m.input(0, _adders.at(pos).output(0));
+      m.input(1, _adders.at(N + pos - b).output(0));
+      m.control(0, carry);
+      m.process();
+      result.bit(N-1-pos) = m.output();
+    }
+
+    if (end < N)
     {
-      _adders.at(i-1).input(1, w0);          
-      _adders.at(i-1).process();
-      Word<N> w = _adders.at(i-1).output();
-      if (i + 1 == N) this->_outputs.at(0) = w;
-      else _adders.at(i).input(0, w);
+      Multiplexer& m = _muxes.at(N - b + block - 1);
+      m.input(0, _adders.at(end - 1).output(1));
+      m.input(1, _adders.at(N + end - 1 - b).output(1));
+      m.control(0, carry);
+      m.process();
+      carry = m.output();
+    }
+  }
+}
+
+template <int N, typename Arch>
+void WordAdder<N, Arch>::processPrefix()
+{
+  Word<N>& word0 = this->_inputs.at(0);
+  Word<N>& word1 = this->_inputs.at(1);
+  Word<N>& result = this->_outputs.at(0);
+
+  for (auto pos = 0; pos < N; ++pos)
+  {
+    HalfAdder& h = _halfAdders.at(pos);
+    h.input(0, word0.bit(N-1-pos));
+    h.input(1, word1.bit(N-1-pos));
+    h.process();
+    _propagate.at(pos) = h.output(0);
+    _generate.at(pos) = h.output(1);
+  }
+
+  // G = G high | (P high & G low), P = P high & P low
+  for (size_t k = 0; k < _cells.size(); ++k)
+  {
+    const PrefixCell& c = _cells.at(k);
+
+    AND& g = _ands.at(2*k);
+    g.input(0, _propagate.at(c.high));
+    g.input(1, _generate.at(c.low));
+    g.process();
+
+    OR& o = _ors.at(k);
+    o.input(0, _generate.at(c.high));
+    o.input(1, g.output());
+    o.process();
+    _generate.at(c.high) = o.output();
+
+    if (c.propagate)
+    {
+      AND& p = _ands.at(2*k+1);
+      p.input(0, _propagate.at(c.high));
+      p.input(1, _propagate.at(c.low));
+      p.process();
+      _propagate.at(c.high) = p.output();
+    }
+  }
+
+  // Each generate now spans down to bit 0, so it's the carry into the
+  // position above
+  result.bit(N-1) = _halfAdders.at(0).output(0);
+  for (auto pos = 1; pos < N; ++pos)
+  {
+    XOR& x = _sums.at(pos);
+    x.input(0, _halfAdders.at(pos).output(0));
+    x.input(1, _generate.at(pos-1));
+    x.process();
+    result.bit(N-1-pos) = x.output();
+  }
+}
+
+template <int N, typename Tree, typename Final>
+WordMultiplier<N, Tree, Final>::WordMultiplier() :
+  WordComponent<N>(2, 1),
+  _gates((N*N+N)/2) // Geometric series!
+{
+  if constexpr (shiftAdd)
+  {
+    _adders.resize(N-1);
+    _rows.resize(N);
+  }
+  else
+  {
+    _tree = CompressorTree(partialProducts(N), Tree::reduction);
+  }
+}
+
+template <int N, typename Tree, typename Final>
+void WordMultiplier<N, Tree, Final>::process()
+{
+  // The AND gates only depend on the inputs, so every partial product
+  // is on the same logic level. Wide multipliers split the rows up.
+  ThreadPool::instance().parallelFor(N, [this](int begin, int end)
+  {
+    for (auto i = begin; i < end; ++i) // Rows
+    {
+      for (auto j = N - 1; j >= i; --j) // Columns
+      {
+        // This turns a "square" index into a flattened "triangle"
+        auto index = N*i+j - ((i*i+i)/2);
+        AND& g = _gates.at(index);
+        g.input(0,this->_inputs.at(0).bit(N-i-1));
+        g.input(1,this->_inputs.at(1).bit(j));
+        g.process();
+
+        if constexpr (shiftAdd) _rows.at(i).bit(j-i) = g.output(); // Fill result array
+        else _tree.input(_tree.channel(i + N-1-j, i), g.output()); // By weight
+      }
+    }
+  }, std::max(1, 2048 / N));
+
+  if constexpr (!shiftAdd)
+  {
+    _tree.process();
+
+    Word<N> row0, row1;
+    for (auto w = 0; w < N; ++w)
+    {
+      row0.bit(N-1-w) = _tree.output(w);
+      row1.bit(N-1-w) = _tree.output(N + w);
+    }
+
+    _final.input(0, row0);
+    _final.input(1, row1);
+    _final.process();
+    this->_outputs.at(0) = _final.output();
+  }
+  else
+  {
+    for (auto i = 0; i < N; ++i) // Rows
+    {
+      const Word<N>& w0 = _rows.at(i);
+
+      // Adder 0 takes input from first set of partial products
+      if (i == 0)
+      {
+        _adders.at(i).input(0, w0);
+      } 
+      // Other adders take input from previous adder
+      else
+      {
+        _adders.at(i-1).input(1, w0);          
+        _adders.at(i-1).process();
+        Word<N> w = _adders.at(i-1).output();
+        if (i + 1 == N) this->_outputs.at(0) = w;
+        else _adders.at(i).input(0, w);
+      }
     }
   }
 }
@@ -233,6 +870,249 @@ void ALU<N>::process()
   this->_outputs.at(0) = _mux.output();
 }
 
+// NETLIST DEFINITIONS
+
+Bus HalfAdder::synthesize(Netlist& n, Net a, Net b)
+{
+  return {XOR::synthesize(n, a, b), AND::synthesize(n, a, b)};
+}
+
+Bus FullAdder::synthesize(Netlist& n, Net a, Net b, Net carry)
+{
+  Bus adder0 = HalfAdder::synthesize(n, a, b);
+  Bus adder1 = HalfAdder::synthesize(n, adder0.at(0), carry);
+  return {adder1.at(0), OR::synthesize(n, adder0.at(1), adder1.at(1))};
+}
+
+template <int N, typename Arch>
+Bus WordAdder<N, Arch>::synthesize(Netlist& n, const Bus& a, const Bus& b)
+{
+  Bus result(N);
+
+  if constexpr (std::is_same<Arch, RippleCarry>::value)
+  {
+    Net carry = n.constant(0);
+
+    for (auto i = N-1; i >= 0; --i)
+    {
+      Bus sum = FullAdder::synthesize(n, a.at(i), b.at(i), carry);
+      result.at(i) = sum.at(0);
+      carry = sum.at(1);
+    }
+  }
+  else if constexpr (std::is_same<Arch, CarrySelect>::value)
+  {
+    int size = std::min(CarrySelect::block(N), N);
+    Net carry = n.constant(0);
+
+    for (auto start = 0; start < N; start += size)
+    {
+      int end = std::min(start + size, N);
+      Bus sums[2];
+      Net carries[2];
+
+      for (auto copy = 0; copy < (start == 0 ? 1 : 2); ++copy)
+      {
+        carries[copy] = n.constant(copy);
+        for (auto pos = start; pos < end; ++pos)
+        {
+          Bus sum = FullAdder::synthesize(n, a.at(N-1-pos), b.at(N-1-pos), carries[copy]);
+          sums[copy].push_back(sum.at(0));
+          carries[copy] = sum.at(1);
+        }
+      }
+
+      for (auto pos = start; pos < end; ++pos)
+      {
+        result.at(N-1-pos) = start == 0 ? sums[0].at(pos - start) :
+          Multiplexer::synthesize(n, sums[0].at(pos - start), sums[1].at(pos - start), carry);
+      }
+
+      if (end < N)
+      {
+        carry = start == 0 ? carries[0] :
+          Multiplexer::synthesize(n, carries[0], carries[1], carry);
+      }
+    }
+  }
+  else
+  {
+    Bus propagate(N), generate(N), sum(N);
+
+    for (auto pos = 0; pos < N; ++pos)
+    {
+      Bus h = HalfAdder::synthesize(n, a.at(N-1-pos), b.at(N-1-pos));
+      sum.at(pos) = propagate.at(pos) = h.at(0);
+      generate.at(pos) = h.at(1);
+    }
+
+    for (const PrefixCell& c : Arch::network(N))
+    {
+      Net g = AND::synthesize(n, propagate.at(c.high), generate.at(c.low));
+      if (c.propagate)
+      {
+        propagate.at(c.high) = AND::synthesize(n, propagate.at(c.high), propagate.at(c.low));
+      }
+      generate.at(c.high) = OR::synthesize(n, generate.at(c.high), g);
+    }
+
+    result.at(N-1) = sum.at(0);
+    for (auto pos = 1; pos < N; ++pos)
+    {
+      result.at(N-1-pos) = XOR::synthesize(n, sum.at(pos), generate.at(pos-1));
+    }
+  }
+
+  return result;
+}
+
+std::vector<int> partialProducts(int width)
+{
+  std::vector<int> heights(width);
+  for (auto w = 0; w < width; ++w) heights.at(w) = w + 1;
+  return heights;
+}
+
+Bus CompressorTree::synthesize(Netlist& n, const Bus& inputs) const
+{
+  Bus bits(_bits.size());
+  std::copy(inputs.begin(), inputs.end(), bits.begin());
+
+  for (auto& step : _steps)
+  {
+    Bus sum = step.c < 0 ?
+      HalfAdder::synthesize(n, bits.at(step.a), bits.at(step.b)) :
+      FullAdder::synthesize(n, bits.at(step.a), bits.at(step.b), bits.at(step.c));
+    bits.at(step.sum) = sum.at(0);
+    bits.at(step.carry) = sum.at(1);
+  }
+
+  Bus out;
+  for (auto r = 0; r < 2; ++r)
+  {
+    for (auto bit : _rows[r]) out.push_back(bit < 0 ? n.constant(0) : bits.at(bit));
+  }
+  return out;
+}
+
+template <int N, typename Tree, typename Final>
+Bus WordMultiplier<N, Tree, Final>::synthesize(Netlist& n, const Bus& a, const Bus& b)
+{
+  if constexpr (std::is_same<Tree, ShiftAdd>::value)
+  {
+    Bus sum;
+
+    for (auto i = 0; i < N; ++i) // Rows
+    {
+      Bus row(N, n.constant(0));
+
+      for (auto j = N - 1; j >= i; --j) // Columns
+      {
+        row.at(j-i) = AND::synthesize(n, a.at(N-i-1), b.at(j));
+      }
+
+      sum = i == 0 ? row : WordAdder<N>::synthesize(n, sum, row);
+    }
+
+    return sum;
+  }
+  else
+  {
+    static const CompressorTree tree(partialProducts(N), Tree::reduction);
+    Bus products(tree.inputs());
+
+    for (auto i = 0; i < N; ++i)
+    {
+      for (auto j = N - 1; j >= i; --j)
+      {
+        products.at(tree.channel(i + N-1-j, i)) = AND::synthesize(n, a.at(N-i-1), b.at(j));
+      }
+    }
+
+    Bus rows = tree.synthesize(n, products);
+    Bus row0(N), row1(N);
+    for (auto w = 0; w < N; ++w)
+    {
+      row0.at(N-1-w) = rows.at(w);
+      row1.at(N-1-w) = rows.at(N + w);
+    }
+
+    return WordAdder<N, Final>::synthesize(n, row0, row1);
+  }
+}
+
+template <int N>
+Bus ALU<N>::synthesize(Netlist& n, const Bus& a, const Bus& b,
+                       const Bus& controls)
+{
+  std::vector<Bus> results = {
+    WordAdder<N>::synthesize(n, a, b),
+    WordMultiplier<N>::synthesize(n, a, b),
+    WordAND<N>::synthesize(n, a, b),
+    WordOR<N>::synthesize(n, a, b)
+  };
+
+  return Nto1WordMultiplexer<2, N>::synthesize(n, results, controls);
+}
+
+
+template <int N, typename Arch>
+AdderReport adderReport()
+{
+  Netlist n;
+  Bus a = n.input(N);
+  Bus b = n.input(N);
+  WordAdder<N, Arch>::synthesize(n, a, b);
+  return {n.gates(), n.depth()};
+}
+
+
+
+// BATCH DEFINITIONS
+
+template <int N, typename Arch>
+void WordAdder<N, Arch>::processBatch(const std::vector<Word<N>>& a,
+                                      const std::vector<Word<N>>& b,
+                                      std::vector<Word<N>>& out) const
+{
+  static const BatchCircuit<N> circuit(0,
+    [](Netlist& n, const Bus& a, const Bus& b, const Bus&)
+    {
+      return synthesize(n, a, b);
+    });
+
+  circuit.run(a, b, {}, out);
+}
+
+template <int N, typename Tree, typename Final>
+void WordMultiplier<N, Tree, Final>::processBatch(const std::vector<Word<N>>& a,
+                                                  const std::vector<Word<N>>& b,
+                                                  std::vector<Word<N>>& out) const
+{
+  static const BatchCircuit<N> circuit(0,
+    [](Netlist& n, const Bus& a, const Bus& b, const Bus&)
+    {
+      return synthesize(n, a, b);
+    });
+
+  circuit.run(a, b, {}, out);
+}
+
+template <int N>
+void ALU<N>::processBatch(const std::vector<Word<N>>& a,
+                          const std::vector<Word<N>>& b,
+                          std::vector<Word<N>>& out) const
+{
+  static const BatchCircuit<N> circuit(2,
+    [](Netlist& n, const Bus& a, const Bus& b, const Bus& controls)
+    {
+      return synthesize(n, a, b, controls);
+    });
+
+  circuit.run(a, b, this->_controls, out);
+}
+
+
 // ARITHMETIC TESTS
 
 
@@ -360,6 +1240,83 @@ void testWordAdder()
   assert(b.output() == Word<8>({0,1,0,0,1,1,1,0}));
 }
 
+template <typename Arch, int N>
+void testAdderArchitecture()
+{
+  WordAdder<N, Arch> adder;
+  Netlist n;
+  Bus a = n.input(N);
+  Bus b = n.input(N);
+  Bus out = WordAdder<N, Arch>::synthesize(n, a, b);
+  NetlistSimulator s(n);
+
+  auto check = [&](uint64_t x, uint64_t y)
+  {
+    uint64_t mask = N == 64 ? ~0ull : (1ull << N) - 1;
+    adder.input(0, Word<N>::fromInt(x));
+    adder.input(1, Word<N>::fromInt(y));
+    adder.process();
+    assert(adder.output().toInt() == ((x + y) & mask));
+
+    s.set(a, Word<N>::fromInt(x));
+    s.set(b, Word<N>::fromInt(y));
+    s.evaluate();
+    assert(s.get<N>(out) == adder.output());
+  };
+
+  if (N <= 6)
+  {
+    for (uint64_t x = 0; x < (1u << N); ++x)
+    {
+      for (uint64_t y = 0; y < (1u << N); ++y) check(x, y);
+    }
+  }
+  else
+  {
+    check(~0ull, 1);
+    check(~0ull, ~0ull);
+    srand(N);
+    for (auto i = 0; i < 200; ++i)
+    {
+      check(((uint64_t)rand() << 32) ^ rand(), ((uint64_t)rand() << 32) ^ rand());
+    }
+  }
+}
+
+template <typename Arch>
+void testAdderArchitecture()
+{
+  testAdderArchitecture<Arch, 1>();
+  testAdderArchitecture<Arch, 4>();
+  testAdderArchitecture<Arch, 5>();
+  testAdderArchitecture<Arch, 6>();
+  testAdderArchitecture<Arch, 13>();
+  testAdderArchitecture<Arch, 32>();
+  testAdderArchitecture<Arch, 64>();
+}
+
+void testAdderArchitectures()
+{
+  testAdderArchitecture<RippleCarry>();
+  testAdderArchitecture<CarrySelect>();
+  testAdderArchitecture<CarryLookahead>();
+  testAdderArchitecture<KoggeStone>();
+  testAdderArchitecture<BrentKung>();
+
+  // Every fast adder is shallower than ripple carry, Kogge-Stone most
+  // of all, and pays for it in gates
+  AdderReport ripple = adderReport<64, RippleCarry>();
+  AdderReport select = adderReport<64, CarrySelect>();
+  AdderReport lookahead = adderReport<64, CarryLookahead>();
+  AdderReport kogge = adderReport<64, KoggeStone>();
+  AdderReport brent = adderReport<64, BrentKung>();
+
+  for (auto r : {select, lookahead, kogge, brent}) assert(r.depth < ripple.depth);
+  assert(kogge.depth <= brent.depth);
+  assert(kogge.gates > brent.gates);
+  assert(brent.gates > ripple.gates);
+}
+
 void testWordMultiplier()
 {
   WordMultiplier<4> m0;
@@ -387,6 +1344,99 @@ void testWordMultiplier()
   assert(m1.output() == w5);
 }
 
+void testCompressorTree()
+{
+  // Six bits of weight 0 and one of weight 1 make 6 + 2 = 8, whichever
+  // way the tree reduces them
+  for (auto reduction : {Reduction::Wallace, Reduction::Dadda})
+  {
+    CompressorTree tree({6, 1, 0, 0}, reduction);
+    assert(tree.inputs() == 7);
+    assert(tree.stages() > 0);
+
+    for (auto i = 0; i < 7; ++i) tree.input(i, 1);
+    tree.process();
+
+    uint64_t total = 0;
+    for (auto w = 0; w < 4; ++w) total += (tree.output(w) + tree.output(4 + w)) << w;
+    assert(total == 8);
+  }
+}
+
+template <typename Tree, int N>
+void testTreeMultiplier()
+{
+  WordMultiplier<N, Tree> m;
+  Netlist n;
+  Bus a = n.input(N);
+  Bus b = n.input(N);
+  Bus out = WordMultiplier<N, Tree>::synthesize(n, a, b);
+  NetlistSimulator s(n);
+
+  auto check = [&](uint64_t x, uint64_t y)
+  {
+    uint64_t mask = N == 64 ? ~0ull : (1ull << N) - 1;
+    m.input(0, Word<N>::fromInt(x));
+    m.input(1, Word<N>::fromInt(y));
+    m.process();
+    assert(m.output().toInt() == ((x * y) & mask));
+
+    s.set(a, Word<N>::fromInt(x));
+    s.set(b, Word<N>::fromInt(y));
+    s.evaluate();
+    assert(s.get<N>(out) == m.output());
+  };
+
+  if (N <= 5)
+  {
+    for (uint64_t x = 0; x < (1u << N); ++x)
+    {
+      for (uint64_t y = 0; y < (1u << N); ++y) check(x, y);
+    }
+  }
+  else
+  {
+    check(~0ull, ~0ull);
+    srand(N);
+    for (auto i = 0; i < 50; ++i)
+    {
+      check(((uint64_t)rand() << 32) ^ rand(), ((uint64_t)rand() << 32) ^ rand());
+    }
+  }
+}
+
+void testTreeMultipliers()
+{
+  testCompressorTree();
+
+  testTreeMultiplier<Wallace, 1>();
+  testTreeMultiplier<Wallace, 4>();
+  testTreeMultiplier<Wallace, 5>();
+  testTreeMultiplier<Wallace, 13>();
+  testTreeMultiplier<Wallace, 32>();
+  testTreeMultiplier<Dadda, 1>();
+  testTreeMultiplier<Dadda, 4>();
+  testTreeMultiplier<Dadda, 5>();
+  testTreeMultiplier<Dadda, 13>();
+  testTreeMultiplier<Dadda, 32>();
+
+  // Same products, far fewer levels
+  auto depth = [](auto synthesize)
+  {
+    Netlist n;
+    Bus a = n.input(32);
+    Bus b = n.input(32);
+    synthesize(n, a, b);
+    return n.depth();
+  };
+
+  int array = depth(WordMultiplier<32>::synthesize);
+  int wallace = depth(WordMultiplier<32, Wallace>::synthesize);
+  int dadda = depth(WordMultiplier<32, Dadda>::synthesize);
+  assert(wallace * 3 < array);
+  assert(dadda * 3 < array);
+}
+
 void testALU()
 {
   ALU<16> a;
@@ -422,13 +1472,117 @@ void testALU()
   assert(a.output() == bor);
 }
 
+void testALUNetlist()
+{
+  ALU<8> a;
+
+  Netlist n;
+  Bus in0 = n.input(8);
+  Bus in1 = n.input(8);
+  Bus controls = n.input(2);
+  Bus out = ALU<8>::synthesize(n, in0, in1, controls);
+  NetlistSimulator s(n);
+
+  // Netlist and components agree on every operation
+  for (auto x : {0, 1, 7, 93, 200, 255})
+  {
+    for (auto y : {0, 3, 64, 129, 255})
+    {
+      for (auto op = 0; op < 4; ++op)
+      {
+        Word<8> w0 = Word<8>::fromInt(x);
+        Word<8> w1 = Word<8>::fromInt(y);
+
+        a.input(0, w0);
+        a.input(1, w1);
+        a.control(0, op >> 1);
+        a.control(1, op & 1);
+        a.process();
+
+        s.set(in0, w0);
+        s.set(in1, w1);
+        s.set(controls.at(0), op >> 1);
+        s.set(controls.at(1), op & 1);
+        s.evaluate();
+
+        assert(s.get<8>(out) == a.output());
+      }
+    }
+  }
+}
+
+void testProcessBatch()
+{
+  // Batches agree with one-at-a-time processing,
+  // including a final pass that doesn't fill all 64 lanes
+  std::vector<Word<16>> a, b, out;
+  srand(3);
+  for (auto i = 0; i < 150; ++i)
+  {
+    a.push_back(Word<16>::fromInt(rand()));
+    b.push_back(Word<16>::fromInt(rand()));
+  }
+
+  WordAdder<16> adder;
+  adder.processBatch(a, b, out);
+  assert(out.size() == a.size());
+  for (auto i = 0; i < (int) a.size(); ++i)
+  {
+    assert(out.at(i).toInt() == ((a.at(i).toInt() + b.at(i).toInt()) & 0xFFFF));
+  }
+
+  WordMultiplier<16> multiplier;
+  multiplier.processBatch(a, b, out);
+  for (auto i = 0; i < (int) a.size(); ++i)
+  {
+    assert(out.at(i).toInt() == ((a.at(i).toInt() * b.at(i).toInt()) & 0xFFFF));
+  }
+
+  ALU<16> alu;
+  for (auto op = 0; op < 4; ++op)
+  {
+    alu.control(0, op >> 1);
+    alu.control(1, op & 1);
+    alu.processBatch(a, b, out);
+
+    for (auto i = 0; i < (int) a.size(); i += 13)
+    {
+      alu.input(0, a.at(i));
+      alu.input(1, b.at(i));
+      alu.process();
+      assert(out.at(i) == alu.output());
+    }
+  }
+
+  // Empty batches are fine, mismatched ones aren't
+  std::vector<Word<16>> none;
+  adder.processBatch(none, none, out);
+  assert(out.empty());
+
+  bool thrown = false;
+  try
+  {
+    adder.processBatch(a, none, out);
+  }
+  catch (const std::invalid_argument&)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+}
+
+
 // Run all tests on ALU components
 void testArithmetic()
 {
   testHalfAdder();
   testFullAdder();
   testWordAdder();
+  testAdderArchitectures();
   testWordMultiplier();
+  testTreeMultipliers();
+  testALUNetlist();
+  testProcessBatch();
 }
 
 
@@ -0,0 +1,1199 @@
+#include <assert.h>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include <malloc.h>
+
+#include "ALU.hpp"
+#include "Cache.hpp"
+#include "Clock.hpp"
+#include "Memory.hpp"
+#include "Multiply.hpp"
+#include "Pipeline.hpp"
+#include "Server.hpp"
+#include "Systolic.hpp"
+#include "Timing.hpp"
+
+/*
+
+             --loob--
+
+            Benchmarks
+
+*/
+
+
+// Wall-clock seconds taken by f()
+template <typename F>
+double timeIt(F f)
+{
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  return d.count();
+}
+
+template <int N>
+Word<N> randomWord()
+{
+  Word<N> w;
+  for (auto i = 0; i < N; ++i) w.bit(i) = rand() % 2;
+  return w;
+}
+
+const std::vector<int> threadCounts = {1, 2, 4, 8, 16, 32, 64};
+
+
+// Evaluate a levelized WordMultiplier<256> netlist on 1 to 64 threads
+
+void benchLevelParallel()
+{
+  std::cout << "\nLEVEL-PARALLEL NETLIST: WordMultiplier<256>\n\n";
+
+  Netlist n;
+  Bus a = n.input(256);
+  Bus b = n.input(256);
+  Bus out = WordMultiplier<256>::synthesize(n, a, b);
+
+  std::cout << "NAND gates:   " << n.gates() << std::endl;
+  std::cout << "Depth:        " << n.depth() << std::endl;
+  std::cout << "Mean width:   " << n.gates() / n.depth() << std::endl;
+  std::cout << std::endl;
+
+  NetlistSimulator s(n);
+  s.set(a, randomWord<256>());
+  s.set(b, randomWord<256>());
+
+  ThreadPool pool(1);
+  double serial = 0;
+  const int reps = 5;
+
+  std::cout << "Threads   ms/eval   Speedup" << std::endl;
+  for (auto t : threadCounts)
+  {
+    pool.resize(t);
+    double seconds = timeIt([&] { for (auto r = 0; r < reps; ++r) s.evaluate(pool); });
+    if (t == 1) serial = seconds;
+
+    std::cout << std::setw(7) << t
+              << std::setw(10) << std::fixed << std::setprecision(2)
+              << 1000 * seconds / reps
+              << std::setw(10) << serial / seconds << std::endl;
+  }
+}
+
+
+// Component-level parallelism: partial products and RAM banks
+
+void benchComponentParallel()
+{
+  std::cout << "\nCOMPONENT PARALLELISM\n\n";
+
+  WordMultiplier<256> m;
+  m.input(0, randomWord<256>());
+  m.input(1, randomWord<256>());
+
+  RAM<13, 32> r;
+  r.input(0, randomWord<32>());
+
+  double mulSerial = 0, ramSerial = 0;
+
+  std::cout << "Threads   WordMultiplier<256> ms   RAM<13,32> ms" << std::endl;
+  for (auto t : threadCounts)
+  {
+    ThreadPool::instance().resize(t);
+    double mul = timeIt([&] { m.process(); });
+    double ram = timeIt([&] { r.processAll(); });
+    if (t == 1) mulSerial = mul, ramSerial = ram;
+
+    std::cout << std::setw(7) << t
+              << std::setw(13) << std::fixed << std::setprecision(2)
+              << 1000 * mul << " (" << mulSerial / mul << "x)"
+              << std::setw(10) << 1000 * ram << " (" << ramSerial / ram << "x)"
+              << std::endl;
+  }
+
+  ThreadPool::instance().resize(std::thread::hardware_concurrency());
+}
+
+
+// ALU -> RAM -> checker, serially and as three pipelined partitions
+
+void benchPipeline()
+{
+  std::cout << "\nPIPELINED PARTITIONS: ALU<32> -> RAM<9,32> -> check\n\n";
+
+  const uint64_t cycles = 2000;
+
+  ALU<32> alu;
+  RAM<9, 32> ram;
+  uint64_t check = 0;
+
+  auto compute = [&](uint64_t c)
+  {
+    alu.input(0, Word<32>::fromInt(c));
+    alu.input(1, Word<32>::fromInt(c * 7));
+    alu.control(0, c % 2);
+    alu.control(1, 0);
+    alu.process();
+  };
+
+  auto store = [&](uint64_t c, const Word<32>& w)
+  {
+    ram.input(0, w);
+    ram.control(0, 1);
+    for (auto i = 1; i < 9; ++i) ram.control(i, (c >> (8-i)) & 1);
+    ram.process();
+  };
+
+  double serial = timeIt([&]
+  {
+    for (uint64_t c = 0; c < cycles; ++c)
+    {
+      compute(c);
+      store(c, alu.output());
+      check += ram.output().toInt();
+    }
+  });
+
+  PartitionedSimulation sim;
+  auto& results = sim.channel<Word<32>>(8);
+  auto& stored = sim.channel<Word<32>>(8);
+
+  sim.partition([&](uint64_t c) { compute(c); results.put(alu.output()); });
+  sim.partition([&](uint64_t c) { store(c, results.take()); stored.put(ram.output()); });
+  sim.partition([&](uint64_t) { check += stored.take().toInt(); });
+
+  double pipelined = timeIt([&] { sim.run(cycles); });
+
+  std::cout << "Serial:       " << cycles / serial << " cycles/s" << std::endl;
+  std::cout << "Partitioned:  " << cycles / pipelined << " cycles/s ("
+            << serial / pipelined << "x)" << std::endl;
+}
+
+
+// One operand pair at a time versus processBatch()
+
+void benchBatch()
+{
+  std::cout << "\nBATCH EVALUATION: ALU<32> multiply, 100000 pairs\n\n";
+
+  const int count = 100000;
+  std::vector<Word<32>> a, b, out;
+  for (auto i = 0; i < count; ++i)
+  {
+    a.push_back(randomWord<32>());
+    b.push_back(randomWord<32>());
+  }
+
+  ALU<32> alu;
+  alu.control(0, 0);
+  alu.control(1, 1);
+
+  // Per-element loop is slow, so time a slice of it
+  const int sample = 2000;
+  double loop = timeIt([&]
+  {
+    for (auto i = 0; i < sample; ++i)
+    {
+      alu.input(0, a.at(i));
+      alu.input(1, b.at(i));
+      alu.process();
+    }
+  });
+
+  alu.processBatch(a, b, out); // Build the netlist outside the timing
+  double batch = timeIt([&] { alu.processBatch(a, b, out); });
+
+  std::cout << "process() loop:  " << sample / loop << " ops/s" << std::endl;
+  std::cout << "processBatch():  " << count / batch << " ops/s ("
+            << (count / batch) / (sample / loop) << "x)" << std::endl;
+}
+
+
+// Random reads and writes on RAM<12, 16>, decoded path vs every word
+
+void benchRAMPath()
+{
+  std::cout << "\nRAM ACCESS PATH: RAM<12, 16>, random reads and writes\n\n";
+
+  RAM<12, 16> ram;
+  const int count = 200;
+
+  auto traffic = [&](bool all)
+  {
+    srand(1);
+    for (auto i = 0; i < count; ++i)
+    {
+      ram.input(0, randomWord<16>());
+      for (auto c = 0; c < 12; ++c) ram.control(c, rand() % 2);
+      if (all) ram.processAll();
+      else ram.process();
+    }
+  };
+
+  double all = timeIt([&] { traffic(true); });
+  double path = timeIt([&] { traffic(false); });
+
+  std::cout << "processAll():  " << count / all << " ops/s" << std::endl;
+  std::cout << "process():     " << count / path << " ops/s ("
+            << all / path << "x)" << std::endl;
+}
+
+// Sequential and random runs on RAM<16, 32>, bursts versus process()
+
+void benchRAMBurst()
+{
+  std::cout << "\nRAM BURSTS: RAM<16, 32>, 32768 words\n\n";
+
+  const int count = 32768;
+  RAM<16, 32> ram;
+  std::vector<Word<32>> in(count), out(count);
+  for (auto& w : in) w = randomWord<32>();
+
+  std::vector<uint64_t> addresses(count);
+  for (auto& a : addresses) a = rand() % count;
+
+  auto single = [&](uint64_t a, Signal write, const Word<32>& w)
+  {
+    ram.input(0, w);
+    ram.control(0, write);
+    for (auto b = 1; b < 16; ++b) ram.control(b, (a >> (15-b)) & 1);
+    ram.process();
+  };
+
+  double writes = timeIt([&]
+  {
+    for (auto i = 0; i < count; ++i) single(i, 1, in.at(i));
+  });
+  double reads = timeIt([&]
+  {
+    for (auto i = 0; i < count; ++i) single(addresses.at(i), 0, in.at(i));
+  });
+
+  double writeBurst = timeIt([&] { ram.writeBurst(0, count, in.data()); });
+  double gather = timeIt([&] { ram.gather(addresses, out.data()); });
+
+  std::cout << "process() writes:  " << count / writes << " words/s" << std::endl;
+  std::cout << "writeBurst():      " << count / writeBurst << " words/s ("
+            << writes / writeBurst << "x)" << std::endl;
+  std::cout << "process() reads:   " << count / reads << " words/s" << std::endl;
+  std::cout << "gather():          " << count / gather << " words/s ("
+            << reads / gather << "x)" << std::endl;
+}
+
+
+// Fill RAM<16, 32> from an image file, versus one write per word
+
+void benchRAMImage()
+{
+  std::cout << "\nRAM IMAGE LOAD: RAM<16, 32>\n\n";
+
+  std::string path = "/tmp/loob-bench.ram";
+  RAMImage image(path, 16, 32);
+  for (uint64_t a = 0; a < image.words(); ++a)
+  {
+    image.write(a, randomWord<32>());
+  }
+
+  RAM<16, 32> ram;
+
+  double writes = timeIt([&]
+  {
+    for (uint64_t a = 0; a < image.words(); ++a)
+    {
+      ram.input(0, image.read<32>(a));
+      ram.control(0, 1);
+      for (auto b = 1; b < 16; ++b) ram.control(b, (a >> (15-b)) & 1);
+      ram.process();
+    }
+  });
+
+  double load = timeIt([&] { ram.load(image); });
+
+  std::cout << "process() per word:  " << writes << " s" << std::endl;
+  std::cout << "load():              " << load << " s ("
+            << writes / load << "x)" << std::endl;
+
+  unlink(path.c_str());
+}
+
+
+// Sixteen ports on sixteen banks, random traffic, 1 to 64 threads
+
+void benchBankedRAM()
+{
+  std::cout << "\nBANKED RAM: BankedRAM<12, 256, 16, 16>, 500 cycles\n\n";
+
+  const int M = 12, ports = 16, cycles = 500;
+  BankedRAM<M, 256, ports, 16> ram;
+
+  std::vector<std::vector<int>> controls(cycles, std::vector<int>(ports * M));
+  for (auto& c : controls)
+  {
+    for (auto& bit : c) bit = rand() % 2;
+  }
+  for (auto p = 0; p < ports; ++p) ram.input(p, randomWord<256>());
+
+  double serial = 0;
+
+  std::cout << "Threads   accesses/s" << std::endl;
+  for (auto t : threadCounts)
+  {
+    ThreadPool::instance().resize(t);
+    ram.resetCounters();
+
+    double time = timeIt([&]
+    {
+      for (auto& c : controls)
+      {
+        for (auto i = 0; i < ports * M; ++i) ram.control(i, c.at(i));
+        ram.process();
+      }
+    });
+    if (t == 1) serial = time;
+
+    uint64_t served = 0, conflicts = 0;
+    for (auto b = 0; b < 16; ++b)
+    {
+      served += ram.counters(b).reads + ram.counters(b).writes;
+      conflicts += ram.counters(b).conflicts;
+    }
+
+    std::cout << std::setw(7) << t
+              << std::setw(13) << std::fixed << std::setprecision(0)
+              << served / time << " (" << std::setprecision(2)
+              << serial / time << "x), " << conflicts << " conflicts"
+              << std::endl;
+  }
+
+  ThreadPool::instance().resize(std::thread::hardware_concurrency());
+}
+
+
+// Gate-level Cache against the behavioral model on one address trace
+
+void benchCache()
+{
+  std::cout << "\nCACHE: 16 sets x 4 ways x 4 words over RAM<13, 32>\n\n";
+
+  auto trace = randomTrace(1000000, 1 << 12);
+
+  Cache<13, 32, 4, 4, 2> cache;
+  const int sample = 20000;
+
+  double gates = timeIt([&]
+  {
+    for (auto i = 0; i < sample; ++i)
+    {
+      cache.control(0, trace.at(i).write);
+      for (auto b = 1; b < 13; ++b)
+      {
+        cache.control(b, (trace.at(i).address >> (12-b)) & 1);
+      }
+      cache.process();
+    }
+  });
+
+  CacheModel<13, 4, 4, 2> model;
+  double fast = timeIt([&] { model.run(trace); });
+
+  const CacheCounters& c = model.counters();
+  std::cout << "Cache::process():  " << sample / gates << " accesses/s" << std::endl;
+  std::cout << "CacheModel::run(): " << trace.size() / fast << " accesses/s" << std::endl;
+  std::cout << "Hit rate " << (double) c.hits / trace.size() << ", "
+            << c.evictions << " evictions, " << c.writebacks << " writebacks"
+            << std::endl;
+}
+
+
+// Lookup latency of one CAM<Entries, 16>, gates versus find()
+
+template <int Entries>
+void benchCAMSize()
+{
+  auto cam = std::make_unique<CAM<Entries, 16>>();
+  const int bits = std::log2(Entries);
+
+  for (auto e = 0; e < Entries; ++e)
+  {
+    cam->input(0, randomWord<16>());
+    cam->control(0, 1);
+    for (auto i = 1; i <= bits; ++i) cam->control(i, (e >> (bits - i)) & 1);
+    cam->process();
+  }
+
+  Word<16> key = randomWord<16>();
+  cam->input(0, key);
+  cam->control(0, 0);
+
+  const int lookups = std::max(1, 65536 / Entries);
+  double gates = timeIt([&]
+  {
+    for (auto i = 0; i < lookups; ++i) cam->process();
+  });
+
+  const int finds = 1000000;
+  volatile int found = 0;
+  double hash = timeIt([&]
+  {
+    for (auto i = 0; i < finds; ++i) found = cam->find(key);
+  });
+
+  std::cout << std::setw(7) << Entries
+            << std::setw(16) << std::fixed << std::setprecision(2)
+            << 1e6 * gates / lookups
+            << std::setw(14) << std::setprecision(3) << 1e6 * hash / finds
+            << std::endl;
+}
+
+void benchCAM()
+{
+  std::cout << "\nCAM LOOKUP LATENCY: CAM<Entries, 16>\n\n";
+  std::cout << "Entries   process() us   find() us" << std::endl;
+
+  benchCAMSize<64>();
+  benchCAMSize<256>();
+  benchCAMSize<1024>();
+  benchCAMSize<4096>();
+  benchCAMSize<16384>();
+  benchCAMSize<65536>();
+}
+
+
+// Random reads of a 1024 word table held in a RAM and in a ROM
+
+void benchROM()
+{
+  std::cout << "\nROM: 1024 x 16 random table, random reads\n\n";
+
+  std::vector<Word<16>> table(1024);
+  for (auto& w : table) w = randomWord<16>();
+
+  RAM<11, 16> ram;
+  ram.writeBurst(0, 1024, table.data());
+  ROM<10, 16> rom(table);
+
+  std::vector<int> addresses(20000);
+  for (auto& a : addresses) a = rand() % 1024;
+
+  double ramTime = timeIt([&]
+  {
+    ram.control(0, 0);
+    for (auto a : addresses)
+    {
+      for (auto b = 1; b < 11; ++b) ram.control(b, (a >> (10-b)) & 1);
+      ram.process();
+    }
+  });
+
+  double romTime = timeIt([&]
+  {
+    for (auto a : addresses)
+    {
+      for (auto b = 0; b < 10; ++b) rom.control(b, (a >> (9-b)) & 1);
+      rom.process();
+    }
+  });
+
+  volatile uint64_t sum = 0;
+  double lookupTime = timeIt([&]
+  {
+    for (auto a : addresses) sum += rom.lookup(a).bit(0);
+  });
+
+  std::cout << "ROM multiplexers: " << rom.multiplexers() << " (full tree "
+            << 1023 * 16 << ")" << std::endl;
+  std::cout << "RAM::process():   " << addresses.size() / ramTime << " reads/s" << std::endl;
+  std::cout << "ROM::process():   " << addresses.size() / romTime << " reads/s" << std::endl;
+  std::cout << "ROM::lookup():    " << addresses.size() / lookupTime << " reads/s"
+            << std::endl;
+}
+
+
+// Two reads and a write per cycle on 32 x 32-bit registers: three
+// RAM<6, 32> passes, one RegisterFile pass, and the packed fast mode
+
+void benchRegisterFile()
+{
+  std::cout << "\nREGISTER FILE: 32 x 32, 2 reads + 1 write per cycle\n\n";
+
+  const int cycles = 20000;
+  std::vector<int> a(cycles), b(cycles), d(cycles);
+  for (auto i = 0; i < cycles; ++i)
+  {
+    a.at(i) = rand() % 32, b.at(i) = rand() % 32, d.at(i) = rand() % 32;
+  }
+  Word<32> value = randomWord<32>();
+
+  RAM<6, 32> ram;
+  auto access = [&](int address, Signal write)
+  {
+    ram.control(0, write);
+    for (auto i = 1; i < 6; ++i) ram.control(i, (address >> (5-i)) & 1);
+    ram.process();
+  };
+
+  ram.input(0, value);
+  double ramTime = timeIt([&]
+  {
+    for (auto i = 0; i < cycles; ++i)
+    {
+      access(a.at(i), 0);
+      access(b.at(i), 0);
+      access(d.at(i), 1);
+    }
+  });
+
+  RegisterFile<32, 32> rf;
+  rf.input(0, value);
+  rf.control(10, 1);
+
+  auto run = [&]
+  {
+    for (auto i = 0; i < cycles; ++i)
+    {
+      for (auto j = 0; j < 5; ++j)
+      {
+        rf.control(j, (a.at(i) >> (4-j)) & 1);
+        rf.control(5 + j, (b.at(i) >> (4-j)) & 1);
+        rf.control(11 + j, (d.at(i) >> (4-j)) & 1);
+      }
+      rf.process();
+    }
+  };
+
+  double gates = timeIt(run);
+  rf.fast(true);
+  double packed = timeIt(run);
+
+  std::cout << "RAM, 3 passes:        " << cycles / ramTime << " cycles/s" << std::endl;
+  std::cout << "RegisterFile:         " << cycles / gates << " cycles/s ("
+            << ramTime / gates << "x)" << std::endl;
+  std::cout << "RegisterFile, packed: " << cycles / packed << " cycles/s ("
+            << ramTime / packed << "x)" << std::endl;
+}
+
+
+// Idle storage: RAM<10, 32> full evaluation and a bank of shift
+// registers, mostly with the clock low, gated and ungated
+
+void benchClockGating()
+{
+  std::cout << "\nCLOCK GATING: 1 write in 8 cycles\n\n";
+
+  RAM<10, 32> ram;
+  std::vector<ShiftRegister<32>> shifters(512);
+  const int cycles = 200;
+
+  auto run = [&]
+  {
+    srand(2);
+    for (auto i = 0; i < cycles; ++i)
+    {
+      Signal clk = rand() % 8 == 0;
+      ram.input(0, randomWord<32>());
+      ram.control(0, clk);
+      for (auto b = 1; b < 10; ++b) ram.control(b, rand() % 2);
+      ram.processAll();
+
+      for (auto& s : shifters)
+      {
+        s.control(0, 1);
+        s.control(1, clk);
+        s.process();
+      }
+    }
+  };
+
+  ClockGating::enabled() = false;
+  double full = timeIt(run);
+  GatingCounters before = ram.gating();
+  ClockGating::enabled() = true;
+  double gated = timeIt(run);
+
+  GatingCounters c = ram.gating();
+  c.gated -= before.gated;
+  c.active -= before.active;
+  std::cout << "Ungated:  " << cycles / full << " cycles/s" << std::endl;
+  std::cout << "Gated:    " << cycles / gated << " cycles/s ("
+            << full / gated << "x)" << std::endl;
+  std::cout << "RAM words gated " << c.gated << ", active " << c.active << std::endl;
+}
+
+
+// A 16-bit gate-level counter and an idle 64-register bank driven by
+// the clocked kernel
+
+void benchClocked()
+{
+  std::cout << "\nCLOCKED KERNEL: counter + 64 idle registers\n\n";
+
+  ClockedSimulation sim;
+  auto& count = sim.reg<16>();
+  WordAdder<16> add;
+  sim.logic([&]
+  {
+    add.input(0, count.q());
+    add.input(1, Word<16>::fromInt(1));
+    add.process();
+    count.d(add.output());
+  });
+
+  for (auto i = 0; i < 64; ++i) sim.reg<32>();
+
+  const int cycles = 200000;
+  double time = timeIt([&] { sim.run(cycles); });
+
+  std::cout << "run(): " << cycles / time << " cycles/s" << std::endl;
+}
+
+
+// Event-driven timing of a WordMultiplier<32> netlist against the
+// zero-delay levelized evaluation
+
+void benchEvents()
+{
+  std::cout << "\nEVENT SIMULATION: WordMultiplier<32>\n\n";
+
+  Netlist n;
+  Bus a = n.input(32);
+  Bus b = n.input(32);
+  Bus out = WordMultiplier<32>::synthesize(n, a, b);
+
+  EventSimulator events(n);
+  NetlistSimulator steady(n);
+  events.watch(out);
+
+  const int vectors = 200;
+  std::vector<Word<32>> as, bs;
+  for (auto i = 0; i < vectors; ++i)
+  {
+    as.push_back(randomWord<32>());
+    bs.push_back(randomWord<32>());
+  }
+
+  uint64_t worst = 0;
+  double timed = timeIt([&]
+  {
+    for (auto i = 0; i < vectors; ++i)
+    {
+      events.set(a, as.at(i));
+      events.set(b, bs.at(i));
+      worst = std::max(worst, events.run());
+    }
+  });
+
+  double zero = timeIt([&]
+  {
+    for (auto i = 0; i < vectors; ++i)
+    {
+      steady.set(a, as.at(i));
+      steady.set(b, bs.at(i));
+      steady.evaluate();
+    }
+  });
+
+  uint64_t glitches = 0;
+  for (auto net : out) glitches += events.activity(net).glitches;
+
+  std::cout << "NAND gates:      " << n.gates() << std::endl;
+  std::cout << "Events:          " << events.events() / timed << " events/s ("
+            << events.events() / vectors << " per vector)" << std::endl;
+  std::cout << "Event vectors:   " << vectors / timed << " vectors/s" << std::endl;
+  std::cout << "Levelized:       " << vectors / zero << " vectors/s" << std::endl;
+  std::cout << "Worst settle:    " << worst << " gate delays (depth " << n.depth() << ")" << std::endl;
+  std::cout << "Output glitches: " << glitches << " on the last vector" << std::endl;
+}
+
+
+// Each adder architecture: size, depth, component and netlist
+// throughput, and how much switching a random input causes
+
+template <typename Arch>
+void benchAdder(const std::string& name)
+{
+  const int N = 64;
+  AdderReport report = adderReport<N, Arch>();
+
+  Netlist n;
+  Bus a = n.input(N);
+  Bus b = n.input(N);
+  Bus out = WordAdder<N, Arch>::synthesize(n, a, b);
+
+  const int vectors = 2000;
+  std::vector<Word<N>> as, bs, sums(vectors);
+  for (auto i = 0; i < vectors; ++i)
+  {
+    as.push_back(randomWord<N>());
+    bs.push_back(randomWord<N>());
+  }
+
+  WordAdder<N, Arch> adder;
+  double component = timeIt([&]
+  {
+    for (auto i = 0; i < vectors; ++i)
+    {
+      adder.input(0, as.at(i));
+      adder.input(1, bs.at(i));
+      adder.process();
+    }
+  });
+
+  double batch = timeIt([&] { adder.processBatch(as, bs, sums); });
+
+  EventSimulator events(n);
+  events.watch(out);
+  uint64_t glitches = 0;
+  for (auto i = 0; i < vectors; ++i)
+  {
+    events.set(a, as.at(i));
+    events.set(b, bs.at(i));
+    events.run();
+    for (auto net : out) glitches += events.activity(net).glitches;
+  }
+
+  std::cout << std::setw(15) << name
+            << std::setw(7) << report.gates
+            << std::setw(7) << report.depth
+            << std::setw(12) << std::setprecision(0) << vectors / component
+            << std::setw(12) << vectors / batch
+            << std::setw(10) << std::setprecision(1) << (double) events.events() / vectors
+            << std::setw(10) << (double) glitches / vectors << std::endl;
+}
+
+void benchAdders()
+{
+  std::cout << "\nADDER ARCHITECTURES: WordAdder<64>\n\n";
+  std::cout << "   Architecture  Gates  Depth      adds/s     batch/s"
+            << "    events  glitches" << std::endl;
+
+  std::cout << std::fixed;
+  benchAdder<RippleCarry>("RippleCarry");
+  benchAdder<CarrySelect>("CarrySelect");
+  benchAdder<CarryLookahead>("CarryLookahead");
+  benchAdder<KoggeStone>("KoggeStone");
+  benchAdder<BrentKung>("BrentKung");
+}
+
+
+// Shift-and-add against tree multipliers: size, depth, component and
+// batch throughput, and event-driven settle time
+
+template <typename Tree>
+void benchMultiplier(const std::string& name)
+{
+  const int N = 32;
+
+  Netlist n;
+  Bus a = n.input(N);
+  Bus b = n.input(N);
+  Bus out = WordMultiplier<N, Tree>::synthesize(n, a, b);
+
+  const int vectors = 200;
+  std::vector<Word<N>> as, bs, products(vectors);
+  for (auto i = 0; i < vectors; ++i)
+  {
+    as.push_back(randomWord<N>());
+    bs.push_back(randomWord<N>());
+  }
+
+  WordMultiplier<N, Tree> m;
+  double component = timeIt([&]
+  {
+    for (auto i = 0; i < vectors; ++i)
+    {
+      m.input(0, as.at(i));
+      m.input(1, bs.at(i));
+      m.process();
+    }
+  });
+
+  double batch = timeIt([&] { m.processBatch(as, bs, products); });
+
+  EventSimulator events(n);
+  events.watch(out);
+  uint64_t settle = 0;
+  for (auto i = 0; i < vectors; ++i)
+  {
+    events.set(a, as.at(i));
+    events.set(b, bs.at(i));
+    settle = std::max(settle, events.run());
+  }
+
+  std::cout << std::setw(10) << name
+            << std::setw(8) << n.gates()
+            << std::setw(7) << n.depth()
+            << std::setw(7) << n.gates() / n.depth()
+            << std::setw(10) << std::setprecision(0) << vectors / component
+            << std::setw(10) << vectors / batch
+            << std::setw(8) << settle
+            << std::setw(10) << events.events() / vectors << std::endl;
+}
+
+void benchMultipliers()
+{
+  std::cout << "\nMULTIPLIER TREES: WordMultiplier<32>\n\n";
+  std::cout << "      Tree   Gates  Depth  Width    muls/s   batch/s"
+            << "  settle    events" << std::endl;
+
+  std::cout << std::fixed;
+  benchMultiplier<ShiftAdd>("ShiftAdd");
+  benchMultiplier<Wallace>("Wallace");
+  benchMultiplier<Dadda>("Dadda");
+}
+
+
+// Signed 32 x 32 -> 64: Booth against sign extending both operands
+// into an unsigned 64-bit multiplier
+
+template <typename M, int W>
+void benchSigned(const std::string& name)
+{
+  const int N = 32;
+
+  Netlist n;
+  Bus a = n.input(W);
+  Bus b = n.input(W);
+  M::synthesize(n, a, b);
+
+  const int vectors = 100;
+  std::vector<Word<W>> as, bs, out(vectors);
+  for (auto i = 0; i < vectors; ++i)
+  {
+    // Sign extended when the multiplier is wider than the operands
+    as.push_back(Word<W>::fromInt((int64_t) (int32_t) randomWord<N>().toInt()));
+    bs.push_back(Word<W>::fromInt((int64_t) (int32_t) randomWord<N>().toInt()));
+  }
+
+  M m;
+  double component = timeIt([&]
+  {
+    for (auto i = 0; i < vectors; ++i)
+    {
+      m.input(0, as.at(i));
+      m.input(1, bs.at(i));
+      m.process();
+    }
+  });
+
+  // Booth has the high half separately
+  std::vector<Word<W>> high(vectors);
+  double batch = timeIt([&]
+  {
+    if constexpr (W == N) m.processBatch(as, bs, out, high);
+    else m.processBatch(as, bs, out);
+  });
+
+  std::cout << std::setw(24) << name
+            << std::setw(8) << n.gates()
+            << std::setw(7) << n.depth()
+            << std::setw(10) << std::setprecision(0) << vectors / component
+            << std::setw(10) << vectors / batch << std::endl;
+}
+
+void benchBooth()
+{
+  std::cout << "\nSIGNED MULTIPLY: 32 x 32 -> 64\n\n";
+  std::cout << "              Multiplier   Gates  Depth    muls/s   batch/s" << std::endl;
+
+  std::cout << std::fixed;
+  benchSigned<BoothMultiplier<32>, 32>("BoothMultiplier<32>");
+  benchSigned<WordMultiplier<64, Dadda>, 64>("WordMultiplier<64,Dadda>");
+  benchSigned<WordMultiplier<64>, 64>("WordMultiplier<64>");
+}
+
+
+// Wide full-product multipliers: schoolbook against Karatsuba, for
+// gates, construction time, heap and one evaluation
+
+template <typename M, int N>
+void benchWideMultiplier(const std::string& name)
+{
+  Netlist n;
+  Bus a = n.input(N);
+  Bus b = n.input(N);
+  M::synthesize(n, a, b);
+  int gates = n.gates();
+  n = Netlist();
+
+  size_t before = mallinfo2().uordblks;
+  std::unique_ptr<M> m;
+  double construct = timeIt([&] { m = std::make_unique<M>(); });
+  double megabytes = (mallinfo2().uordblks - before) / 1e6;
+
+  m->input(0, randomWord<N>());
+  m->input(1, randomWord<N>());
+  double evaluate = timeIt([&] { m->process(); });
+
+  std::cout << std::setw(6) << N
+            << std::setw(12) << name
+            << std::setw(11) << gates
+            << std::setw(13) << std::setprecision(1) << 1000 * construct
+            << std::setw(9) << std::setprecision(0) << megabytes
+            << std::setw(12) << std::setprecision(1) << 1000 * evaluate << std::endl;
+}
+
+void benchKaratsuba()
+{
+  std::cout << "\nWIDE MULTIPLY: N x N -> 2N\n\n";
+  std::cout << "     N  Multiplier      Gates  Construct ms     MB  Process ms" << std::endl;
+
+  std::cout << std::fixed;
+  benchWideMultiplier<WideMultiplier<64>, 64>("Schoolbook");
+  benchWideMultiplier<KaratsubaMultiplier<64>, 64>("Karatsuba");
+  benchWideMultiplier<WideMultiplier<128>, 128>("Schoolbook");
+  benchWideMultiplier<KaratsubaMultiplier<128>, 128>("Karatsuba");
+  benchWideMultiplier<WideMultiplier<256>, 256>("Schoolbook");
+  benchWideMultiplier<KaratsubaMultiplier<256>, 256>("Karatsuba");
+  benchWideMultiplier<WideMultiplier<512>, 512>("Schoolbook");
+  benchWideMultiplier<KaratsubaMultiplier<512>, 512>("Karatsuba");
+  benchWideMultiplier<KaratsubaMultiplier<1024>, 1024>("Karatsuba");
+}
+
+
+// A 16-bit dot product into a 40-bit accumulator, fused against a
+// separate multiply, add and register write per element
+
+void benchMAC()
+{
+  std::cout << "\nMULTIPLY-ACCUMULATE: 16 x 16 into 40 bits\n\n";
+
+  const int elements = 500;
+  std::vector<Word<16>> as, bs;
+  for (auto i = 0; i < elements; ++i)
+  {
+    as.push_back(randomWord<16>());
+    bs.push_back(randomWord<16>());
+  }
+
+  MAC<16, 40> mac;
+  mac.control(0, 1);
+  double fused = timeIt([&]
+  {
+    for (auto i = 0; i < elements; ++i)
+    {
+      mac.input(0, as.at(i));
+      mac.input(1, bs.at(i));
+      mac.control(1, i == 0);
+      mac.process();
+    }
+  });
+
+  WideMultiplier<16> multiply;
+  WordAdder<40, KoggeStone> add;
+  WordMemory<40> accumulator;
+  accumulator.input(0, Word<40>());
+  accumulator.control(0, 1);
+  accumulator.process();
+
+  double separate = timeIt([&]
+  {
+    for (auto i = 0; i < elements; ++i)
+    {
+      multiply.input(0, as.at(i));
+      multiply.input(1, bs.at(i));
+      multiply.process();
+
+      Word<40> product;
+      for (auto w = 0; w < 32; ++w)
+      {
+        product.bit(39-w) = productBit(multiply.output(0), multiply.output(1), w);
+      }
+
+      add.input(0, accumulator.output());
+      add.input(1, product);
+      add.process();
+      accumulator.input(0, add.output());
+      accumulator.process();
+    }
+  });
+
+  assert(mac.accumulator() == accumulator.output());
+
+  // Depth of one step, from operands and accumulator to the new value
+  auto depth = [](auto build)
+  {
+    Netlist n;
+    Bus a = n.input(16);
+    Bus b = n.input(16);
+    Bus acc = n.input(40);
+    build(n, a, b, acc);
+    return n.depth();
+  };
+
+  int fusedDepth = depth([](Netlist& n, const Bus& a, const Bus& b, const Bus& acc)
+  {
+    MAC<16, 40>::synthesize(n, a, b, acc);
+  });
+
+  int separateDepth = depth([](Netlist& n, const Bus& a, const Bus& b, const Bus& acc)
+  {
+    Bus product(8, n.constant(0));
+    Bus full = WideMultiplier<16>::synthesize(n, a, b);
+    product.insert(product.end(), full.begin(), full.end());
+    WordAdder<40, KoggeStone>::synthesize(n, acc, product);
+  });
+
+  std::cout << "MAC:               " << elements / fused << " elements/s, depth "
+            << fusedDepth << std::endl;
+  std::cout << "Multiply then add: " << elements / separate << " elements/s, depth "
+            << separateDepth << std::endl;
+}
+
+
+// One tile through a 16 x 16 array of 8-bit MACs, cycle by cycle
+
+void benchSystolic()
+{
+  std::cout << "\nSYSTOLIC ARRAY: SystolicArray<16, 16, 8>, 32-deep tile\n\n";
+
+  const int K = 32;
+  std::vector<std::vector<uint64_t>> a(16, std::vector<uint64_t>(K));
+  std::vector<std::vector<uint64_t>> b(K, std::vector<uint64_t>(16));
+  for (auto& row : a)
+  {
+    for (auto& x : row) x = rand() & 0xFF;
+  }
+  for (auto& row : b)
+  {
+    for (auto& x : row) x = rand() & 0xFF;
+  }
+
+  SystolicArray<16, 16, 8> array;
+  std::vector<std::vector<uint64_t>> expected;
+  double serial = 0;
+
+  // Every element does a MAC step every cycle, padding included
+  std::cout << "Threads   MACs/s" << std::endl;
+  for (auto t : {1, 8, 64})
+  {
+    ThreadPool::instance().resize(t);
+
+    uint64_t start = array.cycles();
+    std::vector<std::vector<uint64_t>> c;
+    double time = timeIt([&] { c = array.multiply(a, b); });
+    if (t == 1)
+    {
+      serial = time;
+      expected = c;
+    }
+    assert(c == expected);
+
+    std::cout << std::setw(7) << t
+              << std::setw(11) << std::fixed << std::setprecision(0)
+              << 256 * (array.cycles() - start) / time << " ("
+              << std::setprecision(2) << serial / time << "x)" << std::endl;
+  }
+
+  ThreadPool::instance().resize(std::thread::hardware_concurrency());
+
+  array.fast(true);
+  uint64_t start = array.cycles();
+  std::vector<std::vector<uint64_t>> c;
+  double time = timeIt([&]
+  {
+    for (auto r = 0; r < 100; ++r) c = array.multiply(a, b);
+  });
+  assert(c == expected);
+
+  std::cout << "\nFast mode:" << std::setw(11) << std::setprecision(0)
+            << 256 * (array.cycles() - start) / time << " MACs/s" << std::endl;
+}
+
+
+// Many short jobs against a warm server, versus constructing per job
+
+void benchServer()
+{
+  std::cout << "\nSERVER LOAD TEST: short jobs on RAM<10,16>\n\n";
+
+  Job job;
+  job.design = "RAM<10,16>";
+  job.cycles = 4;
+  job.controls = std::vector<int>(10, -1);
+
+  const int cold = 20;
+  double construct = timeIt([&]
+  {
+    for (auto i = 0; i < cold; ++i)
+    {
+      job.seed = i;
+      auto d = Registry::instance().create(job.design);
+      SweepRunner::run(*d, job);
+    }
+  });
+
+  std::string path = "/tmp/loob-bench-" + std::to_string(getpid()) + ".sock";
+  Server server(path, 16);
+  std::thread t(&Server::serve, &server);
+
+  const int clients = 4, jobs = 100;
+  std::vector<double> latency(clients * jobs);
+
+  double warm = timeIt([&]
+  {
+    std::vector<std::thread> threads;
+    for (auto k = 0; k < clients; ++k)
+    {
+      threads.emplace_back([&, k]
+      {
+        Client c(path);
+        Job j = job;
+        for (auto i = 0; i < jobs; ++i)
+        {
+          j.seed = k * jobs + i;
+          latency.at(k * jobs + i) = timeIt([&] { c.run(j); });
+        }
+      });
+    }
+    for (auto& th : threads) th.join();
+  });
+
+  Client(path).shutdown();
+  t.join();
+
+  std::sort(latency.begin(), latency.end());
+
+  std::cout << "Construct per job:  " << cold / construct << " jobs/s" << std::endl;
+  std::cout << "Warm server:        " << clients * jobs / warm << " jobs/s ("
+            << (clients * jobs / warm) / (cold / construct) << "x)" << std::endl;
+  std::cout << "Latency p50/p99:    " << 1e6 * latency.at(latency.size() / 2)
+            << " / " << 1e6 * latency.at(latency.size() * 99 / 100) << " us"
+            << std::endl;
+}
+
+
+int main()
+{
+  std::cout << "Hardware threads: " << std::thread::hardware_concurrency()
+            << std::endl;
+
+  benchLevelParallel();
+  benchComponentParallel();
+  benchPipeline();
+  benchBatch();
+  benchRAMPath();
+  benchRAMBurst();
+  benchRAMImage();
+  benchBankedRAM();
+  benchCache();
+  benchCAM();
+  benchROM();
+  benchRegisterFile();
+  benchClockGating();
+  benchClocked();
+  benchEvents();
+  benchAdders();
+  benchMultipliers();
+  benchBooth();
+  benchKaratsuba();
+  benchMAC();
+  benchSystolic();
+  benchServer();
+}
+
+
+// END
@@ -0,0 +1,538 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <algorithm>
+#include <vector>
+
+#include "Gates.hpp"
+#include "Memory.hpp"
+
+
+// CLASS DECLARATIONS
+
+
+enum class Replacement { LRU, PLRU };
+
+// Write-back caches allocate on every miss. Write-through caches send
+// every write on to memory and don't allocate on a write miss.
+enum class WritePolicy { WriteBack, WriteThrough };
+
+struct CacheCounters
+{
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  uint64_t writebacks = 0;
+};
+
+// One memory access in a trace
+struct Access
+{
+  uint64_t address;
+  bool write;
+};
+
+
+// Picks the way of a set to replace.
+// LRU keeps a last-use stamp per way, PLRU a tree of Ways-1 bits per
+// set that point away from the most recently used way.
+
+class Replacer
+{
+  public:
+    Replacer(int sets, int ways, Replacement policy) :
+      _ways(ways),
+      _policy(policy),
+      _stamps(sets * ways, 0),
+      _bits(sets * ways, 0) {}
+
+    void touch(int set, int way);
+    int victim(int set) const;
+
+  private:
+    int _ways;
+    Replacement _policy;
+    uint64_t _clock = 0;
+    std::vector<uint64_t> _stamps;
+    std::vector<uint8_t> _bits;
+};
+
+
+// Set-associative cache in front of a RAM<M, N>, with the same
+// control interface as the RAM: bit 0 is write, bits 1..M-1 the
+// address, most significant first.
+// The address splits into tag, 2^SetBits sets and lines of 2^LineBits
+// words. Tags live in WordMemory and are matched with WordXOR and an
+// OR reduction, valid and dirty bits are flip-flops, and line data is
+// WordMemory. Lines move to and from memory with RAM bursts.
+
+template <int M, int N, int SetBits = 4, int Ways = 2, int LineBits = 2>
+class Cache : public WordControlComponent<N>
+{
+  static_assert(Ways >= 1 && (Ways & (Ways - 1)) == 0,
+                "Ways must be a power of two");
+
+  public:
+    Cache(Replacement replacement = Replacement::LRU,
+          WritePolicy policy = WritePolicy::WriteBack) :
+      WordControlComponent<N>(1, M, 1),
+      _ways(Sets * Ways),
+      _policy(policy),
+      _replacer(Sets, Ways, replacement) {}
+
+    void process();
+
+    // Write every dirty line back to memory
+    void flush();
+
+    const CacheCounters& counters() const
+    {
+      return _counters;
+    }
+
+    void resetCounters()
+    {
+      _counters = CacheCounters();
+    }
+
+    // The RAM behind the cache
+    RAM<M, N>& memory()
+    {
+      return _memory;
+    }
+
+  private:
+    static const int Sets = 1 << SetBits;
+    static const int Line = 1 << LineBits;
+    static const int TagBits = M - 1 - SetBits - LineBits;
+
+    static_assert(TagBits >= 1, "Address too short for this geometry");
+
+    struct Way
+    {
+      Way() : data(Line) {}
+
+      WordMemory<TagBits> tag;
+      FlipFlop valid, dirty;
+      std::vector<WordMemory<N>> data;
+    };
+
+    bool match(Way& way, const Word<TagBits>& tag);
+    void writeBack(int set, int way);
+    void fill(int set, int way, uint64_t tag);
+
+    static void clock(FlipFlop& f, Signal value)
+    {
+      f.input(0, value);
+      f.control(0, 1);
+      f.process();
+    }
+
+    std::vector<Way> _ways;
+    WordXOR<TagBits> _compare;
+    OR _reduce;
+    Inverter _miss;
+    AND _hit;
+
+    RAM<M, N> _memory;
+    WritePolicy _policy;
+    Replacer _replacer;
+    CacheCounters _counters;
+};
+
+
+// Behavioral model of the same cache: tags, valid and dirty bits and
+// replacement only, no data. Gives the same counters as Cache for the
+// same accesses, at millions of accesses per second.
+
+template <int M, int SetBits = 4, int Ways = 2, int LineBits = 2>
+class CacheModel
+{
+  public:
+    CacheModel(Replacement replacement = Replacement::LRU,
+               WritePolicy policy = WritePolicy::WriteBack) :
+      _tags(Sets * Ways, 0),
+      _valid(Sets * Ways, false),
+      _dirty(Sets * Ways, false),
+      _policy(policy),
+      _replacer(Sets, Ways, replacement) {}
+
+    // Returns whether the access hit
+    bool access(uint64_t address, bool write);
+
+    const CacheCounters& run(const std::vector<Access>& trace)
+    {
+      for (auto& a : trace) access(a.address, a.write);
+      return _counters;
+    }
+
+    const CacheCounters& counters() const
+    {
+      return _counters;
+    }
+
+  private:
+    static const int Sets = 1 << SetBits;
+
+    std::vector<uint64_t> _tags;
+    std::vector<bool> _valid, _dirty;
+    WritePolicy _policy;
+    Replacer _replacer;
+    CacheCounters _counters;
+};
+
+
+// PROCESS DEFINITIONS
+
+
+void Replacer::touch(int set, int way)
+{
+  if (_policy == Replacement::LRU)
+  {
+    _stamps.at(set * _ways + way) = ++_clock;
+    return;
+  }
+
+  // Walk down to the way, pointing each node at the other half
+  uint8_t* bits = &_bits.at(set * _ways);
+  int node = 0, low = 0, high = _ways;
+
+  while (high - low > 1)
+  {
+    int middle = (low + high) / 2;
+    if (way < middle)
+    {
+      bits[node] = 1;
+      node = 2*node + 1;
+      high = middle;
+    }
+    else
+    {
+      bits[node] = 0;
+      node = 2*node + 2;
+      low = middle;
+    }
+  }
+}
+
+int Replacer::victim(int set) const
+{
+  if (_policy == Replacement::LRU)
+  {
+    const uint64_t* stamps = &_stamps.at(set * _ways);
+    return std::min_element(stamps, stamps + _ways) - stamps;
+  }
+
+  const uint8_t* bits = &_bits.at(set * _ways);
+  int node = 0, low = 0, high = _ways;
+
+  while (high - low > 1)
+  {
+    int middle = (low + high) / 2;
+    if (bits[node] == 0)
+    {
+      node = 2*node + 1;
+      high = middle;
+    }
+    else
+    {
+      node = 2*node + 2;
+      low = middle;
+    }
+  }
+
+  return low;
+}
+
+
+template <int M, int N, int SetBits, int Ways, int LineBits>
+bool Cache<M, N, SetBits, Ways, LineBits>::match(Way& way, const Word<TagBits>& tag)
+{
+  // Any differing bit means a miss
+  _compare.input(0, way.tag.output());
+  _compare.input(1, tag);
+  _compare.process();
+
+  Signal differ = 0;
+  for (auto i = 0; i < TagBits; ++i)
+  {
+    _reduce.input(0, differ);
+    _reduce.input(1, _compare.output().bit(i));
+    _reduce.process();
+    differ = _reduce.output();
+  }
+
+  _miss.input(0, differ);
+  _miss.process();
+
+  _hit.input(0, way.valid.output());
+  _hit.input(1, _miss.output());
+  _hit.process();
+
+  return _hit.output();
+}
+
+template <int M, int N, int SetBits, int Ways, int LineBits>
+void Cache<M, N, SetBits, Ways, LineBits>::writeBack(int set, int way)
+{
+  Way& w = _ways.at(set * Ways + way);
+
+  std::vector<Word<N>> line;
+  for (auto& d : w.data) line.push_back(d.output());
+
+  uint64_t base = ((w.tag.output().toInt() << SetBits) | set) << LineBits;
+  _memory.writeBurst(base, Line, line.data());
+
+  clock(w.dirty, 0);
+  ++_counters.writebacks;
+}
+
+template <int M, int N, int SetBits, int Ways, int LineBits>
+void Cache<M, N, SetBits, Ways, LineBits>::fill(int set, int way, uint64_t tag)
+{
+  Way& w = _ways.at(set * Ways + way);
+
+  std::vector<Word<N>> line(Line);
+  uint64_t base = ((tag << SetBits) | set) << LineBits;
+  _memory.readBurst(base, Line, line.data());
+
+  for (auto i = 0; i < Line; ++i)
+  {
+    w.data.at(i).input(0, line.at(i));
+    w.data.at(i).control(0, 1);
+    w.data.at(i).process();
+  }
+
+  w.tag.input(0, Word<TagBits>::fromInt(tag));
+  w.tag.control(0, 1);
+  w.tag.process();
+
+  clock(w.valid, 1);
+  clock(w.dirty, 0);
+}
+
+template <int M, int N, int SetBits, int Ways, int LineBits>
+void Cache<M, N, SetBits, Ways, LineBits>::process()
+{
+  uint64_t address = 0;
+  for (auto i = 1; i < M; ++i) address = (address << 1) | this->_controls.at(i);
+
+  Signal write = this->_controls.at(0);
+  int offset = address & (Line - 1);
+  int set = (address >> LineBits) & (Sets - 1);
+  uint64_t tag = address >> (LineBits + SetBits);
+  Word<TagBits> tagWord = Word<TagBits>::fromInt(tag);
+
+  // Every way of the set is compared
+  int way = -1;
+  for (auto w = 0; w < Ways; ++w)
+  {
+    if (match(_ways.at(set * Ways + w), tagWord)) way = w;
+  }
+
+  if (way >= 0)
+  {
+    ++_counters.hits;
+  }
+  else
+  {
+    ++_counters.misses;
+
+    if (write && _policy == WritePolicy::WriteThrough)
+    {
+      _memory.writeBurst(address, 1, &this->_inputs.at(0));
+      this->_outputs.at(0) = this->_inputs.at(0);
+      return;
+    }
+
+    // Fill an invalid way if there is one
+    for (auto w = Ways - 1; w >= 0; --w)
+    {
+      if (!_ways.at(set * Ways + w).valid.output()) way = w;
+    }
+
+    if (way < 0)
+    {
+      way = _replacer.victim(set);
+      ++_counters.evictions;
+      if (_ways.at(set * Ways + way).dirty.output()) writeBack(set, way);
+    }
+
+    fill(set, way, tag);
+  }
+
+  _replacer.touch(set, way);
+
+  Way& w = _ways.at(set * Ways + way);
+  WordMemory<N>& data = w.data.at(offset);
+
+  if (write)
+  {
+    data.input(0, this->_inputs.at(0));
+    data.control(0, 1);
+    data.process();
+
+    if (_policy == WritePolicy::WriteBack) clock(w.dirty, 1);
+    else _memory.writeBurst(address, 1, &this->_inputs.at(0));
+  }
+
+  this->_outputs.at(0) = data.output();
+}
+
+template <int M, int N, int SetBits, int Ways, int LineBits>
+void Cache<M, N, SetBits, Ways, LineBits>::flush()
+{
+  for (auto s = 0; s < Sets; ++s)
+  {
+    for (auto w = 0; w < Ways; ++w)
+    {
+      if (_ways.at(s * Ways + w).dirty.output()) writeBack(s, w);
+    }
+  }
+}
+
+
+template <int M, int SetBits, int Ways, int LineBits>
+bool CacheModel<M, SetBits, Ways, LineBits>::access(uint64_t address, bool write)
+{
+  int set = (address >> LineBits) & (Sets - 1);
+  uint64_t tag = (address & (((uint64_t) 1 << (M-1)) - 1)) >> (LineBits + SetBits);
+  int first = set * Ways;
+
+  int way = -1;
+  for (auto w = 0; w < Ways; ++w)
+  {
+    if (_valid.at(first + w) && _tags.at(first + w) == tag) way = w;
+  }
+
+  bool hit = way >= 0;
+
+  if (hit)
+  {
+    ++_counters.hits;
+  }
+  else
+  {
+    ++_counters.misses;
+
+    if (write && _policy == WritePolicy::WriteThrough) return false;
+
+    for (auto w = Ways - 1; w >= 0; --w)
+    {
+      if (!_valid.at(first + w)) way = w;
+    }
+
+    if (way < 0)
+    {
+      way = _replacer.victim(set);
+      ++_counters.evictions;
+      if (_dirty.at(first + way)) ++_counters.writebacks;
+    }
+
+    _tags.at(first + way) = tag;
+    _valid.at(first + way) = true;
+    _dirty.at(first + way) = false;
+  }
+
+  _replacer.touch(set, way);
+
+  if (write && _policy == WritePolicy::WriteBack) _dirty.at(first + way) = true;
+
+  return hit;
+}
+
+
+// CACHE TESTS
+
+
+// Random traffic with some locality, within an address space of size
+std::vector<Access> randomTrace(int count, uint64_t size)
+{
+  std::vector<Access> trace;
+  uint64_t address = 0;
+
+  for (auto i = 0; i < count; ++i)
+  {
+    if (rand() % 4 == 0) address = rand() % size;
+    else address = (address + 1) % size;
+    trace.push_back({address, rand() % 3 == 0});
+  }
+
+  return trace;
+}
+
+template <Replacement R, WritePolicy P>
+void testCachePolicy()
+{
+  Cache<9, 16, 2, 2, 2> cache(R, P);
+  CacheModel<9, 2, 2, 2> model(R, P);
+  RAM<9, 16> reference;
+
+  std::vector<bool> written(256, false);
+  auto trace = randomTrace(600, 256);
+
+  for (auto& a : trace)
+  {
+    Word<16> w = Word<16>::fromInt(rand());
+
+    for (auto c : {0, 1})
+    {
+      WordControlComponent<16>& target = c ? (WordControlComponent<16>&) cache
+                                           : (WordControlComponent<16>&) reference;
+      target.input(0, w);
+      target.control(0, a.write);
+      for (auto b = 1; b < 9; ++b) target.control(b, (a.address >> (8-b)) & 1);
+    }
+
+    cache.process();
+    reference.process();
+    model.access(a.address, a.write);
+
+    if (a.write) written.at(a.address) = true;
+    if (written.at(a.address)) assert(cache.output() == reference.output());
+    assert(model.counters().hits == cache.counters().hits);
+  }
+
+  assert(model.counters().misses == cache.counters().misses);
+  assert(model.counters().evictions == cache.counters().evictions);
+  assert(model.counters().writebacks == cache.counters().writebacks);
+  assert(cache.counters().hits + cache.counters().misses == trace.size());
+
+  // Once flushed, memory holds everything that was written
+  cache.flush();
+  std::vector<Word<16>> memory(256), expected(256);
+  cache.memory().readBurst(0, 256, memory.data());
+  reference.readBurst(0, 256, expected.data());
+
+  for (auto i = 0; i < 256; ++i)
+  {
+    if (written.at(i)) assert(memory.at(i) == expected.at(i));
+  }
+}
+
+void testReplacer()
+{
+  // LRU: the oldest way goes
+  Replacer lru(1, 4, Replacement::LRU);
+  for (auto w : {0, 1, 2, 3, 0, 2}) lru.touch(0, w);
+  assert(lru.victim(0) == 1);
+
+  // PLRU: the tree points away from the most recent use
+  Replacer plru(1, 4, Replacement::PLRU);
+  for (auto w : {0, 1, 2, 3}) plru.touch(0, w);
+  assert(plru.victim(0) == 0);
+  plru.touch(0, 0);
+  assert(plru.victim(0) == 2);
+}
+
+void testCache()
+{
+  testReplacer();
+  testCachePolicy<Replacement::LRU, WritePolicy::WriteBack>();
+  testCachePolicy<Replacement::PLRU, WritePolicy::WriteBack>();
+  testCachePolicy<Replacement::LRU, WritePolicy::WriteThrough>();
+  testCachePolicy<Replacement::PLRU, WritePolicy::WriteThrough>();
+}
+
+
+#endif // CACHE_HPP
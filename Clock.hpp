@@ -0,0 +1,216 @@
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "ALU.hpp"
+#include "Memory.hpp"
+
+
+// Base class so a simulation can commit registers of any width
+
+class RegisterBase
+{
+  public:
+    virtual ~RegisterBase() {}
+
+    // Latch the value set this cycle, if any
+    virtual void commit() = 0;
+};
+
+
+// An N-bit register for the clocked kernel, stored in WordMemory.
+// Logic reads q() and sets d() during a cycle. Nothing changes until
+// commit(), so every register sees every other as it was at the start
+// of the cycle. A register that isn't given a new value holds.
+
+template <int N>
+class Register : public RegisterBase
+{
+  public:
+    Register(const Word<N>& reset = Word<N>())
+    {
+      d(reset);
+      commit();
+    }
+
+    const Word<N>& q()
+    {
+      return _storage.output();
+    }
+
+    void d(const Word<N>& w, Signal enable = 1)
+    {
+      _next = w;
+      _enable = enable;
+    }
+
+    void commit()
+    {
+      _storage.input(0, _next);
+      _storage.control(0, _enable);
+      _storage.process();
+      _enable = 0;
+    }
+
+  private:
+    WordMemory<N> _storage;
+    Word<N> _next;
+    Signal _enable = 0;
+};
+
+
+// Cycle-based simulation with a single global clock.
+// Each cycle has two phases: every block of combinational logic runs
+// once, in the order added, reading register outputs and setting
+// register inputs; then every register latches together.
+
+class ClockedSimulation
+{
+  public:
+    using Logic = std::function<void()>;
+
+    // Create a register owned by the simulation
+    template <int N>
+    Register<N>& reg(const Word<N>& reset = Word<N>())
+    {
+      auto r = std::make_unique<Register<N>>(reset);
+      Register<N>& ref = *r;
+      _registers.push_back(std::move(r));
+      return ref;
+    }
+
+    void logic(Logic block)
+    {
+      _logic.push_back(block);
+    }
+
+    // Cycles simulated so far
+    uint64_t cycle() const
+    {
+      return _cycle;
+    }
+
+    void step();
+    void run(uint64_t cycles);
+
+  private:
+    std::vector<Logic> _logic;
+    std::vector<std::unique_ptr<RegisterBase>> _registers;
+    uint64_t _cycle = 0;
+};
+
+
+// PROCESS DEFINITIONS
+
+
+void ClockedSimulation::step()
+{
+  for (auto& block : _logic) block();
+
+  // Registers don't share anything, so wide designs commit in parallel
+  ThreadPool::instance().parallelFor(_registers.size(), [this](int begin, int end)
+  {
+    for (auto i = begin; i < end; ++i) _registers.at(i)->commit();
+  }, 256);
+
+  ++_cycle;
+}
+
+void ClockedSimulation::run(uint64_t cycles)
+{
+  for (uint64_t i = 0; i < cycles; ++i) step();
+}
+
+
+// CLOCK TESTS
+
+
+void testClockedSimulation()
+{
+  ClockedSimulation sim;
+
+  // Swapping two registers only works if both latch together
+  auto& a = sim.reg<8>(Word<8>::fromInt(3));
+  auto& b = sim.reg<8>(Word<8>::fromInt(5));
+  sim.logic([&]
+  {
+    a.d(b.q());
+    b.d(a.q());
+  });
+
+  // Counter through the gate-level adder
+  auto& count = sim.reg<8>();
+  WordAdder<8> add;
+  sim.logic([&]
+  {
+    add.input(0, count.q());
+    add.input(1, Word<8>::fromInt(1));
+    add.process();
+    count.d(add.output());
+  });
+
+  // A register that's only loaded every fourth cycle
+  auto& held = sim.reg<8>();
+  sim.logic([&]
+  {
+    held.d(count.q(), sim.cycle() % 4 == 0);
+  });
+
+  sim.run(301);
+
+  assert(sim.cycle() == 301);
+  assert(a.q().toInt() == 5 && b.q().toInt() == 3);
+  assert(count.q().toInt() == 301 % 256);
+  assert(held.q().toInt() == 300 % 256);
+}
+
+void testShiftRegisterChain()
+{
+  // A chain of one-bit registers shifts like ShiftRegister, whichever
+  // order the logic runs in
+  ClockedSimulation sim;
+  std::vector<Register<1>*> chain;
+  for (auto i = 0; i < 8; ++i) chain.push_back(&sim.reg<1>());
+
+  ShiftRegister<8> s;
+  Word<8> w({0,1,0,0,1,0,1,1});
+  s.input(0, w);
+  s.control(0, 0);
+  s.control(1, 1);
+  s.process();
+
+  for (auto i = 0; i < 8; ++i)
+  {
+    chain.at(i)->d(Word<1>({w.bit(i)}));
+    chain.at(i)->commit();
+  }
+
+  for (auto i = 7; i >= 0; --i)
+  {
+    sim.logic([&, i]
+    {
+      Signal next = i == 7 ? 0 : chain.at(i+1)->q().bit(0);
+      chain.at(i)->d(Word<1>({next}));
+    });
+  }
+
+  s.control(0, 1);
+  for (auto cycle = 0; cycle < 8; ++cycle)
+  {
+    s.process();
+    sim.step();
+    for (auto i = 0; i < 8; ++i) assert(chain.at(i)->q().bit(0) == s.output().bit(i));
+  }
+}
+
+void testClock()
+{
+  testClockedSimulation();
+  testShiftRegisterChain();
+}
+
+
+#endif // CLOCK_HPP
@@ -27,6 +27,33 @@ class Word
     {
       return _word.at(position);
     }
+
+    Signal bit(int position) const
+    {
+      return _word.at(position);
+    }
+
+    // Build a word from the low N bits of an integer
+    static Word<N> fromInt(uint64_t value)
+    {
+      Word<N> w;
+      for (auto i = 0; i < N && i < 64; ++i)
+      {
+        w.bit(N-1-i) = (value >> i) & 1;
+      }
+      return w;
+    }
+
+    // Low 64 bits of the word as an integer
+    uint64_t toInt() const
+    {
+      uint64_t value = 0;
+      for (auto i = 0; i < N && i < 64; ++i)
+      {
+        value |= (uint64_t) _word.at(N-1-i) << i;
+      }
+      return value;
+    }
     
     void printValue() const
     {
@@ -148,6 +175,11 @@ class WordComponent
       return _outputs.at(channel);
     }
 
+    int outputs() const
+    {
+      return _outputs.size();
+    }
+
     void printValue()
     {
       for (auto o : _outputs) o.printValue();
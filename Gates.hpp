@@ -2,6 +2,7 @@
 #define GATES_HPP
 
 #include "Components.hpp"
+#include "Netlist.hpp"
 
 
 // Everything is built from NAND gates.
@@ -14,6 +15,9 @@ class NAND : public Component
     NAND() : Component(2, 1) {}
 
     void process();
+
+    // Add the same gates to a netlist, returning the output net
+    static Net synthesize(Netlist& n, Net a, Net b);
 };
 
 
@@ -30,6 +34,9 @@ class Inverter : public Component
 
     void process();
 
+    // Add the same gates to a netlist, returning the output net
+    static Net synthesize(Netlist& n, Net a);
+
   private:
     NAND _gate0;
 };
@@ -43,6 +50,9 @@ class AND : public Component
 
     void process();
 
+    // Add the same gates to a netlist, returning the output net
+    static Net synthesize(Netlist& n, Net a, Net b);
+
   private:
     NAND _gate0, _gate1;
 };
@@ -57,6 +67,9 @@ class OR : public Component
 
     void process();
 
+    // Add the same gates to a netlist, returning the output net
+    static Net synthesize(Netlist& n, Net a, Net b);
+
   private:
     NAND _gate0, _gate1, _gate2;
 };
@@ -71,6 +84,9 @@ class XOR : public Component
 
     void process();
 
+    // Add the same gates to a netlist, returning the output net
+    static Net synthesize(Netlist& n, Net a, Net b);
+
   private:
     NAND _gate0, _gate1, _gate2, _gate3;
 };
@@ -86,6 +102,8 @@ class WordInverter : public WordComponent<N>
   
     void process();
 
+    static Bus synthesize(Netlist& n, const Bus& a);
+
   private:
     std::vector<Inverter> _inverters;
 }; 
@@ -101,6 +119,8 @@ class WordNAND : public WordComponent<N>
   
     void process();
 
+    static Bus synthesize(Netlist& n, const Bus& a, const Bus& b);
+
   private:
     std::vector<NAND> _gates;
 }; 
@@ -116,6 +136,8 @@ class WordAND : public WordComponent<N>
   
     void process();
 
+    static Bus synthesize(Netlist& n, const Bus& a, const Bus& b);
+
   private:
     std::vector<AND> _gates;
 }; 
@@ -131,6 +153,8 @@ class WordOR : public WordComponent<N>
   
     void process();
 
+    static Bus synthesize(Netlist& n, const Bus& a, const Bus& b);
+
   private:
     std::vector<OR> _gates;
 }; 
@@ -146,6 +170,8 @@ class WordXOR : public WordComponent<N>
   
     void process();
 
+    static Bus synthesize(Netlist& n, const Bus& a, const Bus& b);
+
   private:
     std::vector<XOR> _gates;
 }; 
@@ -311,6 +337,89 @@ void WordXOR<N>::process()
 }
 
 
+// NETLIST DEFINITIONS
+
+Net NAND::synthesize(Netlist& n, Net a, Net b)
+{
+  return n.nand(a, b);
+}
+
+
+Net Inverter::synthesize(Netlist& n, Net a)
+{
+  return n.nand(a, a);
+}
+
+
+Net AND::synthesize(Netlist& n, Net a, Net b)
+{
+  Net gate0 = n.nand(a, b);
+  return n.nand(gate0, gate0);
+}
+
+
+Net OR::synthesize(Netlist& n, Net a, Net b)
+{
+  Net gate0 = n.nand(a, a);
+  Net gate1 = n.nand(b, b);
+  return n.nand(gate0, gate1);
+}
+
+
+Net XOR::synthesize(Netlist& n, Net a, Net b)
+{
+  Net gate0 = n.nand(a, b);
+  Net gate1 = n.nand(a, gate0);
+  Net gate2 = n.nand(gate0, b);
+  return n.nand(gate1, gate2);
+}
+
+
+template <int N>
+Bus WordInverter<N>::synthesize(Netlist& n, const Bus& a)
+{
+  Bus out(N);
+  for (auto i = 0; i < N; ++i) out.at(i) = Inverter::synthesize(n, a.at(i));
+  return out;
+}
+
+
+template <int N>
+Bus WordNAND<N>::synthesize(Netlist& n, const Bus& a, const Bus& b)
+{
+  Bus out(N);
+  for (auto i = 0; i < N; ++i) out.at(i) = n.nand(a.at(i), b.at(i));
+  return out;
+}
+
+
+template <int N>
+Bus WordAND<N>::synthesize(Netlist& n, const Bus& a, const Bus& b)
+{
+  Bus out(N);
+  for (auto i = 0; i < N; ++i) out.at(i) = AND::synthesize(n, a.at(i), b.at(i));
+  return out;
+}
+
+
+template <int N>
+Bus WordOR<N>::synthesize(Netlist& n, const Bus& a, const Bus& b)
+{
+  Bus out(N);
+  for (auto i = 0; i < N; ++i) out.at(i) = OR::synthesize(n, a.at(i), b.at(i));
+  return out;
+}
+
+
+template <int N>
+Bus WordXOR<N>::synthesize(Netlist& n, const Bus& a, const Bus& b)
+{
+  Bus out(N);
+  for (auto i = 0; i < N; ++i) out.at(i) = XOR::synthesize(n, a.at(i), b.at(i));
+  return out;
+}
+
+
 // GATE TESTS
 
 void testInverter()
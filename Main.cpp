@@ -2,7 +2,16 @@
 #include <iostream>
 
 #include "ALU.hpp"
+#include "Cache.hpp"
+#include "Clock.hpp"
 #include "Memory.hpp"
+#include "MultiProcess.hpp"
+#include "Multiply.hpp"
+#include "Pipeline.hpp"
+#include "Server.hpp"
+#include "Sweep.hpp"
+#include "Systolic.hpp"
+#include "Timing.hpp"
 
 /*
 
@@ -21,10 +30,21 @@ A library for digital systems design
 
 void testAll()
 {
+  testThreadPool();
+  testNetlists();
   testGates();
   testArithmetic();
+  testMultiply();
   testMultiplexers();
   testMemory();
+  testCache();
+  testClock();
+  testTiming();
+  testSystolic();
+  testPipeline();
+  testMultiProcess();
+  testSweep();
+  testServers();
 }
 
 void demoALU()
@@ -1,6 +1,23 @@
 #ifndef MEMORY_HPP
 #define MEMORY_HPP
 
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "Gates.hpp"
 #include "Muxes.hpp"
 
@@ -8,6 +25,36 @@
 // CLASS DECLARATIONS
 
 
+// Clock gating: a flip-flop that has been evaluated once holds its
+// value whenever its clock is low, so sequential components skip
+// evaluating their gates then. Switching it off evaluates everything,
+// which gives the same outputs.
+
+struct ClockGating
+{
+  static bool& enabled()
+  {
+    static bool on = true;
+    return on;
+  }
+};
+
+// Evaluations a sequential component skipped with its clock low,
+// and ones it actually did
+struct GatingCounters
+{
+  uint64_t gated = 0;
+  uint64_t active = 0;
+
+  GatingCounters& operator+=(const GatingCounters& other)
+  {
+    gated += other.gated;
+    active += other.active;
+    return *this;
+  }
+};
+
+
 // This is the NAND version used in D-type flip flops.
 // Set Input 0, Reset Input 1
 // Q Output 0, ~Q Output 1
@@ -19,7 +66,13 @@ class SRLatch : public Component
 
     void process();
 
+    // Set and reset nets, returns {Q, ~Q}
+    static Bus synthesize(Netlist& n, Net set, Net reset);
+
   private:
+    // Feedback passes before giving up on the latch settling
+    static const int maxPasses = 4;
+
     NAND _gate0, _gate1;
 };
 
@@ -35,10 +88,23 @@ class FlipFlop : public ControlComponent
 
     void process();
 
+    // Data and clock nets, returns {Q, ~Q}
+    static Bus synthesize(Netlist& n, Net data, Net clk);
+
+    const GatingCounters& gating() const
+    {
+      return _gating;
+    }
+
   private:
     Inverter _gate0;
     NAND _gate1, _gate2;
     SRLatch _latch0;
+
+    // The very first evaluation always runs, since the latch powers up
+    // into whatever the gates make of it
+    bool _settled = false;
+    GatingCounters _gating;
 };
 
 
@@ -56,8 +122,87 @@ class WordMemory : public WordControlComponent<N>
 
     void process();
 
+    const GatingCounters& gating() const
+    {
+      return _gating;
+    }
+
   private:
     std::vector<FlipFlop> _flipflops;
+
+    bool _settled = false;
+    GatingCounters _gating;
+};
+
+
+// A RAM image file, mapped into memory.
+// 32 byte header, then 2^(M-1) words of ceil(N/8) bytes each. A word
+// is stored as an unsigned number, least significant bit being the
+// last bit of the Word, in the byte order given by the header.
+// The mapping is shared, so writes reach the file without any
+// explicit save; sync() waits for them to hit the disk.
+
+class RAMImage
+{
+  public:
+    // Open an existing image
+    RAMImage(const std::string& path);
+
+    // Create (or replace) a zero-filled image for a RAM<M, N>
+    RAMImage(const std::string& path, int m, int n);
+
+    ~RAMImage();
+
+    RAMImage(const RAMImage&) = delete;
+    RAMImage& operator=(const RAMImage&) = delete;
+
+    int m() const { return _header->m; }
+    int n() const { return _header->n; }
+    bool bigEndian() const { return _header->bigEndian; }
+
+    uint64_t words() const
+    {
+      return (uint64_t) 1 << (m() - 1);
+    }
+
+    template <int N>
+    Word<N> read(uint64_t address) const;
+
+    template <int N>
+    void write(uint64_t address, const Word<N>& w);
+
+    void sync();
+
+  private:
+    struct Header
+    {
+      char magic[8];
+      uint32_t m;
+      uint32_t n;
+      uint8_t bigEndian;
+      uint8_t reserved[15];
+    };
+
+    static_assert(sizeof(Header) == 32, "Header must be 32 bytes");
+
+    int stride() const
+    {
+      return (n() + 7) / 8;
+    }
+
+    // Byte holding bits 8k..8k+7 of the word, counting from the LSB
+    uint8_t* byte(uint64_t address, int k) const
+    {
+      int b = bigEndian() ? stride() - 1 - k : k;
+      return _data + sizeof(Header) + address * stride() + b;
+    }
+
+    void map(int fd, size_t size, const std::string& path);
+
+    std::string _path;
+    Header* _header;
+    uint8_t* _data;
+    size_t _size;
 };
 
 
@@ -72,16 +217,376 @@ class RAM : public WordControlComponent<N>
       WordControlComponent<N>(1, M, 1),
       _words(pow(2, M-1)) {}
     
+    // Decodes the address once and only evaluates the path through
+    // the demultiplexers, the addressed word, and the path back out
+    // through the multiplexer. O(M + N) gates instead of O(2^M * N).
     void process();
 
+    // Evaluates every demultiplexer, word and multiplexer in the RAM.
+    // Reads and writes give the same results as process().
+    void processAll();
+
+    // Burst access to count words, the i-th at address start + i*stride
+    // (wrapping around the RAM), or at addresses[i] for gather/scatter.
+    // Writes take words from in, reads put them in out. Each word is
+    // clocked just as process() would clock it, and the RAM is left as
+    // if process() had been called for the last access.
+    void readBurst(uint64_t start, int count, Word<N>* out, int64_t stride = 1);
+    void writeBurst(uint64_t start, int count, const Word<N>* in, int64_t stride = 1);
+    void gather(const std::vector<uint64_t>& addresses, Word<N>* out);
+    void scatter(const std::vector<uint64_t>& addresses, const Word<N>* in);
+
+    // Clock every word straight from an image of the same shape,
+    // skipping the address decode.
+    void load(const RAMImage& image);
+
+    // Write every word out to an image of the same shape
+    void store(RAMImage& image);
+
+    // Load the image, then write every later write through to it,
+    // so the file always holds the RAM's contents.
+    void attach(RAMImage& image);
+    void detach();
+
+    // Word evaluations, summed over every word
+    GatingCounters gating() const
+    {
+      GatingCounters total;
+      for (auto& w : _words) total += w.gating();
+      return total;
+    }
+
   private:
+    template <typename Address>
+    void burst(int count, Address address, Signal write,
+               const Word<N>* in, Word<N>* out);
+
+    void check(const RAMImage& image) const;
+
     std::vector<WordMemory<N>> _words;
+    RAMImage* _image = nullptr;
     Nto1WordMultiplexer<M-1, N> _multiplexer;
     OnetoNWordDemultiplexer<M-1, N> _demultiplexer0;
     OnetoNDemultiplexer<M-1> _demultiplexer1;
 };
 
 
+// RAM with several ports over address-interleaved banks.
+// Each port p has input p, output p and controls p*M .. p*M+M-1, laid
+// out like a RAM's: write bit, then the address, most significant
+// first. The low address bits pick one of the Banks banks, each an
+// ordinary single-ported RAM, and each port reads its bank through a
+// word multiplexer.
+// A bank serves one port per process(). When ports collide on a bank
+// the lowest port wins and the others stall, holding their output,
+// except that reads of the same word are all served. Busy banks are
+// processed in parallel.
+
+template <int M, int N, int Ports = 2, int Banks = 4>
+class BankedRAM : public WordControlComponent<N>
+{
+  static_assert(Banks >= 2 && (Banks & (Banks - 1)) == 0,
+                "Banks must be a power of two");
+  static_assert(Ports >= 1, "Need at least one port");
+
+  public:
+    struct Counters
+    {
+      uint64_t reads = 0;
+      uint64_t writes = 0;
+      uint64_t conflicts = 0;
+    };
+
+    BankedRAM() :
+      WordControlComponent<N>(Ports, Ports * M, Ports),
+      _banks(Banks),
+      _multiplexers(Ports),
+      _counters(Banks),
+      _stalled(Ports, false) {}
+
+    void process();
+
+    // Whether the port lost its bank in the last process()
+    bool stalled(int port) const
+    {
+      return _stalled.at(port);
+    }
+
+    const Counters& counters(int bank) const
+    {
+      return _counters.at(bank);
+    }
+
+    void resetCounters()
+    {
+      std::fill(_counters.begin(), _counters.end(), Counters());
+    }
+
+  private:
+    static constexpr int log2(int x)
+    {
+      return x <= 1 ? 0 : 1 + log2(x / 2);
+    }
+
+    static const int bankBits = log2(Banks);
+
+    static_assert(M - 1 > bankBits, "Need address bits within each bank");
+
+    std::vector<RAM<M - bankBits, N>> _banks;
+    std::vector<Nto1WordMultiplexer<bankBits, N>> _multiplexers;
+    std::vector<Counters> _counters;
+    std::vector<bool> _stalled;
+};
+
+
+// RAM for address spaces too big to build up front.
+// Same control interface as RAM: bit 0 is write, bits 1..M-1 are the
+// address, most significant first. Storage is allocated a page of
+// WordMemory at a time, on the first write to that page, so only the
+// touched part of the address space costs anything. Addresses that
+// were never written read as zero.
+
+template <int M, int N, int PageBits = 8>
+class SparseRAM : public WordControlComponent<N>
+{
+  static_assert(M >= 2 && M <= 65, "Address must fit in 64 bits");
+
+  public:
+    SparseRAM() : WordControlComponent<N>(1, M, 1) {}
+
+    void process();
+
+    // Pages allocated so far
+    int pages() const
+    {
+      return _pages.size();
+    }
+
+    // Words of storage allocated so far
+    uint64_t words() const
+    {
+      return _pages.size() * ((uint64_t) 1 << pageBits);
+    }
+
+  private:
+    static const int pageBits = std::min(PageBits, M-1);
+
+    using Page = std::vector<WordMemory<N>>;
+
+    uint64_t address() const;
+
+    std::unordered_map<uint64_t, std::unique_ptr<Page>> _pages;
+};
+
+
+// Read-only memory of 2^A words, A address controls most significant
+// first, no inputs. Contents come from a table or a RAM image and are
+// compiled into one multiplexer tree per output bit with the data
+// folded in: ranges that hold a constant bit need no gates, address
+// bits a range doesn't depend on are skipped, and identical subtrees
+// are shared between bits. process() only evaluates the multiplexers
+// on the selected path. lookup() just indexes the table.
+
+template <int A, int N>
+class ROM : public WordControlComponent<N>
+{
+  static_assert(A >= 1 && A <= 30, "Address bits out of range");
+
+  public:
+    ROM(const std::vector<Word<N>>& contents);
+
+    // Table of 2^A values, first entry at address 0
+    ROM(const std::array<uint64_t, ((size_t) 1 << A)>& table);
+
+    // Image written for a RAM<A+1, N>
+    ROM(const RAMImage& image);
+
+    void process();
+
+    const Word<N>& lookup(uint64_t address) const
+    {
+      return _contents.at(address);
+    }
+
+    // Multiplexers left after folding
+    int multiplexers() const
+    {
+      return _nodes.size();
+    }
+
+    // Address is A nets, most significant first
+    Bus synthesize(Netlist& n, const Bus& address) const;
+
+  private:
+    // A reference is 0 or 1 for a constant, or 2 + node number
+    struct Node
+    {
+      int control;
+      int zero, one;
+    };
+
+    void compile();
+
+    // Brings a reference up to date for the current address
+    int evaluate(int ref);
+
+    std::vector<Word<N>> _contents;
+    std::vector<Node> _nodes;
+    std::vector<int> _roots;
+    std::vector<Multiplexer> _multiplexers;
+    std::vector<Signal> _values;
+    std::vector<uint64_t> _evaluated;
+    uint64_t _epoch = 0;
+};
+
+
+// Register file of Regs words with several read and write ports, all
+// served by one process(). With R = log2(Regs), read port p has
+// output p and address controls p*R .. p*R+R-1. Write port w has
+// input w and, from control ReadPorts*R + w*(R+1), an enable bit then
+// the address. Addresses are most significant bit first.
+// Reads see the registers as they were before this process(). If two
+// write ports hit the same register, the higher numbered port wins.
+// In fast mode registers are packed into 64-bit limbs and ports just
+// index them; switching modes carries the contents across.
+
+template <int Regs, int N, int ReadPorts = 2, int WritePorts = 1>
+class RegisterFile : public WordControlComponent<N>
+{
+  static_assert(Regs >= 2 && (Regs & (Regs - 1)) == 0,
+                "Regs must be a power of two");
+
+  public:
+    RegisterFile() :
+      WordControlComponent<N>(WritePorts,
+                              ReadPorts * R + WritePorts * (R + 1),
+                              ReadPorts),
+      _registers(Regs),
+      _readers(ReadPorts),
+      _decoders(WritePorts),
+      _packed(Regs * limbs, 0)
+    {
+      // Reset every register to zero, so none is left to power up
+      // on its first clock
+      for (auto& r : _registers)
+      {
+        r.control(0, 1);
+        r.process();
+      }
+    }
+
+    void process();
+
+    bool fast() const
+    {
+      return _fast;
+    }
+
+    void fast(bool on);
+
+  private:
+    static constexpr int log2(int x)
+    {
+      return x <= 1 ? 0 : 1 + log2(x / 2);
+    }
+
+    static const int R = log2(Regs);
+    static const int limbs = (N + 63) / 64;
+
+    int address(int control) const
+    {
+      int a = 0;
+      for (auto i = 0; i < R; ++i) a = (a << 1) | this->_controls.at(control + i);
+      return a;
+    }
+
+    void processGates();
+    void processPacked();
+
+    std::vector<WordMemory<N>> _registers;
+    std::vector<Nto1WordMultiplexer<R, N>> _readers;
+    std::vector<OnetoNDemultiplexer<R>> _decoders;
+
+    bool _fast = false;
+    std::vector<uint64_t> _packed;
+};
+
+
+// Content-addressable memory of Entries words.
+// Control bit 0 is write, bits 1..log2(Entries) the entry to write,
+// most significant first. A write stores input 0 in that entry and
+// marks it valid. Otherwise input 0 is compared with every valid entry
+// at once (WordXOR, OR reduction and the valid bit for each) and a
+// priority encoder picks the lowest matching entry. Output 0 is its
+// index, match() says whether there was one.
+// find() gives the same answer from a hash of the stored words.
+
+template <int Entries, int N>
+class CAM : public WordControlComponent<N>
+{
+  static_assert(Entries >= 2 && (Entries & (Entries - 1)) == 0,
+                "Entries must be a power of two");
+
+  public:
+    CAM() :
+      WordControlComponent<N>(1, 1 + indexBits, 1),
+      _entries(Entries),
+      _valid(Entries),
+      _comparators(Entries) {}
+
+    void process();
+
+    Signal match() const
+    {
+      return _encoder.output(indexBits);
+    }
+
+    // Lowest entry holding key, or -1
+    int find(const Word<N>& key) const;
+
+    // Distinct words stored, never more than Entries
+    int keys() const
+    {
+      return _index.size();
+    }
+
+  private:
+    static constexpr int log2(int x)
+    {
+      return x <= 1 ? 0 : 1 + log2(x / 2);
+    }
+
+    static const int indexBits = log2(Entries);
+
+    static_assert(indexBits <= N, "Index must fit in a word");
+
+    static std::string pack(const Word<N>& w)
+    {
+      std::string key((N + 7) / 8, 0);
+      for (auto i = 0; i < N; ++i) key[i / 8] |= w.bit(i) << (i % 8);
+      return key;
+    }
+
+    // Compares the key with one entry: XOR each bit, OR the
+    // differences together, and match if none differ and it's valid
+    struct Comparator
+    {
+      WordXOR<N> compare;
+      std::vector<OR> differ = std::vector<OR>(N - 1);
+      Inverter same;
+      AND match;
+    };
+
+    std::vector<WordMemory<N>> _entries;
+    std::vector<FlipFlop> _valid;
+    std::vector<Comparator> _comparators;
+    PriorityEncoder<indexBits> _encoder;
+
+    // Entries holding each stored word, lowest first
+    std::unordered_map<std::string, std::set<int>> _index;
+};
+
+
 // Parallel in, parallel out shift register.
 // This would be useful for building a bit shifter.
 // The process() method will shift all elements to the left by one.
@@ -99,12 +604,122 @@ class ShiftRegister : public WordControlComponent<N>
  
     void process();
 
+    const GatingCounters& gating() const
+    {
+      return _gating;
+    }
+
   private:
     std::vector<FlipFlop> _flipflops;
     std::vector<Multiplexer> _multiplexers;
+
+    bool _settled = false;
+    GatingCounters _gating;
 };
 
 
+// RAM IMAGE DEFINITIONS
+
+
+RAMImage::RAMImage(const std::string& path) : _path(path)
+{
+  int fd = open(path.c_str(), O_RDWR);
+  if (fd < 0) throw std::runtime_error("Can't open " + path);
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(Header))
+  {
+    close(fd);
+    throw std::runtime_error("Not a RAM image: " + path);
+  }
+
+  map(fd, st.st_size, path);
+
+  if (std::memcmp(_header->magic, "LOOBRAM1", 8) != 0
+      || m() < 1 || m() > 40 || n() < 1
+      || _size < sizeof(Header) + words() * stride())
+  {
+    munmap(_data, _size);
+    throw std::runtime_error("Not a RAM image: " + path);
+  }
+}
+
+RAMImage::RAMImage(const std::string& path, int m, int n) : _path(path)
+{
+  if (m < 1 || m > 40 || n < 1) throw std::invalid_argument("Bad RAM shape");
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw std::runtime_error("Can't create " + path);
+
+  size_t size = sizeof(Header) + ((uint64_t) 1 << (m - 1)) * ((n + 7) / 8);
+
+  // The file is sparse, so the zeroed words cost nothing on disk
+  if (ftruncate(fd, size) != 0)
+  {
+    close(fd);
+    throw std::runtime_error("ftruncate failed: " + path);
+  }
+
+  map(fd, size, path);
+
+  uint16_t probe = 1;
+  std::memcpy(_header->magic, "LOOBRAM1", 8);
+  _header->m = m;
+  _header->n = n;
+  _header->bigEndian = *(uint8_t*) &probe == 0;
+}
+
+RAMImage::~RAMImage()
+{
+  munmap(_data, _size);
+}
+
+void RAMImage::map(int fd, size_t size, const std::string& path)
+{
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED) throw std::runtime_error("mmap failed: " + path);
+
+  _data = (uint8_t*) data;
+  _header = (Header*) data;
+  _size = size;
+}
+
+template <int N>
+Word<N> RAMImage::read(uint64_t address) const
+{
+  Word<N> w;
+  for (auto i = 0; i < N; ++i)
+  {
+    w.bit(N-1-i) = (*byte(address, i / 8) >> (i % 8)) & 1;
+  }
+  return w;
+}
+
+template <int N>
+void RAMImage::write(uint64_t address, const Word<N>& w)
+{
+  for (auto k = 0; k < stride(); ++k)
+  {
+    uint8_t b = 0;
+    for (auto i = 8*k; i < std::min(N, 8*k + 8); ++i)
+    {
+      b |= w.bit(N-1-i) << (i % 8);
+    }
+    *byte(address, k) = b;
+  }
+}
+
+void RAMImage::sync()
+{
+  if (msync(_data, _size, MS_SYNC) != 0)
+  {
+    throw std::runtime_error("msync failed: " + _path);
+  }
+}
+
+
 // PROCESS DEFINITIONS
 
 void SRLatch::process()
@@ -118,16 +733,21 @@ void SRLatch::process()
 
   // Non-simultaneous feedback to mimic real-life conditions.
   // If feedback is simultaneous, oscillation occurs.
-  _gate0.input(1, _gate1.output());
-  _gate0.process();
-  _gate1.input(1, _gate0.output());
-  _gate1.process();
+  // Repeat until a pass changes nothing. A latch that is holding
+  // settles in one pass, a flip takes two.
+  for (auto pass = 1; ; ++pass)
+  {
+    Signal q = _gate0.output(), nq = _gate1.output();
 
-  // Needs to be processed twice to force stable state.
-  _gate0.input(1, _gate1.output());
-  _gate0.process();
-  _gate1.input(1, _gate0.output());
-  _gate1.process();
+    _gate0.input(1, _gate1.output());
+    _gate0.process();
+    _gate1.input(1, _gate0.output());
+    _gate1.process();
+
+    if (_gate0.output() == q && _gate1.output() == nq) break;
+
+    if (pass == maxPasses) throw std::runtime_error("SRLatch did not settle");
+  }
 
   _outputs.at(0) = _gate0.output();
   _outputs.at(1) = _gate1.output();
@@ -137,85 +757,689 @@ void FlipFlop::process()
 {
   Signal data = _inputs.at(0);
   Signal clk = _controls.at(0);
+
+  // Gates 1 and 2 would both give 1 and the latch would hold
+  if (!clk && _settled && ClockGating::enabled())
+  {
+    ++_gating.gated;
+    return;
+  }
+
+  _settled = true;
+  ++_gating.active;
   
   // Data -> Gate 0 (inverter)
   _gate0.input(0, data);
   _gate0.process();
 
-  // Data, Clk -> Gate 1 
-  _gate1.input(0, data);
-  _gate1.input(1, clk);
-  _gate1.process();
+  // Data, Clk -> Gate 1 
+  _gate1.input(0, data);
+  _gate1.input(1, clk);
+  _gate1.process();
+
+  // Clock, Gate 0 -> Gate 2
+  _gate2.input(0, clk);
+  _gate2.input(1, _gate0.output());
+  _gate2.process();
+
+  // Gate 1, Gate 2 -> Latch 0
+  _latch0.input(0, _gate1.output());
+  _latch0.input(1, _gate2.output());
+  _latch0.process();
+
+  _outputs.at(0) = _latch0.output(0);
+  _outputs.at(1) = _latch0.output(1);
+}
+
+template <int N>
+void WordMemory<N>::process()
+{
+  if (!this->_controls.at(0) && _settled && ClockGating::enabled())
+  {
+    ++_gating.gated;
+    return;
+  }
+
+  _settled = true;
+  ++_gating.active;
+
+  for (auto i = 0; i < N; ++i)  
+  {
+    FlipFlop& f = _flipflops.at(i);
+    f.input(0, this->_inputs.at(0).bit(i));
+    f.control(0, this->_controls.at(0));
+    f.process();
+    this->_outputs.at(0).bit(i) = f.output();
+  }
+}
+
+
+template <int M, int N>
+void RAM<M, N>::process()
+{
+  int address = 0;
+
+  for (auto i = 0; i < M-1; ++i)
+  {
+    // Demultiplexers and multiplexer share control bits 1..M-1
+    _demultiplexer0.control(i, this->_controls.at(i+1));  
+    _demultiplexer1.control(i, this->_controls.at(i+1));  
+    _multiplexer.control(i, this->_controls.at(i+1));  
+    address = (address << 1) | this->_controls.at(i+1);
+  }
+
+  _demultiplexer0.input(0, this->_inputs.at(0));
+  _demultiplexer0.processPath();
+
+  _demultiplexer1.input(0, this->_controls.at(0));
+  _demultiplexer1.processPath();
+
+  // Every other word has its enable bit low and holds its value
+  WordMemory<N>& w = _words.at(address);
+  w.input(0, _demultiplexer0.output(address));
+  w.control(0, _demultiplexer1.output(address));
+  w.process();
+  _multiplexer.input(address, w.output());
+
+  if (_image && this->_controls.at(0)) _image->write(address, w.output());
+
+  _multiplexer.processPath();
+
+  this->_outputs.at(0) = _multiplexer.output();
+}
+
+
+template <int M, int N>
+void RAM<M, N>::processAll()
+{
+  int address = 0;
+
+  for (auto i = 0; i < M-1; ++i)
+  {
+    // Demultiplexers and multiplexer share control bits 1..M-1
+    _demultiplexer0.control(i, this->_controls.at(i+1));  
+    _demultiplexer1.control(i, this->_controls.at(i+1));  
+    _multiplexer.control(i, this->_controls.at(i+1));  
+    address = (address << 1) | this->_controls.at(i+1);
+  }
+
+  // This controls where the input is sent to
+  _demultiplexer0.input(0, this->_inputs.at(0));
+  _demultiplexer0.process();
+
+  // This controls which word gets control signal
+  _demultiplexer1.input(0, this->_controls.at(0));
+  _demultiplexer1.process();
+
+  // Every word sees its own slice of the demultiplexer outputs,
+  // so the bank can be split across threads.
+  ThreadPool::instance().parallelFor(_words.size(), [this](int begin, int end)
+  {
+    for (auto i = begin; i < end; ++i)
+    {
+      // Send demultiplexer output to memory
+      _words.at(i).input(0, _demultiplexer0.output(i));
+      _words.at(i).control(0, _demultiplexer1.output(i));
+      _words.at(i).process(); // Noop if enable bit not set
+      _multiplexer.input(i, _words.at(i).output());
+    }
+  }, std::max(1, 1024 / N));
+
+  if (_image && this->_controls.at(0)) _image->write(address, _words.at(address).output());
+  
+  _multiplexer.process();
+  
+  this->_outputs.at(0) = _multiplexer.output();
+}
+
+// Within a burst the write bit is fixed, so the decode only ever
+// routes the data and the write bit to the addressed word and leaves
+// every other word's enable low. The words are clocked with that
+// directly; only the last access goes through the full path, to leave
+// the controls, multiplexer and output where process() would. Words
+// written directly go to an attached image here, the last in process().
+
+template <int M, int N>
+template <typename Address>
+void RAM<M, N>::burst(int count, Address address, Signal write,
+                      const Word<N>* in, Word<N>* out)
+{
+  if (count <= 0) return;
+
+  const uint64_t mask = _words.size() - 1;
+
+  for (auto i = 0; i < count - 1; ++i)
+  {
+    uint64_t a = address(i) & mask;
+    WordMemory<N>& w = _words.at(a);
+    if (write) w.input(0, in[i]);
+    w.control(0, write);
+    w.process();
+    if (out) out[i] = w.output();
+    if (_image && write) _image->write(a, w.output());
+  }
+
+  uint64_t last = address(count - 1) & mask;
+  if (write) this->_inputs.at(0) = in[count - 1];
+  this->_controls.at(0) = write;
+  for (auto i = 1; i < M; ++i) this->_controls.at(i) = (last >> (M-1-i)) & 1;
+  process();
+  if (out) out[count - 1] = this->_outputs.at(0);
+}
+
+template <int M, int N>
+void RAM<M, N>::readBurst(uint64_t start, int count, Word<N>* out, int64_t stride)
+{
+  burst(count, [=](int i) { return start + i * stride; }, 0, nullptr, out);
+}
+
+template <int M, int N>
+void RAM<M, N>::writeBurst(uint64_t start, int count, const Word<N>* in, int64_t stride)
+{
+  burst(count, [=](int i) { return start + i * stride; }, 1, in, nullptr);
+}
+
+template <int M, int N>
+void RAM<M, N>::gather(const std::vector<uint64_t>& addresses, Word<N>* out)
+{
+  burst(addresses.size(), [&](int i) { return addresses[i]; }, 0, nullptr, out);
+}
+
+template <int M, int N>
+void RAM<M, N>::scatter(const std::vector<uint64_t>& addresses, const Word<N>* in)
+{
+  burst(addresses.size(), [&](int i) { return addresses[i]; }, 1, in, nullptr);
+}
+
+template <int M, int N>
+void RAM<M, N>::check(const RAMImage& image) const
+{
+  if (image.m() != M || image.n() != N)
+  {
+    throw std::invalid_argument("Image is for RAM<" + std::to_string(image.m())
+      + ", " + std::to_string(image.n()) + ">");
+  }
+}
+
+template <int M, int N>
+void RAM<M, N>::load(const RAMImage& image)
+{
+  check(image);
+
+  ThreadPool::instance().parallelFor(_words.size(), [&](int begin, int end)
+  {
+    for (auto i = begin; i < end; ++i)
+    {
+      WordMemory<N>& w = _words.at(i);
+      w.input(0, image.read<N>(i));
+      w.control(0, 1);
+      w.process();
+    }
+  }, std::max(1, 1024 / N));
+}
+
+template <int M, int N>
+void RAM<M, N>::store(RAMImage& image)
+{
+  check(image);
+
+  for (size_t i = 0; i < _words.size(); ++i)
+  {
+    image.write(i, _words.at(i).output());
+  }
+}
+
+template <int M, int N>
+void RAM<M, N>::attach(RAMImage& image)
+{
+  load(image);
+  _image = &image;
+}
+
+template <int M, int N>
+void RAM<M, N>::detach()
+{
+  _image = nullptr;
+}
+
+
+template <int M, int N, int Ports, int Banks>
+void BankedRAM<M, N, Ports, Banks>::process()
+{
+  std::vector<uint64_t> address(Ports);
+  std::vector<int> owner(Banks, -1);
+
+  // Arbitrate, lowest port first
+  for (auto p = 0; p < Ports; ++p)
+  {
+    address.at(p) = 0;
+    for (auto i = 1; i < M; ++i)
+    {
+      address.at(p) = (address.at(p) << 1) | this->_controls.at(p*M + i);
+    }
+
+    int bank = address.at(p) & (Banks - 1);
+    int o = owner.at(bank);
+    Signal write = this->_controls.at(p*M);
+
+    if (o < 0)
+    {
+      owner.at(bank) = p;
+      _stalled.at(p) = false;
+      if (write) ++_counters.at(bank).writes;
+      else ++_counters.at(bank).reads;
+    }
+    else if (!write && !this->_controls.at(o*M) && address.at(o) == address.at(p))
+    {
+      _stalled.at(p) = false;
+      ++_counters.at(bank).reads;
+    }
+    else
+    {
+      _stalled.at(p) = true;
+      ++_counters.at(bank).conflicts;
+    }
+  }
+
+  std::vector<int> busy;
+  for (auto b = 0; b < Banks; ++b)
+  {
+    if (owner.at(b) >= 0) busy.push_back(b);
+  }
+
+  // Banks share nothing, so each can run on its own thread
+  ThreadPool::instance().parallelFor(busy.size(), [&](int begin, int end)
+  {
+    for (auto i = begin; i < end; ++i)
+    {
+      int b = busy.at(i);
+      int p = owner.at(b);
+      RAM<M - bankBits, N>& bank = _banks.at(b);
+
+      bank.input(0, this->_inputs.at(p));
+      bank.control(0, this->_controls.at(p*M));
+      for (auto c = 1; c < M - bankBits; ++c)
+      {
+        bank.control(c, this->_controls.at(p*M + c));
+      }
+      bank.process();
+    }
+  }, std::max(1, 256 / N));
+
+  // Route each served port's bank back out
+  for (auto p = 0; p < Ports; ++p)
+  {
+    if (_stalled.at(p)) continue;
+
+    Nto1WordMultiplexer<bankBits, N>& mux = _multiplexers.at(p);
+    int bank = address.at(p) & (Banks - 1);
+
+    for (auto i = 0; i < bankBits; ++i)
+    {
+      mux.control(i, this->_controls.at(p*M + M - bankBits + i));
+    }
+    mux.input(bank, _banks.at(bank).output());
+    mux.processPath();
+
+    this->_outputs.at(p) = mux.output();
+  }
+}
+
+
+template <int M, int N, int PageBits>
+uint64_t SparseRAM<M, N, PageBits>::address() const
+{
+  uint64_t a = 0;
+  for (auto i = 1; i < M; ++i) a = (a << 1) | this->_controls.at(i);
+  return a;
+}
+
+template <int M, int N, int PageBits>
+void SparseRAM<M, N, PageBits>::process()
+{
+  uint64_t a = address();
+  uint64_t page = a >> pageBits;
+  uint64_t offset = a & (((uint64_t) 1 << pageBits) - 1);
+
+  auto p = _pages.find(page);
+
+  if (this->_controls.at(0))
+  {
+    if (p == _pages.end())
+    {
+      p = _pages.emplace(page, std::make_unique<Page>(1 << pageBits)).first;
+    }
+
+    WordMemory<N>& w = p->second->at(offset);
+    w.input(0, this->_inputs.at(0));
+    w.control(0, 1);
+    w.process();
+  }
+
+  // Words are only ever clocked to write them, so a word that was
+  // allocated but never written still reads as zero
+  if (p == _pages.end()) this->_outputs.at(0) = Word<N>();
+  else this->_outputs.at(0) = p->second->at(offset).output();
+}
+
+
+template <int A, int N>
+ROM<A, N>::ROM(const std::vector<Word<N>>& contents) :
+  WordControlComponent<N>(0, A, 1),
+  _contents(contents)
+{
+  if (_contents.size() != ((size_t) 1 << A))
+  {
+    throw std::invalid_argument("ROM needs 2^A words");
+  }
+  compile();
+}
+
+template <int A, int N>
+ROM<A, N>::ROM(const std::array<uint64_t, ((size_t) 1 << A)>& table) :
+  WordControlComponent<N>(0, A, 1)
+{
+  for (auto v : table) _contents.push_back(Word<N>::fromInt(v));
+  compile();
+}
+
+template <int A, int N>
+ROM<A, N>::ROM(const RAMImage& image) :
+  WordControlComponent<N>(0, A, 1)
+{
+  if (image.m() != A + 1 || image.n() != N)
+  {
+    throw std::invalid_argument("Image is for RAM<" + std::to_string(image.m())
+      + ", " + std::to_string(image.n()) + ">");
+  }
+
+  for (uint64_t i = 0; i < image.words(); ++i)
+  {
+    _contents.push_back(image.read<N>(i));
+  }
+  compile();
+}
+
+template <int A, int N>
+void ROM<A, N>::compile()
+{
+  std::map<std::tuple<int, int, int>, int> shared;
+
+  // Build bottom up, so every node comes after its children
+  std::function<int(int, int, uint64_t)> build =
+    [&](int bit, int depth, uint64_t first) -> int
+  {
+    if (depth == A) return _contents.at(first).bit(bit);
+
+    uint64_t half = (uint64_t) 1 << (A - 1 - depth);
+    int zero = build(bit, depth + 1, first);
+    int one = build(bit, depth + 1, first + half);
+
+    // The address bit makes no difference here
+    if (zero == one) return zero;
+
+    auto key = std::make_tuple(depth, zero, one);
+    auto found = shared.find(key);
+    if (found != shared.end()) return found->second;
+
+    _nodes.push_back({depth, zero, one});
+    return shared[key] = 2 + _nodes.size() - 1;
+  };
+
+  for (auto bit = 0; bit < N; ++bit) _roots.push_back(build(bit, 0, 0));
+
+  _multiplexers.resize(_nodes.size());
+  _values.resize(2 + _nodes.size());
+  _values.at(1) = 1;
+  _evaluated.resize(_nodes.size(), 0);
+}
+
+template <int A, int N>
+int ROM<A, N>::evaluate(int ref)
+{
+  if (ref < 2 || _evaluated.at(ref - 2) == _epoch) return _values.at(ref);
+
+  const Node& node = _nodes.at(ref - 2);
+  Multiplexer& m = _multiplexers.at(ref - 2);
+  Signal control = this->_controls.at(node.control);
+
+  // Only the selected side is brought up to date, the other input
+  // can't reach the output
+  m.input(0, control ? _values.at(node.zero) : evaluate(node.zero));
+  m.input(1, control ? evaluate(node.one) : _values.at(node.one));
+  m.control(0, control);
+  m.process();
+
+  _evaluated.at(ref - 2) = _epoch;
+  return _values.at(ref) = m.output();
+}
+
+template <int A, int N>
+void ROM<A, N>::process()
+{
+  ++_epoch;
+
+  for (auto bit = 0; bit < N; ++bit)
+  {
+    this->_outputs.at(0).bit(bit) = evaluate(_roots.at(bit));
+  }
+}
+
+template <int A, int N>
+Bus ROM<A, N>::synthesize(Netlist& n, const Bus& address) const
+{
+  std::vector<Net> nets = {n.constant(0), n.constant(1)};
+
+  for (auto& node : _nodes)
+  {
+    nets.push_back(Multiplexer::synthesize(n, nets.at(node.zero),
+      nets.at(node.one), address.at(node.control)));
+  }
+
+  Bus out(N);
+  for (auto bit = 0; bit < N; ++bit) out.at(bit) = nets.at(_roots.at(bit));
+  return out;
+}
+
+
+template <int Regs, int N, int ReadPorts, int WritePorts>
+void RegisterFile<Regs, N, ReadPorts, WritePorts>::process()
+{
+  if (_fast) processPacked();
+  else processGates();
+}
+
+template <int Regs, int N, int ReadPorts, int WritePorts>
+void RegisterFile<Regs, N, ReadPorts, WritePorts>::processGates()
+{
+  // Reads first, so they see the old contents
+  for (auto p = 0; p < ReadPorts; ++p)
+  {
+    Nto1WordMultiplexer<R, N>& mux = _readers.at(p);
+    int a = address(p * R);
+
+    for (auto i = 0; i < R; ++i) mux.control(i, this->_controls.at(p*R + i));
+    mux.input(a, _registers.at(a).output());
+    mux.processPath();
 
-  // Clock, Gate 0 -> Gate 2
-  _gate2.input(0, clk);
-  _gate2.input(1, _gate0.output());
-  _gate2.process();
+    this->_outputs.at(p) = mux.output();
+  }
 
-  // Gate 1, Gate 2 -> Latch 0
-  _latch0.input(0, _gate1.output());
-  _latch0.input(1, _gate2.output());
-  _latch0.process();
+  // The decoder routes the enable bit to the addressed register,
+  // every other register holds
+  for (auto w = 0; w < WritePorts; ++w)
+  {
+    OnetoNDemultiplexer<R>& decoder = _decoders.at(w);
+    int base = ReadPorts * R + w * (R + 1);
+    int a = address(base + 1);
+
+    decoder.input(0, this->_controls.at(base));
+    for (auto i = 0; i < R; ++i) decoder.control(i, this->_controls.at(base + 1 + i));
+    decoder.processPath();
+
+    WordMemory<N>& reg = _registers.at(a);
+    reg.input(0, this->_inputs.at(w));
+    reg.control(0, decoder.output(a));
+    reg.process();
+  }
+}
 
-  _outputs.at(0) = _latch0.output(0);
-  _outputs.at(1) = _latch0.output(1);
+template <int Regs, int N, int ReadPorts, int WritePorts>
+void RegisterFile<Regs, N, ReadPorts, WritePorts>::processPacked()
+{
+  for (auto p = 0; p < ReadPorts; ++p)
+  {
+    const uint64_t* reg = &_packed.at(address(p * R) * limbs);
+    Word<N>& out = this->_outputs.at(p);
+    for (auto i = 0; i < N; ++i) out.bit(i) = (reg[i / 64] >> (i % 64)) & 1;
+  }
+
+  for (auto w = 0; w < WritePorts; ++w)
+  {
+    int base = ReadPorts * R + w * (R + 1);
+    if (!this->_controls.at(base)) continue;
+
+    uint64_t* reg = &_packed.at(address(base + 1) * limbs);
+    const Word<N>& in = this->_inputs.at(w);
+    std::fill(reg, reg + limbs, 0);
+    for (auto i = 0; i < N; ++i) reg[i / 64] |= (uint64_t) in.bit(i) << (i % 64);
+  }
 }
 
-template <int N>
-void WordMemory<N>::process()
+template <int Regs, int N, int ReadPorts, int WritePorts>
+void RegisterFile<Regs, N, ReadPorts, WritePorts>::fast(bool on)
 {
-  for (auto i = 0; i < N; ++i)  
+  if (on == _fast) return;
+
+  for (auto r = 0; r < Regs; ++r)
   {
-    FlipFlop& f = _flipflops.at(i);
-    f.input(0, this->_inputs.at(0).bit(i));
-    f.control(0, this->_controls.at(0));
-    f.process();
-    this->_outputs.at(0).bit(i) = f.output();
+    uint64_t* reg = &_packed.at(r * limbs);
+    WordMemory<N>& m = _registers.at(r);
+
+    if (on)
+    {
+      const Word<N>& w = m.output();
+      std::fill(reg, reg + limbs, 0);
+      for (auto i = 0; i < N; ++i) reg[i / 64] |= (uint64_t) w.bit(i) << (i % 64);
+    }
+    else
+    {
+      Word<N> w;
+      for (auto i = 0; i < N; ++i) w.bit(i) = (reg[i / 64] >> (i % 64)) & 1;
+      m.input(0, w);
+      m.control(0, 1);
+      m.process();
+    }
   }
+
+  _fast = on;
 }
 
 
-template <int M, int N>
-void RAM<M, N>::process()
+template <int Entries, int N>
+void CAM<Entries, N>::process()
 {
-  for (auto i = 0; i < M-1; ++i)
+  const Word<N>& key = this->_inputs.at(0);
+
+  if (this->_controls.at(0))
   {
-    // Demultiplexers and multiplexer share control bits 1..M-1
-    _demultiplexer0.control(i, this->_controls.at(i+1));  
-    _demultiplexer1.control(i, this->_controls.at(i+1));  
-    _multiplexer.control(i, this->_controls.at(i+1));  
+    int e = 0;
+    for (auto i = 1; i <= indexBits; ++i) e = (e << 1) | this->_controls.at(i);
+
+    WordMemory<N>& entry = _entries.at(e);
+    FlipFlop& valid = _valid.at(e);
+
+    // Drop emptied buckets, or every key ever written would keep one
+    if (valid.output())
+    {
+      auto old = _index.find(pack(entry.output()));
+      old->second.erase(e);
+      if (old->second.empty()) _index.erase(old);
+    }
+    _index.try_emplace(pack(key)).first->second.insert(e);
+
+    entry.input(0, key);
+    entry.control(0, 1);
+    entry.process();
+
+    valid.input(0, 1);
+    valid.control(0, 1);
+    valid.process();
+    return;
   }
 
-  // This controls where the input is sent to
-  _demultiplexer0.input(0, this->_inputs.at(0));
-  _demultiplexer0.process();
+  // Every entry has its own comparator, so split them across threads
+  std::vector<Signal> matches(Entries);
 
-  // This controls which word gets control signal
-  _demultiplexer1.input(0, this->_controls.at(0));
-  _demultiplexer1.process();
+  ThreadPool::instance().parallelFor(Entries, [&](int begin, int end)
+  {
+    for (auto e = begin; e < end; ++e)
+    {
+      Comparator& c = _comparators.at(e);
+
+      c.compare.input(0, _entries.at(e).output());
+      c.compare.input(1, key);
+      c.compare.process();
+
+      Signal d = c.compare.output().bit(0);
+      for (auto i = 1; i < N; ++i)
+      {
+        OR& differ = c.differ.at(i - 1);
+        differ.input(0, d);
+        differ.input(1, c.compare.output().bit(i));
+        differ.process();
+        d = differ.output();
+      }
+
+      c.same.input(0, d);
+      c.same.process();
+
+      c.match.input(0, c.same.output());
+      c.match.input(1, _valid.at(e).output());
+      c.match.process();
+
+      matches.at(e) = c.match.output();
+    }
+  }, std::max(1, 512 / N));
 
-  for (auto i = 0; i < pow(2, M-1); ++i)
+  for (auto e = 0; e < Entries; ++e) _encoder.input(e, matches.at(e));
+  _encoder.process();
+
+  Word<N>& out = this->_outputs.at(0);
+  out = Word<N>();
+  for (auto i = 0; i < indexBits; ++i)
   {
-    // Send demultiplexer output to memory
-    _words.at(i).input(0, _demultiplexer0.output(i));
-    _words.at(i).control(0, _demultiplexer1.output(i));
-    _words.at(i).process(); // Noop if enable bit not set
-    _multiplexer.input(i, _words.at(i).output());
+    out.bit(N - indexBits + i) = _encoder.output(i);
   }
-  
-  _multiplexer.process();
-  
-  this->_outputs.at(0) = _multiplexer.output();
+}
+
+template <int Entries, int N>
+int CAM<Entries, N>::find(const Word<N>& key) const
+{
+  auto i = _index.find(pack(key));
+  if (i == _index.end()) return -1;
+  return *i->second.begin();
 }
 
 
 template <int N>
 void ShiftRegister<N>::process()
 {
+  // With the clock low no flip-flop changes, and the muxes only
+  // feed the flip-flops
+  if (!this->_controls.at(1) && _settled && ClockGating::enabled())
+  {
+    ++_gating.gated;
+    return;
+  }
+
+  _settled = true;
+  ++_gating.active;
+
+  // Every mux sees the flip-flops as they were before this clock
   for (auto i = 0; i < N; ++i)
   {
     Multiplexer& m = _multiplexers.at(i);
-    FlipFlop& f = _flipflops.at(i);
 
     m.input(0, this->_inputs.at(0).bit(i));
 
@@ -232,16 +1456,44 @@ void ShiftRegister<N>::process()
 
     m.control(0, this->_controls.at(0)); 
     m.process();
-    
-    f.input(0, m.output());
+  }
+
+  // Then they all latch together
+  for (auto i = 0; i < N; ++i)
+  {
+    FlipFlop& f = _flipflops.at(i);
+
+    f.input(0, _multiplexers.at(i).output());
     f.control(0, this->_controls.at(1));
     f.process();
 
-    this->_outputs.at(0).bit(i) = _flipflops.at(i).output();
+    this->_outputs.at(0).bit(i) = f.output();
   } 
 } 
 
 
+// NETLIST DEFINITIONS
+
+
+Bus SRLatch::synthesize(Netlist& n, Net set, Net reset)
+{
+  // ~Q feeds back into the first gate
+  Net feedback = n.loop();
+  Net q = n.nand(set, feedback);
+  Net nq = n.nand(reset, q);
+  n.close(feedback, nq);
+  return {q, nq};
+}
+
+Bus FlipFlop::synthesize(Netlist& n, Net data, Net clk)
+{
+  Net gate0 = Inverter::synthesize(n, data);
+  Net gate1 = n.nand(data, clk);
+  Net gate2 = n.nand(clk, gate0);
+  return SRLatch::synthesize(n, gate1, gate2);
+}
+
+
 // MEMORY TESTS
 
 
@@ -332,6 +1584,37 @@ void testFlipFlop()
   assert(d.output() == 0);
 }
 
+void testFeedbackNetlist()
+{
+  // A flip-flop in a netlist behaves like the component, power-up
+  // included, with its latch settled by the feedback solver
+  Netlist n;
+  Net data = n.input();
+  Net clk = n.input();
+  Bus q = FlipFlop::synthesize(n, data, clk);
+  assert(n.loops().size() == 1);
+
+  NetlistSimulator sim(n);
+  FlipFlop f;
+  srand(11);
+
+  for (auto i = 0; i < 200; ++i)
+  {
+    Signal d = rand() % 2, c = rand() % 2;
+    sim.set(data, d);
+    sim.set(clk, c);
+    sim.evaluate();
+
+    f.input(0, d);
+    f.control(0, c);
+    f.process();
+
+    assert(sim.get(q.at(0)) == f.output(0));
+    assert(sim.get(q.at(1)) == f.output(1));
+  }
+}
+
+
 void testWordMemory()
 {
   WordMemory<4> m;
@@ -500,14 +1783,570 @@ void testShiftRegister()
 }
 
 
+void testClockGating()
+{
+  // Gated and fully evaluated copies see the same traffic, mostly
+  // with the clock low, starting from power-up
+  FlipFlop f[2];
+  WordMemory<8> m[2];
+  ShiftRegister<8> s[2];
+  RAM<5, 8> r[2];
+  srand(10);
+
+  for (auto i = 0; i < 400; ++i)
+  {
+    Signal data = rand() % 2, clk = rand() % 4 == 0, mode = rand() % 2;
+    Word<8> w = Word<8>::fromInt(rand());
+    int address = rand() % 16;
+
+    for (auto g = 0; g < 2; ++g)
+    {
+      ClockGating::enabled() = g;
+
+      f[g].input(0, data);
+      f[g].control(0, clk);
+      f[g].process();
+
+      m[g].input(0, w);
+      m[g].control(0, clk);
+      m[g].process();
+
+      s[g].input(0, w);
+      s[g].control(0, mode);
+      s[g].control(1, clk);
+      s[g].process();
+
+      r[g].input(0, w);
+      r[g].control(0, clk);
+      for (auto b = 1; b < 5; ++b) r[g].control(b, (address >> (4-b)) & 1);
+      r[g].processAll();
+    }
+
+    assert(f[0].output() == f[1].output());
+    assert(m[0].output() == m[1].output());
+    assert(s[0].output() == s[1].output());
+    assert(r[0].output() == r[1].output());
+  }
+
+  ClockGating::enabled() = true;
+
+  // Only the first low-clock evaluation ran
+  assert(f[0].gating().gated == 0);
+  assert(f[1].gating().active + f[1].gating().gated == 400);
+  assert(f[1].gating().gated > 200);
+  assert(m[1].gating().gated > 200);
+  assert(s[1].gating().gated > 200);
+
+  // Each RAM pass clocks 16 words, at most one of them enabled
+  GatingCounters ram = r[1].gating();
+  assert(ram.active + ram.gated == 16 * 400);
+  assert(ram.gated > 14 * 400);
+}
+
+
+void testRAMFastPath()
+{
+  // Decoded path and full evaluation agree on random traffic
+  RAM<6, 8> fast, full;
+  srand(5);
+
+  for (auto i = 0; i < 300; ++i)
+  {
+    Word<8> w = Word<8>::fromInt(rand());
+    Signal write = rand() % 2;
+    int address = rand() % 32;
+
+    fast.input(0, w);
+    full.input(0, w);
+    fast.control(0, write);
+    full.control(0, write);
+    for (auto b = 1; b < 6; ++b)
+    {
+      fast.control(b, (address >> (5-b)) & 1);
+      full.control(b, (address >> (5-b)) & 1);
+    }
+
+    fast.process();
+    full.processAll();
+    assert(fast.output() == full.output());
+  }
+}
+
+
+void testRAMBurst()
+{
+  // Bursts match one process() per word, including reads of
+  // never-written words
+  RAM<6, 8> single, burst;
+  srand(6);
+
+  auto access = [&](uint64_t address, Signal write, const Word<8>& w)
+  {
+    single.input(0, w);
+    single.control(0, write);
+    for (auto b = 1; b < 6; ++b) single.control(b, (address >> (5-b)) & 1);
+    single.process();
+    return single.output();
+  };
+
+  std::vector<Word<8>> in(40), out(40);
+  for (auto& w : in) w = Word<8>::fromInt(rand());
+
+  // Sequential write from 3, wrapping past the end
+  burst.writeBurst(3, 30, in.data());
+  for (auto i = 0; i < 30; ++i) access((3 + i) % 32, 1, in.at(i));
+  assert(burst.output() == single.output());
+
+  // Strided read, backwards
+  burst.readBurst(40, 20, out.data(), -3);
+  for (auto i = 0; i < 20; ++i)
+  {
+    assert(out.at(i) == access((40 - 3*i) % 32, 0, Word<8>()));
+  }
+
+  // Scatter with a repeated address, then gather everything
+  std::vector<uint64_t> addresses;
+  for (auto i = 0; i < 40; ++i) addresses.push_back(rand() % 32);
+  burst.scatter(addresses, in.data());
+  for (auto i = 0; i < 40; ++i) access(addresses.at(i), 1, in.at(i));
+
+  for (auto i = 0; i < 40; ++i) addresses.at(i) = i % 32;
+  burst.gather(addresses, out.data());
+  for (auto i = 0; i < 40; ++i)
+  {
+    assert(out.at(i) == access(i % 32, 0, Word<8>()));
+  }
+
+  // Left as if the last access went through process()
+  assert(burst.output() == single.output());
+  burst.process();
+  single.process();
+  assert(burst.output() == single.output());
+}
+
+
+void testRAMImage()
+{
+  std::string path = "/tmp/loob-test-" + std::to_string(getpid()) + ".ram";
+
+  // Write through an attached image, then reopen it
+  {
+    RAMImage image(path, 6, 12);
+    assert(image.words() == 32);
+
+    RAM<6, 12> r;
+    r.attach(image);
+
+    for (auto a = 0; a < 32; ++a)
+    {
+      r.input(0, Word<12>::fromInt(a * 97));
+      r.control(0, 1);
+      for (auto b = 1; b < 6; ++b) r.control(b, (a >> (5-b)) & 1);
+      r.process();
+    }
+    image.sync();
+  }
+
+  RAMImage image(path);
+  assert(image.m() == 6 && image.n() == 12);
+  assert(image.read<12>(31).toInt() == (31 * 97) % 4096);
+
+  // Loading skips the decode but reads back the same
+  RAM<6, 12> r;
+  r.load(image);
+
+  for (auto a = 0; a < 32; ++a)
+  {
+    r.control(0, 0);
+    for (auto b = 1; b < 6; ++b) r.control(b, (a >> (5-b)) & 1);
+    r.process();
+    assert(r.output().toInt() == (uint64_t) (a * 97) % 4096);
+  }
+
+  // Store into a fresh image
+  std::string copy = path + ".copy";
+  {
+    RAMImage out(copy, 6, 12);
+    r.store(out);
+    for (auto a = 0; a < 32; ++a)
+    {
+      assert(out.read<12>(a) == image.read<12>(a));
+    }
+  }
+
+  // Bursts write every word through, not just the last
+  std::string all = path + ".all";
+  {
+    RAMImage out(all, 6, 12);
+    RAM<6, 12> w;
+    w.attach(out);
+
+    std::vector<Word<12>> in;
+    for (auto i = 0; i < 10; ++i) in.push_back(Word<12>::fromInt(i * 31 + 1));
+    w.writeBurst(28, 10, in.data());
+    for (auto i = 0; i < 10; ++i) assert(out.read<12>((28 + i) % 32) == in.at(i));
+
+    std::vector<uint64_t> addresses = {9, 2, 9, 17};
+    w.scatter(addresses, in.data());
+    assert(out.read<12>(2) == in.at(1));
+    assert(out.read<12>(9) == in.at(2));
+    assert(out.read<12>(17) == in.at(3));
+  }
+  unlink(all.c_str());
+
+  // The full decode writes through as well
+  {
+    RAMImage out(all, 6, 12);
+    RAM<6, 12> w;
+    w.attach(out);
+
+    w.input(0, Word<12>::fromInt(55));
+    w.control(0, 1);
+    for (auto b = 1; b < 6; ++b) w.control(b, (5 >> (5-b)) & 1);
+    w.processAll();
+    assert(out.read<12>(5).toInt() == 55);
+  }
+
+  // Shape is checked
+  bool thrown = false;
+  try
+  {
+    RAM<5, 12> wrong;
+    wrong.load(image);
+  }
+  catch (const std::invalid_argument&)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+
+  unlink(path.c_str());
+  unlink(copy.c_str());
+  unlink(all.c_str());
+}
+
+
+void testBankedRAM()
+{
+  const int words = 32;
+  BankedRAM<6, 8, 3, 4> r;
+  std::vector<uint64_t> model(words);
+  std::vector<bool> written(words, false);
+
+  auto port = [&](int p, uint64_t address, Signal write, uint64_t value)
+  {
+    r.input(p, Word<8>::fromInt(value));
+    r.control(p*6, write);
+    for (auto b = 1; b < 6; ++b) r.control(p*6 + b, (address >> (5-b)) & 1);
+  };
+
+  // Three writes to different banks all go through
+  port(0, 4, 1, 40);
+  port(1, 5, 1, 50);
+  port(2, 6, 1, 60);
+  r.process();
+  assert(!r.stalled(0) && !r.stalled(1) && !r.stalled(2));
+  assert(r.output(0).toInt() == 40);
+  assert(r.output(2).toInt() == 60);
+
+  // Addresses 4 and 8 share bank 0: port 0 wins, port 1 holds
+  port(0, 8, 1, 80);
+  port(1, 4, 0, 0);
+  port(2, 5, 0, 0);
+  r.process();
+  assert(!r.stalled(0) && r.stalled(1) && !r.stalled(2));
+  assert(r.output(1).toInt() == 50);
+  assert(r.output(2).toInt() == 50);
+  assert(r.counters(0).conflicts == 1);
+  assert(r.counters(0).writes == 2);
+
+  // Reads of one word are shared
+  port(0, 6, 0, 0);
+  port(1, 6, 0, 0);
+  port(2, 8, 0, 0);
+  r.process();
+  assert(!r.stalled(0) && !r.stalled(1) && !r.stalled(2));
+  assert(r.output(0).toInt() == 60 && r.output(1).toInt() == 60);
+  assert(r.output(2).toInt() == 80);
+  assert(r.counters(2).reads == 2);
+
+  // Random traffic against a plain model of the served accesses
+  r.resetCounters();
+  model.at(4) = 80, model.at(5) = 50, model.at(6) = 60, model.at(8) = 80;
+  written.at(4) = written.at(5) = written.at(6) = written.at(8) = true;
+  srand(7);
+
+  for (auto i = 0; i < 300; ++i)
+  {
+    uint64_t address[3], value[3];
+    Signal write[3];
+    for (auto p = 0; p < 3; ++p)
+    {
+      address[p] = rand() % words;
+      write[p] = rand() % 2;
+      value[p] = rand() % 256;
+      port(p, address[p], write[p], value[p]);
+    }
+    r.process();
+
+    for (auto p = 0; p < 3; ++p)
+    {
+      if (r.stalled(p)) continue;
+      if (write[p])
+      {
+        model.at(address[p]) = value[p];
+        written.at(address[p]) = true;
+      }
+      if (written.at(address[p])) assert(r.output(p).toInt() == model.at(address[p]));
+    }
+  }
+
+  uint64_t total = 0;
+  for (auto b = 0; b < 4; ++b)
+  {
+    total += r.counters(b).reads + r.counters(b).writes + r.counters(b).conflicts;
+  }
+  assert(total == 900);
+}
+
+
+void testRegisterFile()
+{
+  // Two read ports, two write ports over 8 registers of 70 bits
+  RegisterFile<8, 70, 2, 2> rf;
+  std::vector<Word<70>> model(8);
+  srand(9);
+
+  auto randomWord = []
+  {
+    Word<70> w;
+    for (auto i = 0; i < 70; ++i) w.bit(i) = rand() % 2;
+    return w;
+  };
+
+  for (auto cycle = 0; cycle < 300; ++cycle)
+  {
+    // Switch modes now and then, contents carry over
+    if (cycle % 50 == 49) rf.fast(!rf.fast());
+
+    int reads[2] = {rand() % 8, rand() % 8};
+    for (auto p = 0; p < 2; ++p)
+    {
+      for (auto i = 0; i < 3; ++i) rf.control(p*3 + i, (reads[p] >> (2-i)) & 1);
+    }
+
+    int writes[2];
+    Signal enables[2];
+    Word<70> data[2];
+    for (auto w = 0; w < 2; ++w)
+    {
+      writes[w] = rand() % 8;
+      enables[w] = rand() % 2;
+      data[w] = randomWord();
+
+      rf.input(w, data[w]);
+      rf.control(6 + w*4, enables[w]);
+      for (auto i = 0; i < 3; ++i) rf.control(6 + w*4 + 1 + i, (writes[w] >> (2-i)) & 1);
+    }
+
+    rf.process();
+
+    // Reads see the old values
+    assert(rf.output(0) == model.at(reads[0]));
+    assert(rf.output(1) == model.at(reads[1]));
+
+    for (auto w = 0; w < 2; ++w)
+    {
+      if (enables[w]) model.at(writes[w]) = data[w];
+    }
+  }
+}
+
+
+void testROM()
+{
+  // Quarter-wave sine table, 8 bits
+  std::array<uint64_t, 32> sine;
+  for (auto i = 0; i < 32; ++i) sine[i] = std::lround(255 * std::sin(i * M_PI / 64));
+
+  ROM<5, 8> r(sine);
+
+  Netlist n;
+  Bus address = n.input(5);
+  Bus data = r.synthesize(n, address);
+  NetlistSimulator sim(n);
+
+  for (auto a = 0; a < 32; ++a)
+  {
+    for (auto b = 0; b < 5; ++b)
+    {
+      r.control(b, (a >> (4-b)) & 1);
+      sim.set(address.at(b), (a >> (4-b)) & 1);
+    }
+    r.process();
+    sim.evaluate();
+
+    assert(r.output().toInt() == sine[a]);
+    assert(r.output() == r.lookup(a));
+    assert(sim.get<8>(data) == r.lookup(a));
+  }
+
+  // Constant and repeated data fold away
+  std::array<uint64_t, 16> constant;
+  constant.fill(0x5A);
+  assert((ROM<4, 8>(constant).multiplexers() == 0));
+
+  std::array<uint64_t, 16> parity;
+  for (auto i = 0; i < 16; ++i) parity[i] = i % 2 ? 0xFF : 0x00;
+  assert((ROM<4, 8>(parity).multiplexers() == 1));
+
+  // Straight from a RAM image
+  std::string path = "/tmp/loob-test-" + std::to_string(getpid()) + ".rom";
+  {
+    RAMImage image(path, 6, 8);
+    for (auto a = 0; a < 32; ++a) image.write(a, Word<8>::fromInt(sine[31 - a]));
+  }
+
+  ROM<5, 8> reversed{RAMImage(path)};
+  for (auto a = 0; a < 32; ++a) assert(reversed.lookup(a).toInt() == sine[31 - a]);
+  unlink(path.c_str());
+}
+
+
+void testCAM()
+{
+  CAM<16, 8> c;
+
+  auto write = [&](int entry, uint64_t value)
+  {
+    c.input(0, Word<8>::fromInt(value));
+    c.control(0, 1);
+    for (auto i = 1; i <= 4; ++i) c.control(i, (entry >> (4-i)) & 1);
+    c.process();
+  };
+
+  auto lookup = [&](uint64_t value)
+  {
+    c.input(0, Word<8>::fromInt(value));
+    c.control(0, 0);
+    c.process();
+    int found = c.match() ? (int) c.output().toInt() : -1;
+    assert(found == c.find(Word<8>::fromInt(value)));
+    return found;
+  };
+
+  // Empty entries don't match, not even zero
+  assert(lookup(0) == -1);
+
+  write(5, 0xAB);
+  write(9, 0xCD);
+  write(12, 0xAB);
+  assert(lookup(0xAB) == 5);
+  assert(lookup(0xCD) == 9);
+  assert(lookup(0xEF) == -1);
+
+  // Overwriting moves the match to the next entry holding the key
+  write(5, 0x00);
+  assert(lookup(0xAB) == 12);
+  assert(lookup(0x00) == 5);
+
+  // Random traffic: gates and hash always agree
+  srand(8);
+  for (auto i = 0; i < 200; ++i)
+  {
+    if (rand() % 2) write(rand() % 16, rand() % 32);
+    else lookup(rand() % 32);
+  }
+
+  // Overwritten keys leave nothing behind
+  for (auto i = 0; i < 256; ++i) write(i % 2, i);
+  assert(c.keys() <= 16);
+}
+
+
+void testSparseRAM()
+{
+  // 2^32 words of address space
+  SparseRAM<33, 16> r;
+
+  auto access = [&](uint64_t address, Signal write, uint64_t value)
+  {
+    r.input(0, Word<16>::fromInt(value));
+    r.control(0, write);
+    for (auto i = 1; i < 33; ++i) r.control(i, (address >> (32-i)) & 1);
+    r.process();
+    return r.output().toInt();
+  };
+
+  // Unwritten addresses read as zero without allocating anything
+  assert(access(123456789, 0, 0) == 0);
+  assert(r.pages() == 0);
+
+  assert(access(0, 1, 0xBEEF) == 0xBEEF);
+  assert(access(0xFFFFFFFF, 1, 0x1234) == 0x1234);
+  assert(access(0x80000001, 1, 0x0F0F) == 0x0F0F);
+  assert(r.pages() == 3);
+
+  assert(access(0, 0, 0xFFFF) == 0xBEEF);
+  assert(access(0xFFFFFFFF, 0, 0) == 0x1234);
+  assert(access(0x80000001, 0, 0) == 0x0F0F);
+
+  // Same page, never written
+  assert(access(1, 0, 0) == 0);
+  assert(r.pages() == 3);
+
+  // Overwrite
+  assert(access(0, 1, 7) == 7);
+  assert(access(0, 0, 0) == 7);
+
+  // Matches the dense RAM on everything that has been written
+  RAM<5, 8> dense;
+  SparseRAM<5, 8, 2> sparse;
+  std::vector<bool> written(16, false);
+  srand(4);
+
+  for (auto i = 0; i < 200; ++i)
+  {
+    int address = rand() % 16;
+    Signal write = rand() % 2;
+    Word<8> w = Word<8>::fromInt(rand());
+
+    dense.input(0, w);
+    sparse.input(0, w);
+    dense.control(0, write);
+    sparse.control(0, write);
+    for (auto b = 1; b < 5; ++b)
+    {
+      dense.control(b, (address >> (4-b)) & 1);
+      sparse.control(b, (address >> (4-b)) & 1);
+    }
+    dense.process();
+    sparse.process();
+
+    if (write) written.at(address) = true;
+    if (written.at(address)) assert(dense.output() == sparse.output());
+  }
+}
+
+
 // Run all memory tests
 void testMemory()
 {
   testSRLatch();
   testFlipFlop();
+  testFeedbackNetlist();
   testWordMemory();
   testRAM();
+  testRAMFastPath();
+  testRAMBurst();
+  testRAMImage();
+  testBankedRAM();
+  testSparseRAM();
+  testRegisterFile();
+  testROM();
+  testCAM();
   testShiftRegister();
+  testClockGating();
 }
 
 
@@ -0,0 +1,749 @@
+#ifndef MULTIPROCESS_HPP
+#define MULTIPROCESS_HPP
+
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ALU.hpp"
+#include "Memory.hpp"
+#include "Pipeline.hpp"
+
+
+// A POSIX shared memory segment.
+// The name is unlinked as soon as the segment is mapped, so nothing
+// leaks if we crash. Forked workers inherit the mapping.
+
+class SharedSegment
+{
+  public:
+    SharedSegment(size_t size);
+    ~SharedSegment();
+
+    SharedSegment(const SharedSegment&) = delete;
+    SharedSegment& operator=(const SharedSegment&) = delete;
+
+    void* data() const
+    {
+      return _data;
+    }
+
+  private:
+    void* _data;
+    size_t _size;
+};
+
+
+// Lock-free single-producer, single-consumer ring of N-bit words,
+// laid out flat so it can live in a shared segment between processes.
+
+template <int N, int Capacity = 16>
+class SharedChannel
+{
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+  static_assert(std::atomic<uint64_t>::is_always_lock_free, "Need address-free atomics");
+
+  public:
+    SharedChannel() : _head(0), _tail(0), _closed(0) {}
+
+    bool tryPut(const Word<N>& w)
+    {
+      uint64_t tail = _tail.load(std::memory_order_relaxed);
+      if (tail - _head.load(std::memory_order_acquire) == Capacity) return false;
+
+      uint64_t* slot = _slots[tail % Capacity];
+      std::fill(slot, slot + Limbs, 0);
+      for (auto i = 0; i < N; ++i)
+      {
+        slot[i / 64] |= (uint64_t) w.bit(i) << (i % 64);
+      }
+
+      _tail.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+
+    bool tryTake(Word<N>& w)
+    {
+      uint64_t head = _head.load(std::memory_order_relaxed);
+      if (head == _tail.load(std::memory_order_acquire)) return false;
+
+      const uint64_t* slot = _slots[head % Capacity];
+      for (auto i = 0; i < N; ++i)
+      {
+        w.bit(i) = (slot[i / 64] >> (i % 64)) & 1;
+      }
+
+      _head.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    void put(const Word<N>& w)
+    {
+      while (!tryPut(w)) wait();
+    }
+
+    Word<N> take()
+    {
+      Word<N> w;
+      while (!tryTake(w)) wait();
+      return w;
+    }
+
+    void close()
+    {
+      _closed = 1;
+    }
+
+  private:
+    static const int Limbs = (N + 63) / 64;
+
+    void wait() const
+    {
+      if (_closed) throw std::runtime_error("Channel closed");
+      std::this_thread::yield();
+    }
+
+    alignas(64) std::atomic<uint64_t> _head;
+    alignas(64) std::atomic<uint64_t> _tail;
+    std::atomic<uint32_t> _closed;
+    uint64_t _slots[Capacity][Limbs];
+};
+
+
+// Ring of bit vectors whose width is only known at run time, such as
+// the cuts of a partitioned netlist. The slots follow the header in the
+// same shared segment, so size() says how big that segment must be.
+
+class SharedBitChannel
+{
+  public:
+    SharedBitChannel(int width, int capacity) :
+      _head(0), _tail(0), _closed(0), _width(width), _capacity(capacity) {}
+
+    static size_t size(int width, int capacity)
+    {
+      return sizeof(SharedBitChannel) + sizeof(uint64_t) * limbs(width) * capacity;
+    }
+
+    int width() const
+    {
+      return _width;
+    }
+
+    bool tryPut(const std::vector<Signal>& bits)
+    {
+      uint64_t tail = _tail.load(std::memory_order_relaxed);
+      if (tail - _head.load(std::memory_order_acquire) == _capacity) return false;
+
+      uint64_t* slot = slots() + (tail % _capacity) * limbs(_width);
+      std::fill(slot, slot + limbs(_width), 0);
+      for (auto i = 0; i < _width; ++i)
+      {
+        slot[i / 64] |= (uint64_t) (bits.at(i) & 1) << (i % 64);
+      }
+
+      _tail.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+
+    bool tryTake(std::vector<Signal>& bits)
+    {
+      uint64_t head = _head.load(std::memory_order_relaxed);
+      if (head == _tail.load(std::memory_order_acquire)) return false;
+
+      const uint64_t* slot = slots() + (head % _capacity) * limbs(_width);
+      bits.resize(_width);
+      for (auto i = 0; i < _width; ++i) bits[i] = (slot[i / 64] >> (i % 64)) & 1;
+
+      _head.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    void put(const std::vector<Signal>& bits)
+    {
+      while (!tryPut(bits)) wait();
+    }
+
+    void take(std::vector<Signal>& bits)
+    {
+      while (!tryTake(bits)) wait();
+    }
+
+    void close()
+    {
+      _closed = 1;
+    }
+
+  private:
+    static int limbs(int width)
+    {
+      return std::max(1, (width + 63) / 64);
+    }
+
+    uint64_t* slots()
+    {
+      return reinterpret_cast<uint64_t*>(this + 1);
+    }
+
+    void wait() const
+    {
+      if (_closed) throw std::runtime_error("Channel closed");
+      std::this_thread::yield();
+    }
+
+    alignas(64) std::atomic<uint64_t> _head;
+    alignas(64) std::atomic<uint64_t> _tail;
+    std::atomic<uint32_t> _closed;
+    int _width;
+    uint64_t _capacity;
+};
+
+
+// Simulates a design split into partitions, each in its own process.
+//
+// Each partition is built inside its worker, so its components live in
+// that worker's address space. Boundary words travel through shared
+// memory channels, and every worker has a Unix socket back to us for
+// setup and cycle stepping. A worker that crashes takes down only the
+// simulation, not the process driving it.
+
+class ProcessSimulation
+{
+  public:
+    using Step = std::function<void(uint64_t cycle)>;
+
+    // Runs in the worker and returns the partition's step function
+    using Build = std::function<Step()>;
+
+    ProcessSimulation() {}
+    ~ProcessSimulation();
+
+    // Create a boundary channel. Must be called before start().
+    template <int N, int Capacity = 16>
+    SharedChannel<N, Capacity>& channel();
+
+    // Create a boundary channel of a width chosen at run time
+    SharedBitChannel& channel(int width, int capacity = 16);
+
+    // Add a partition. Must be called before start().
+    void partition(Build build)
+    {
+      if (!_workers.empty()) throw std::logic_error("Simulation already started");
+      _builds.push_back(build);
+    }
+
+    // Fork one worker per partition and wait for them to build
+    void start();
+
+    // Run every worker for a number of cycles
+    void step(uint64_t cycles);
+
+    // Shut down the workers
+    void stop();
+
+    uint64_t cycle() const
+    {
+      return _cycle;
+    }
+
+  private:
+    enum Op : uint32_t { Ready, Run, Done, Failed, Quit };
+
+    struct Message
+    {
+      uint32_t op;
+      uint64_t cycles;
+      char error[116];
+    };
+
+    struct Worker
+    {
+      pid_t pid;
+      int socket;
+    };
+
+    static bool send(int socket, const Message& m);
+    static bool receive(int socket, Message& m);
+    static Message reply(Op op, const char* error = "");
+
+    void serve(int index, int socket);
+    void collect(Op expected);
+    void closeChannels();
+
+    std::vector<Build> _builds;
+    std::vector<Worker> _workers;
+    std::vector<std::unique_ptr<SharedSegment>> _segments;
+    std::vector<std::function<void()>> _closers;
+    uint64_t _cycle = 0;
+    bool _failed = false;
+};
+
+
+// A flattened design cut with partitionNetlist() and run with one
+// worker process per partition. Each worker builds its own stage, so
+// its net values live only in its address space. Cut values go through
+// shared memory: input vectors into the first worker, each cut to the
+// next, and outputs back from the last.
+
+class ProcessNetlist
+{
+  public:
+    // Starts the workers straight away
+    ProcessNetlist(const Netlist& netlist, const Bus& outputs, int parts,
+                   int capacity = 64);
+
+    const NetlistPartitions& partitions() const
+    {
+      return _partitions;
+    }
+
+    // Each input vector holds the netlist's inputs in order, and gets
+    // back the outputs in order
+    std::vector<std::vector<Signal>> run(const std::vector<std::vector<Signal>>& stimulus);
+
+  private:
+    NetlistPartitions _partitions;
+    ProcessSimulation _sim;
+    std::vector<SharedBitChannel*> _links;
+    int _capacity;
+};
+
+
+// SHARED MEMORY DEFINITIONS
+
+SharedSegment::SharedSegment(size_t size) : _data(nullptr), _size(size)
+{
+  static std::atomic<int> count(0);
+  std::string name = "/loob-" + std::to_string(getpid()) + "-"
+                   + std::to_string(count++);
+
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) throw std::runtime_error("shm_open failed: " + name);
+
+  shm_unlink(name.c_str());
+
+  if (ftruncate(fd, size) != 0)
+  {
+    close(fd);
+    throw std::runtime_error("ftruncate failed: " + name);
+  }
+
+  _data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (_data == MAP_FAILED) throw std::runtime_error("mmap failed: " + name);
+}
+
+SharedSegment::~SharedSegment()
+{
+  munmap(_data, _size);
+}
+
+
+// PROCESS SIMULATION DEFINITIONS
+
+template <int N, int Capacity>
+SharedChannel<N, Capacity>& ProcessSimulation::channel()
+{
+  if (!_workers.empty()) throw std::logic_error("Simulation already started");
+
+  _segments.push_back(std::make_unique<SharedSegment>(
+    sizeof(SharedChannel<N, Capacity>)));
+
+  auto* c = new (_segments.back()->data()) SharedChannel<N, Capacity>();
+  _closers.push_back([c] { c->close(); });
+  return *c;
+}
+
+SharedBitChannel& ProcessSimulation::channel(int width, int capacity)
+{
+  if (!_workers.empty()) throw std::logic_error("Simulation already started");
+
+  _segments.push_back(std::make_unique<SharedSegment>(
+    SharedBitChannel::size(width, capacity)));
+
+  auto* c = new (_segments.back()->data()) SharedBitChannel(width, capacity);
+  _closers.push_back([c] { c->close(); });
+  return *c;
+}
+
+ProcessSimulation::~ProcessSimulation()
+{
+  stop();
+}
+
+bool ProcessSimulation::send(int socket, const Message& m)
+{
+  const char* p = (const char*) &m;
+  size_t left = sizeof(m);
+
+  while (left > 0)
+  {
+    ssize_t n = ::send(socket, p, left, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    left -= n;
+  }
+
+  return true;
+}
+
+bool ProcessSimulation::receive(int socket, Message& m)
+{
+  char* p = (char*) &m;
+  size_t left = sizeof(m);
+
+  while (left > 0)
+  {
+    ssize_t n = ::recv(socket, p, left, 0);
+    if (n <= 0) return false;
+    p += n;
+    left -= n;
+  }
+
+  return true;
+}
+
+ProcessSimulation::Message ProcessSimulation::reply(Op op, const char* error)
+{
+  Message m = {op, 0, {0}};
+  strncpy(m.error, error, sizeof(m.error) - 1);
+  return m;
+}
+
+void ProcessSimulation::serve(int index, int socket)
+{
+  Step step;
+
+  try
+  {
+    step = _builds.at(index)();
+  }
+  catch (const std::exception& e)
+  {
+    send(socket, reply(Failed, e.what()));
+    _exit(1);
+  }
+
+  send(socket, reply(Ready));
+
+  Message m;
+  while (receive(socket, m) && m.op == Run)
+  {
+    try
+    {
+      for (uint64_t c = 0; c < m.cycles; ++c) step(_cycle + c);
+      _cycle += m.cycles;
+      send(socket, reply(Done));
+    }
+    catch (const std::exception& e)
+    {
+      send(socket, reply(Failed, e.what()));
+      _exit(1);
+    }
+  }
+
+  // Skip destructors and atexit handlers that belong to the parent
+  _exit(0);
+}
+
+void ProcessSimulation::start()
+{
+  if (!_workers.empty()) throw std::logic_error("Simulation already started");
+
+  for (auto i = 0; i < (int) _builds.size(); ++i)
+  {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+    {
+      throw std::runtime_error("socketpair failed");
+    }
+
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) throw std::runtime_error("fork failed");
+
+    if (pid == 0)
+    {
+      close(sockets[0]);
+      for (auto& w : _workers) close(w.socket);
+      serve(i, sockets[1]);
+    }
+
+    close(sockets[1]);
+    _workers.push_back({pid, sockets[0]});
+  }
+
+  collect(Ready);
+}
+
+void ProcessSimulation::step(uint64_t cycles)
+{
+  if (_failed) throw std::runtime_error("Simulation has failed");
+
+  Message m = {Run, cycles, {0}};
+  for (auto& w : _workers) send(w.socket, m);
+
+  collect(Done);
+  _cycle += cycles;
+}
+
+void ProcessSimulation::closeChannels()
+{
+  for (auto& c : _closers) c();
+}
+
+void ProcessSimulation::collect(Op expected)
+{
+  // Poll everyone at once, since a worker blocked on a channel
+  // only wakes up after a dead neighbour's channels are closed.
+  std::vector<bool> waiting(_workers.size(), true);
+  int left = _workers.size();
+  std::string error;
+
+  while (left > 0)
+  {
+    std::vector<pollfd> fds;
+    std::vector<int> index;
+
+    for (auto i = 0; i < (int) _workers.size(); ++i)
+    {
+      if (!waiting.at(i)) continue;
+      fds.push_back({_workers.at(i).socket, POLLIN, 0});
+      index.push_back(i);
+    }
+
+    if (poll(fds.data(), fds.size(), -1) < 0) continue;
+
+    for (auto k = 0; k < (int) fds.size(); ++k)
+    {
+      if (!fds.at(k).revents) continue;
+
+      int i = index.at(k);
+      waiting.at(i) = false;
+      --left;
+
+      Message m = {Quit, 0, {0}};
+      if (receive(_workers.at(i).socket, m) && m.op == expected) continue;
+
+      if (error.empty())
+      {
+        error = "Worker " + std::to_string(i) + " "
+              + (m.op == Failed ? std::string("failed: ") + m.error
+                                : std::string("exited unexpectedly"));
+      }
+
+      closeChannels();
+    }
+  }
+
+  if (!error.empty())
+  {
+    _failed = true;
+    throw std::runtime_error(error);
+  }
+}
+
+void ProcessSimulation::stop()
+{
+  Message m = {Quit, 0, {0}};
+
+  for (auto& w : _workers)
+  {
+    send(w.socket, m);
+    close(w.socket);
+  }
+
+  for (auto& w : _workers) waitpid(w.pid, nullptr, 0);
+
+  _workers.clear();
+}
+
+
+// PROCESS NETLIST DEFINITIONS
+
+ProcessNetlist::ProcessNetlist(const Netlist& netlist, const Bus& outputs,
+                               int parts, int capacity) :
+  _partitions(partitionNetlist(netlist, outputs, parts)),
+  _capacity(capacity)
+{
+  for (auto& cut : _partitions.cuts) _links.push_back(&_sim.channel(cut.size(), capacity));
+
+  for (auto p = 0; p < _partitions.parts(); ++p)
+  {
+    _sim.partition([this, &netlist, p]
+    {
+      auto stage = std::make_shared<NetlistStage>(netlist, _partitions, p);
+      auto in = std::make_shared<std::vector<Signal>>();
+      auto out = std::make_shared<std::vector<Signal>>();
+      SharedBitChannel* from = _links.at(p);
+      SharedBitChannel* to = _links.at(p + 1);
+
+      return [stage, in, out, from, to](uint64_t)
+      {
+        from->take(*in);
+        stage->step(*in, *out);
+        to->put(*out);
+      };
+    });
+  }
+
+  _sim.start();
+}
+
+std::vector<std::vector<Signal>>
+ProcessNetlist::run(const std::vector<std::vector<Signal>>& stimulus)
+{
+  std::vector<std::vector<Signal>> results(stimulus.size());
+
+  // The rings hold a batch each way, so we can fill the input before
+  // stepping and empty the output after without blocking anyone
+  for (size_t first = 0; first < stimulus.size(); first += _capacity)
+  {
+    size_t last = std::min(stimulus.size(), first + _capacity);
+
+    for (auto k = first; k < last; ++k) _links.front()->put(stimulus.at(k));
+    _sim.step(last - first);
+    for (auto k = first; k < last; ++k) _links.back()->take(results.at(k));
+  }
+
+  return results;
+}
+
+
+// MULTIPROCESS TESTS
+
+void testSharedChannel()
+{
+  SharedSegment s(sizeof(SharedChannel<70, 4>));
+  auto* c = new (s.data()) SharedChannel<70, 4>();
+
+  Word<70> w;
+  w.bit(0) = 1;
+  w.bit(69) = 1;
+
+  for (auto i = 0; i < 4; ++i) assert(c->tryPut(w));
+  assert(!c->tryPut(w));
+
+  for (auto i = 0; i < 4; ++i) assert(c->take() == w);
+  assert(!c->tryTake(w));
+}
+
+void testProcessSimulation()
+{
+  // ALU and RAM in separate workers, with results coming back to us
+  ProcessSimulation sim;
+  auto& sums = sim.channel<8>();
+  auto& reads = sim.channel<8, 64>();
+
+  sim.partition([&]
+  {
+    auto alu = std::make_shared<ALU<8>>();
+    return [alu, &sums](uint64_t c)
+    {
+      alu->input(0, Word<8>::fromInt(c));
+      alu->input(1, Word<8>::fromInt(3));
+      alu->control(0, 0);
+      alu->control(1, 1);
+      alu->process();
+      sums.put(alu->output());
+    };
+  });
+
+  sim.partition([&]
+  {
+    auto ram = std::make_shared<RAM<5, 8>>();
+    return [ram, &sums, &reads](uint64_t c)
+    {
+      ram->input(0, sums.take());
+      ram->control(0, 1);
+      for (auto i = 1; i < 5; ++i) ram->control(i, (c >> (4-i)) & 1);
+      ram->process();
+      reads.put(ram->output());
+    };
+  });
+
+  sim.start();
+  sim.step(20);
+  sim.step(12);
+  assert(sim.cycle() == 32);
+
+  for (uint64_t c = 0; c < 32; ++c) assert(reads.take().toInt() == (c * 3) % 256);
+
+  sim.stop();
+
+  // A crashing worker is reported, and its neighbour doesn't hang
+  ProcessSimulation broken;
+  auto& never = broken.channel<8>();
+  broken.partition([&] { return [&](uint64_t) { never.take(); }; });
+  broken.partition([&] { return [&](uint64_t) { _exit(3); }; });
+  broken.start();
+
+  bool thrown = false;
+  try
+  {
+    broken.step(1);
+  }
+  catch (const std::runtime_error&)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+}
+
+
+void testProcessNetlist()
+{
+  // A multiplier cut three ways across workers matches a plain run,
+  // with more vectors than fit in one batch
+  Netlist n;
+  Bus a = n.input(8), b = n.input(8);
+  Bus product = WordMultiplier<8>::synthesize(n, a, b);
+
+  ProcessNetlist sim(n, product, 3, 16);
+  assert(sim.partitions().parts() == 3);
+
+  srand(28);
+  std::vector<std::vector<Signal>> stimulus(50);
+  for (auto& v : stimulus)
+  {
+    for (auto i = 0; i < 16; ++i) v.push_back(rand() & 1);
+  }
+
+  auto results = sim.run(stimulus);
+
+  NetlistSimulator reference(n);
+  for (size_t k = 0; k < stimulus.size(); ++k)
+  {
+    for (auto i = 0; i < 16; ++i) reference.set(n.inputs().at(i), stimulus.at(k).at(i));
+    reference.evaluate();
+    for (auto i = 0; i < 8; ++i) assert(results.at(k).at(i) == reference.get(product.at(i)));
+  }
+
+  assert(sim.run(stimulus) == results);
+}
+
+
+// Run all multiprocess tests
+void testMultiProcess()
+{
+  testSharedChannel();
+  testProcessSimulation();
+  testProcessNetlist();
+}
+
+
+#endif // MULTIPROCESS_HPP
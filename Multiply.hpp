@@ -0,0 +1,1362 @@
+#ifndef MULTIPLY_HPP
+#define MULTIPLY_HPP
+
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+#include "ALU.hpp"
+
+
+// Recode three overlapping multiplier bits, (b 2k+1, b 2k, b 2k-1),
+// as a radix-4 digit in -2..2. Outputs are (negate, two, nonzero):
+// the digit's sign, whether it's 2 rather than 1, and whether it's
+// anything at all.
+
+class BoothEncoder : public Component
+{
+  public:
+    BoothEncoder() : Component(3, 3) {}
+
+    void process();
+
+    static Bus synthesize(Netlist& n, Net high, Net middle, Net low);
+
+  private:
+    XOR _one, _pair;
+    Inverter _notOne;
+    AND _two;
+    OR _nonzero;
+};
+
+
+// Signed N x N multiply with radix-4 modified Booth recoding.
+// Input 1 is recoded a digit per two bits, so there are half as many
+// partial product rows, each a multiplexer choosing input 0 or twice
+// it, masked, and inverted for negative digits. Sign extension is
+// folded into one inverted bit per row and a constant, then the rows
+// go through a compressor tree and one fast adder.
+//
+// The 2N-bit product comes out in two words, output 0 the low half
+// (the same as WordMultiplier) and output 1 the high half.
+
+template <int N, typename Tree = Dadda, typename Final = KoggeStone>
+class BoothMultiplier : public WordComponent<N>
+{
+  public:
+    BoothMultiplier();
+
+    void process();
+
+    // The whole product, high half first
+    static Bus synthesize(Netlist& n, const Bus& a, const Bus& b);
+
+    // Multiply a whole array of operand pairs, low halves only, or
+    // both halves
+    void processBatch(const std::vector<Word<N>>& a,
+                      const std::vector<Word<N>>& b,
+                      std::vector<Word<N>>& low) const;
+
+    void processBatch(const std::vector<Word<N>>& a,
+                      const std::vector<Word<N>>& b,
+                      std::vector<Word<N>>& low,
+                      std::vector<Word<N>>& high) const;
+
+    static const int rows = (N + 1) / 2;
+
+  private:
+    // Where each partial product bit goes in the tree, by weight
+    struct Layout
+    {
+      std::vector<int> heights;
+
+      // Channel of row r bit j at (N + 1) * r + j, or -1 past the top.
+      // Bit N is the row's inverted sign.
+      std::vector<int> products;
+      std::vector<int> negates;
+      std::vector<int> ones;
+
+      Layout();
+    };
+
+    static const Layout& layout();
+
+    std::vector<BoothEncoder> _encoders;
+
+    // For each bit of each row: input 0 or 2x, masked, negated
+    std::vector<Multiplexer> _selects;
+    std::vector<AND> _masks;
+    std::vector<XOR> _negates;
+    std::vector<Inverter> _signs;
+
+    CompressorTree _tree;
+    WordAdder<2*N, Final> _final;
+};
+
+
+// Unsigned N x N multiply keeping the whole 2N-bit product.
+// All N*N partial products go into a compressor tree by weight, then
+// one fast adder. Output 0 is the low half and output 1 the high half,
+// as for BoothMultiplier.
+
+template <int N, typename Tree = Dadda, typename Final = KoggeStone>
+class WideMultiplier : public WordComponent<N>
+{
+  public:
+    WideMultiplier();
+
+    void process();
+
+    // The whole product, high half first
+    static Bus synthesize(Netlist& n, const Bus& a, const Bus& b);
+
+    void processBatch(const std::vector<Word<N>>& a,
+                      const std::vector<Word<N>>& b,
+                      std::vector<Word<N>>& low,
+                      std::vector<Word<N>>& high) const;
+
+  private:
+    // Channel of a bit of weight i times a bit of weight j
+    static int channel(const CompressorTree& tree, int i, int j)
+    {
+      return tree.channel(i + j, i - std::max(0, i + j - (N-1)));
+    }
+
+    // Row per bit of input 0, by weight
+    std::vector<AND> _gates;
+
+    CompressorTree _tree;
+    WordAdder<2*N, Final> _final;
+};
+
+
+// Column heights of every partial product of an N x N multiply
+std::vector<int> widePartialProducts(int width);
+
+
+// Unsigned N x N -> 2N multiply for very wide words. Split each
+// operand in half, a = a1 2^h + a0, and build three products of about
+// half the width instead of four:
+//
+//   z0 = a0 b0,  z2 = a1 b1,  zm = (a0 + a1)(b0 + b1)
+//   a b = z2 2^2h + (zm - z0 - z2) 2^h + z0
+//
+// The three go on recursively until they're no wider than Threshold,
+// where a WideMultiplier does the rest. Recombining is one
+// compressor tree and one adder: z2 and z0 side by side, zm, and the
+// complements of z0 and z2, with the +1s gathered into a constant.
+// Gates grow as N^log2(3), about N^1.585.
+
+template <int N, int Threshold = 32>
+class KaratsubaMultiplier : public WordComponent<N>
+{
+  static_assert(Threshold >= 4, "Splitting narrower words never gets smaller");
+
+  public:
+    KaratsubaMultiplier();
+
+    void process();
+
+    // The whole product, high half first
+    static Bus synthesize(Netlist& n, const Bus& a, const Bus& b);
+
+    static const bool split = N > Threshold;
+
+    // Widths of the low and high halves
+    static const int h = N / 2;
+    static const int H = N - h;
+
+  private:
+    using Low = std::conditional_t<split, KaratsubaMultiplier<h, Threshold>, WideMultiplier<N>>;
+    using High = std::conditional_t<split, KaratsubaMultiplier<H, Threshold>, Unused>;
+    using Middle = std::conditional_t<split, KaratsubaMultiplier<H + 1, Threshold>, Unused>;
+    using Sum = std::conditional_t<split, WordAdder<H + 1, BrentKung>, Unused>;
+    using Final = std::conditional_t<split, WordAdder<2*N, BrentKung>, Unused>;
+
+    // Where each bit goes in the recombining tree
+    struct Layout
+    {
+      std::vector<int> heights;
+
+      // By weight within each product
+      std::vector<int> z0, z2, zm, notZ0, notZ2;
+      std::vector<int> ones;
+
+      Layout();
+    };
+
+    static const Layout& layout();
+
+    Low _low;
+    High _high;
+    Middle _middle;
+    Sum _sumA, _sumB;
+
+    std::vector<Inverter> _notZ0, _notZ2;
+    CompressorTree _tree;
+    Final _final;
+};
+
+
+// Multiply-accumulate, acc = acc + a b, kept to AccBits bits.
+// The accumulator stays in carry-save form, as two WordMemory words
+// whose sum is the value. Every step puts the partial products and
+// both of those words through one compressor tree, so there's no
+// carry to propagate on the way round. A fast adder turns them into
+// one word only when accumulator() is read, off the loop.
+//
+// Control 0 latches the step, control 1 starts a new sum from a b
+// alone.
+
+template <int N, int AccBits = 2*N + 8, typename Tree = Dadda, typename Final = KoggeStone>
+class MAC : public WordControlComponent<N>
+{
+  public:
+    MAC();
+
+    void process();
+
+    // Value after the last process()
+    const Word<AccBits>& accumulator();
+
+    // Set the accumulator directly
+    void load(const Word<AccBits>& value);
+
+    // The same datapath without the registers: accumulator + a b
+    static Bus synthesize(Netlist& n, const Bus& a, const Bus& b, const Bus& accumulator);
+
+  private:
+    // Partial products below AccBits, then rows on top of them
+    static std::vector<int> heights(int rows);
+
+    static int channel(const CompressorTree& tree, int i, int j)
+    {
+      return tree.channel(i + j, i - std::max(0, i + j - (N-1)));
+    }
+
+    std::vector<AND> _gates;
+
+    // Old sum and carry, unless clearing
+    Inverter _notClear;
+    std::vector<AND> _keep;
+
+    CompressorTree _tree;
+    WordMemory<AccBits> _sum, _carry;
+    WordAdder<AccBits, Final> _final;
+    bool _resolved = false;
+};
+
+
+// PROCESS DEFINITIONS
+
+
+void BoothEncoder::process()
+{
+  Signal high = _inputs.at(0);
+  Signal middle = _inputs.at(1);
+  Signal low = _inputs.at(2);
+
+  // Middle, Low -> One: the digit is +-1
+  _one.input(0, middle);
+  _one.input(1, low);
+  _one.process();
+
+  // High, Middle -> Pair, only +-2 if it's set and the digit isn't +-1
+  _pair.input(0, high);
+  _pair.input(1, middle);
+  _pair.process();
+
+  _notOne.input(0, _one.output());
+  _notOne.process();
+
+  _two.input(0, _pair.output());
+  _two.input(1, _notOne.output());
+  _two.process();
+
+  _nonzero.input(0, _one.output());
+  _nonzero.input(1, _two.output());
+  _nonzero.process();
+
+  _outputs.at(0) = high;
+  _outputs.at(1) = _two.output();
+  _outputs.at(2) = _nonzero.output();
+}
+
+template <int N, typename Tree, typename Final>
+BoothMultiplier<N, Tree, Final>::Layout::Layout() :
+  heights(2*N, 0),
+  products(rows * (N + 1), -1),
+  negates(rows, -1)
+{
+  auto place = [&](int weight)
+  {
+    return weight < 2*N ? heights.at(weight)++ : -1;
+  };
+
+  // Column slots first, then channels once every height is known
+  std::vector<int> slots(products.size(), -1);
+  for (auto r = 0; r < rows; ++r)
+  {
+    for (auto j = 0; j <= N; ++j) slots.at(r * (N + 1) + j) = place(2*r + j);
+    negates.at(r) = place(2*r);
+  }
+
+  // -2^(2r+N) for every row's sign, summed in 2N-bit two's complement
+  std::vector<int> constant(2*N, 0);
+  for (auto r = 0; r < rows; ++r)
+  {
+    if (2*r + N < 2*N) constant.at(2*r + N) = 1;
+  }
+  int carry = 1;
+  for (auto w = 0; w < 2*N; ++w)
+  {
+    int bit = !constant.at(w) + carry;
+    constant.at(w) = bit & 1;
+    carry = bit >> 1;
+  }
+
+  std::vector<int> constantSlots(2*N, -1);
+  for (auto w = 0; w < 2*N; ++w)
+  {
+    if (constant.at(w)) constantSlots.at(w) = place(w);
+  }
+
+  CompressorTree tree(heights, Tree::reduction);
+  for (auto r = 0; r < rows; ++r)
+  {
+    for (auto j = 0; j <= N; ++j)
+    {
+      int slot = slots.at(r * (N + 1) + j);
+      if (slot >= 0) products.at(r * (N + 1) + j) = tree.channel(2*r + j, slot);
+    }
+    if (negates.at(r) >= 0) negates.at(r) = tree.channel(2*r, negates.at(r));
+  }
+  for (auto w = 0; w < 2*N; ++w)
+  {
+    if (constantSlots.at(w) >= 0) ones.push_back(tree.channel(w, constantSlots.at(w)));
+  }
+}
+
+template <int N, typename Tree, typename Final>
+const typename BoothMultiplier<N, Tree, Final>::Layout&
+BoothMultiplier<N, Tree, Final>::layout()
+{
+  static const Layout l;
+  return l;
+}
+
+template <int N, typename Tree, typename Final>
+BoothMultiplier<N, Tree, Final>::BoothMultiplier() :
+  WordComponent<N>(2, 2),
+  _encoders(rows),
+  _selects(rows * (N + 1)),
+  _masks(rows * (N + 1)),
+  _negates(rows * (N + 1)),
+  _signs(rows),
+  _tree(layout().heights, Tree::reduction)
+{
+  for (auto channel : layout().ones) _tree.input(channel, 1);
+}
+
+template <int N, typename Tree, typename Final>
+void BoothMultiplier<N, Tree, Final>::process()
+{
+  const Word<N>& a = this->_inputs.at(0);
+  const Word<N>& b = this->_inputs.at(1);
+  const Layout& l = layout();
+
+  // Bit i of a word counting from the least significant, sign extended
+  auto bit = [](const Word<N>& w, int i) -> Signal
+  {
+    if (i < 0) return 0;
+    return w.bit(N-1 - std::min(i, N-1));
+  };
+
+  // Rows are independent until the tree
+  ThreadPool::instance().parallelFor(rows, [&](int begin, int end)
+  {
+    for (auto r = begin; r < end; ++r)
+    {
+      BoothEncoder& e = _encoders.at(r);
+      e.input(0, bit(b, 2*r + 1));
+      e.input(1, bit(b, 2*r));
+      e.input(2, bit(b, 2*r - 1));
+      e.process();
+
+      for (auto j = 0; j <= N; ++j)
+      {
+        int index = r * (N + 1) + j;
+
+        // a or 2a, by weight
+        Multiplexer& m = _selects.at(index);
+        m.input(0, bit(a, j));
+        m.input(1, bit(a, j - 1));
+        m.control(0, e.output(1));
+        m.process();
+
+        AND& g = _masks.at(index);
+        g.input(0, m.output());
+        g.input(1, e.output(2));
+        g.process();
+
+        XOR& x = _negates.at(index);
+        x.input(0, g.output());
+        x.input(1, e.output(0));
+        x.process();
+
+        Signal s = x.output();
+        if (j == N)
+        {
+          Inverter& i = _signs.at(r);
+          i.input(0, s);
+          i.process();
+          s = i.output();
+        }
+
+        if (l.products.at(index) >= 0) _tree.input(l.products.at(index), s);
+      }
+
+      // Two's complement: the +1 for a negative digit
+      if (l.negates.at(r) >= 0) _tree.input(l.negates.at(r), e.output(0));
+    }
+  }, std::max(1, 512 / N));
+
+  _tree.process();
+
+  Word<2*N> row0, row1;
+  for (auto w = 0; w < 2*N; ++w)
+  {
+    row0.bit(2*N-1-w) = _tree.output(w);
+    row1.bit(2*N-1-w) = _tree.output(2*N + w);
+  }
+
+  _final.input(0, row0);
+  _final.input(1, row1);
+  _final.process();
+
+  const Word<2*N>& product = _final.output();
+  for (auto i = 0; i < N; ++i)
+  {
+    this->_outputs.at(1).bit(i) = product.bit(i);
+    this->_outputs.at(0).bit(i) = product.bit(N + i);
+  }
+}
+
+
+template <int N, typename Tree, typename Final>
+WideMultiplier<N, Tree, Final>::WideMultiplier() :
+  WordComponent<N>(2, 2),
+  _gates(N*N),
+  _tree(widePartialProducts(N), Tree::reduction) {}
+
+template <int N, typename Tree, typename Final>
+void WideMultiplier<N, Tree, Final>::process()
+{
+  const Word<N>& a = this->_inputs.at(0);
+  const Word<N>& b = this->_inputs.at(1);
+
+  ThreadPool::instance().parallelFor(N, [&](int begin, int end)
+  {
+    for (auto i = begin; i < end; ++i)
+    {
+      for (auto j = 0; j < N; ++j)
+      {
+        AND& g = _gates.at(N*i + j);
+        g.input(0, a.bit(N-1-i));
+        g.input(1, b.bit(N-1-j));
+        g.process();
+        _tree.input(channel(_tree, i, j), g.output());
+      }
+    }
+  }, std::max(1, 1024 / N));
+
+  _tree.process();
+
+  Word<2*N> row0, row1;
+  for (auto w = 0; w < 2*N; ++w)
+  {
+    row0.bit(2*N-1-w) = _tree.output(w);
+    row1.bit(2*N-1-w) = _tree.output(2*N + w);
+  }
+
+  _final.input(0, row0);
+  _final.input(1, row1);
+  _final.process();
+
+  const Word<2*N>& product = _final.output();
+  for (auto i = 0; i < N; ++i)
+  {
+    this->_outputs.at(1).bit(i) = product.bit(i);
+    this->_outputs.at(0).bit(i) = product.bit(N + i);
+  }
+}
+
+template <int N, int Threshold>
+KaratsubaMultiplier<N, Threshold>::Layout::Layout() :
+  heights(2*N, 0)
+{
+  if (!split) return;
+
+  // Column slots, then channels once the heights are known
+  auto place = [&](std::vector<int>& bits, int count, int shift)
+  {
+    for (auto w = 0; w < count; ++w)
+    {
+      bits.push_back(w + shift < 2*N ? heights.at(w + shift)++ : -1);
+    }
+  };
+
+  place(z0, 2*h, 0);
+  place(z2, 2*H, 2*h);
+  place(zm, 2*H + 2, h);
+  place(notZ0, 2*h, h);
+  place(notZ2, 2*H, h);
+
+  // Subtracting z 2^h in 2N bits is adding ~(z 2^h) + 1. The
+  // complement is ~z in z's own bits and ones everywhere else.
+  std::vector<int> constant(2*N, 0);
+  auto add = [&](const std::vector<int>& bits)
+  {
+    int carry = 0;
+    for (auto w = 0; w < 2*N; ++w)
+    {
+      int sum = constant.at(w) + bits.at(w) + carry;
+      constant.at(w) = sum & 1;
+      carry = sum >> 1;
+    }
+  };
+
+  for (auto length : {2*h, 2*H})
+  {
+    std::vector<int> ones(2*N, 1);
+    for (auto w = h; w < std::min(h + length, 2*N); ++w) ones.at(w) = 0;
+    add(ones);
+
+    std::vector<int> one(2*N, 0);
+    one.at(0) = 1;
+    add(one);
+  }
+
+  std::vector<int> slots(2*N, -1);
+  for (auto w = 0; w < 2*N; ++w)
+  {
+    if (constant.at(w)) slots.at(w) = heights.at(w)++;
+  }
+
+  CompressorTree tree(heights, Reduction::Dadda);
+  auto channels = [&](std::vector<int>& bits, int shift)
+  {
+    for (size_t w = 0; w < bits.size(); ++w)
+    {
+      if (bits.at(w) >= 0) bits.at(w) = tree.channel(w + shift, bits.at(w));
+    }
+  };
+
+  channels(z0, 0);
+  channels(z2, 2*h);
+  channels(zm, h);
+  channels(notZ0, h);
+  channels(notZ2, h);
+  for (auto w = 0; w < 2*N; ++w)
+  {
+    if (slots.at(w) >= 0) ones.push_back(tree.channel(w, slots.at(w)));
+  }
+}
+
+template <int N, int Threshold>
+const typename KaratsubaMultiplier<N, Threshold>::Layout&
+KaratsubaMultiplier<N, Threshold>::layout()
+{
+  static const Layout l;
+  return l;
+}
+
+template <int N, int Threshold>
+KaratsubaMultiplier<N, Threshold>::KaratsubaMultiplier() :
+  WordComponent<N>(2, 2),
+  _notZ0(split ? 2*h : 0),
+  _notZ2(split ? 2*H : 0)
+{
+  if constexpr (split)
+  {
+    _tree = CompressorTree(layout().heights, Reduction::Dadda);
+    for (auto channel : layout().ones) _tree.input(channel, 1);
+  }
+}
+
+// Bit of weight w of a product split across two words
+template <int M>
+Signal productBit(const Word<M>& low, const Word<M>& high, int w)
+{
+  return w < M ? low.bit(M-1-w) : high.bit(2*M-1-w);
+}
+
+template <int N, int Threshold>
+void KaratsubaMultiplier<N, Threshold>::process()
+{
+  const Word<N>& a = this->_inputs.at(0);
+  const Word<N>& b = this->_inputs.at(1);
+
+  if constexpr (!split)
+  {
+    _low.input(0, a);
+    _low.input(1, b);
+    _low.process();
+    this->_outputs.at(0) = _low.output(0);
+    this->_outputs.at(1) = _low.output(1);
+  }
+  else
+  {
+    // Low halves, high halves, and both zero extended for the sums
+    Word<h> a0, b0;
+    Word<H> a1, b1;
+    Word<H + 1> a0x, b0x, a1x, b1x;
+    for (auto w = 0; w < h; ++w)
+    {
+      a0.bit(h-1-w) = a0x.bit(H-w) = a.bit(N-1-w);
+      b0.bit(h-1-w) = b0x.bit(H-w) = b.bit(N-1-w);
+    }
+    for (auto w = 0; w < H; ++w)
+    {
+      a1.bit(H-1-w) = a1x.bit(H-w) = a.bit(H-1-w);
+      b1.bit(H-1-w) = b1x.bit(H-w) = b.bit(H-1-w);
+    }
+
+    _sumA.input(0, a0x);
+    _sumA.input(1, a1x);
+    _sumA.process();
+    _sumB.input(0, b0x);
+    _sumB.input(1, b1x);
+    _sumB.process();
+
+    _low.input(0, a0);
+    _low.input(1, b0);
+    _high.input(0, a1);
+    _high.input(1, b1);
+    _middle.input(0, _sumA.output());
+    _middle.input(1, _sumB.output());
+
+    // The three products don't share anything
+    ThreadPool::instance().parallelFor(3, [this](int begin, int end)
+    {
+      for (auto i = begin; i < end; ++i)
+      {
+        if (i == 0) _low.process();
+        else if (i == 1) _high.process();
+        else _middle.process();
+      }
+    }, 1);
+
+    const Layout& l = layout();
+    auto feed = [&](const std::vector<int>& channels, auto& m, int width,
+                    std::vector<Inverter>* inverters)
+    {
+      for (auto w = 0; w < width; ++w)
+      {
+        int channel = channels.at(w);
+        if (channel < 0) continue;
+
+        Signal s = productBit(m.output(0), m.output(1), w);
+        if (inverters)
+        {
+          Inverter& i = inverters->at(w);
+          i.input(0, s);
+          i.process();
+          s = i.output();
+        }
+        _tree.input(channel, s);
+      }
+    };
+
+    feed(l.z0, _low, 2*h, nullptr);
+    feed(l.z2, _high, 2*H, nullptr);
+    feed(l.zm, _middle, 2*H + 2, nullptr);
+    feed(l.notZ0, _low, 2*h, &_notZ0);
+    feed(l.notZ2, _high, 2*H, &_notZ2);
+
+    _tree.process();
+
+    Word<2*N> row0, row1;
+    for (auto w = 0; w < 2*N; ++w)
+    {
+      row0.bit(2*N-1-w) = _tree.output(w);
+      row1.bit(2*N-1-w) = _tree.output(2*N + w);
+    }
+
+    _final.input(0, row0);
+    _final.input(1, row1);
+    _final.process();
+
+    const Word<2*N>& product = _final.output();
+    for (auto i = 0; i < N; ++i)
+    {
+      this->_outputs.at(1).bit(i) = product.bit(i);
+      this->_outputs.at(0).bit(i) = product.bit(N + i);
+    }
+  }
+}
+
+
+template <int N, int AccBits, typename Tree, typename Final>
+std::vector<int> MAC<N, AccBits, Tree, Final>::heights(int rows)
+{
+  std::vector<int> h = widePartialProducts(N);
+  h.resize(AccBits, 0);
+  for (auto& column : h) column += rows;
+  return h;
+}
+
+template <int N, int AccBits, typename Tree, typename Final>
+MAC<N, AccBits, Tree, Final>::MAC() :
+  WordControlComponent<N>(2, 2, 0),
+  _gates(N*N),
+  _keep(2*AccBits),
+  _tree(heights(2), Tree::reduction)
+{
+  // Flip flops power on set, so clear them
+  for (auto* r : {&_sum, &_carry})
+  {
+    r->input(0, Word<AccBits>());
+    r->control(0, 1);
+    r->process();
+  }
+}
+
+template <int N, int AccBits, typename Tree, typename Final>
+void MAC<N, AccBits, Tree, Final>::process()
+{
+  const Word<N>& a = this->_inputs.at(0);
+  const Word<N>& b = this->_inputs.at(1);
+
+  ThreadPool::instance().parallelFor(N, [&](int begin, int end)
+  {
+    for (auto i = begin; i < end; ++i)
+    {
+      for (auto j = 0; j < N && i + j < AccBits; ++j)
+      {
+        AND& g = _gates.at(N*i + j);
+        g.input(0, a.bit(N-1-i));
+        g.input(1, b.bit(N-1-j));
+        g.process();
+        _tree.input(channel(_tree, i, j), g.output());
+      }
+    }
+  }, std::max(1, 1024 / N));
+
+  _notClear.input(0, this->_controls.at(1));
+  _notClear.process();
+
+  // The two state rows sit on top of each column
+  for (auto w = 0; w < AccBits; ++w)
+  {
+    int top = w < 2*N - 1 ? std::min(w + 1, 2*N - 1 - w) : 0;
+    const Word<AccBits>* rows[2] = {&_sum.output(), &_carry.output()};
+
+    for (auto r = 0; r < 2; ++r)
+    {
+      AND& k = _keep.at(2*w + r);
+      k.input(0, rows[r]->bit(AccBits-1-w));
+      k.input(1, _notClear.output());
+      k.process();
+      _tree.input(_tree.channel(w, top + r), k.output());
+    }
+  }
+
+  _tree.process();
+
+  Word<AccBits> sum, carry;
+  for (auto w = 0; w < AccBits; ++w)
+  {
+    sum.bit(AccBits-1-w) = _tree.output(w);
+    carry.bit(AccBits-1-w) = _tree.output(AccBits + w);
+  }
+
+  _sum.input(0, sum);
+  _sum.control(0, this->_controls.at(0));
+  _sum.process();
+  _carry.input(0, carry);
+  _carry.control(0, this->_controls.at(0));
+  _carry.process();
+
+  _resolved = false;
+}
+
+template <int N, int AccBits, typename Tree, typename Final>
+const Word<AccBits>& MAC<N, AccBits, Tree, Final>::accumulator()
+{
+  if (!_resolved)
+  {
+    _final.input(0, _sum.output());
+    _final.input(1, _carry.output());
+    _final.process();
+    _resolved = true;
+  }
+
+  return _final.output();
+}
+
+template <int N, int AccBits, typename Tree, typename Final>
+void MAC<N, AccBits, Tree, Final>::load(const Word<AccBits>& value)
+{
+  _sum.input(0, value);
+  _sum.control(0, 1);
+  _sum.process();
+  _carry.input(0, Word<AccBits>());
+  _carry.control(0, 1);
+  _carry.process();
+
+  _resolved = false;
+}
+
+
+// NETLIST DEFINITIONS
+
+
+Bus BoothEncoder::synthesize(Netlist& n, Net high, Net middle, Net low)
+{
+  Net one = XOR::synthesize(n, middle, low);
+  Net pair = XOR::synthesize(n, high, middle);
+  Net two = AND::synthesize(n, pair, Inverter::synthesize(n, one));
+  return {high, two, OR::synthesize(n, one, two)};
+}
+
+template <int N, typename Tree, typename Final>
+Bus BoothMultiplier<N, Tree, Final>::synthesize(Netlist& n, const Bus& a, const Bus& b)
+{
+  const Layout& l = layout();
+  static const CompressorTree tree(l.heights, Tree::reduction);
+
+  auto bit = [&](const Bus& w, int i)
+  {
+    if (i < 0) return n.constant(0);
+    return w.at(N-1 - std::min(i, N-1));
+  };
+
+  Bus inputs(tree.inputs());
+  for (auto channel : l.ones) inputs.at(channel) = n.constant(1);
+
+  for (auto r = 0; r < rows; ++r)
+  {
+    Bus e = BoothEncoder::synthesize(n, bit(b, 2*r + 1), bit(b, 2*r), bit(b, 2*r - 1));
+
+    for (auto j = 0; j <= N; ++j)
+    {
+      int channel = l.products.at(r * (N + 1) + j);
+      if (channel < 0) continue;
+
+      Net m = Multiplexer::synthesize(n, bit(a, j), bit(a, j - 1), e.at(1));
+      Net s = XOR::synthesize(n, AND::synthesize(n, m, e.at(2)), e.at(0));
+      inputs.at(channel) = j == N ? Inverter::synthesize(n, s) : s;
+    }
+
+    if (l.negates.at(r) >= 0) inputs.at(l.negates.at(r)) = e.at(0);
+  }
+
+  Bus reduced = tree.synthesize(n, inputs);
+  Bus row0(2*N), row1(2*N);
+  for (auto w = 0; w < 2*N; ++w)
+  {
+    row0.at(2*N-1-w) = reduced.at(w);
+    row1.at(2*N-1-w) = reduced.at(2*N + w);
+  }
+
+  return WordAdder<2*N, Final>::synthesize(n, row0, row1);
+}
+
+
+std::vector<int> widePartialProducts(int width)
+{
+  std::vector<int> heights(2 * width, 0);
+  for (auto w = 0; w < 2 * width - 1; ++w) heights.at(w) = std::min(w + 1, 2 * width - 1 - w);
+  return heights;
+}
+
+template <int N, typename Tree, typename Final>
+Bus WideMultiplier<N, Tree, Final>::synthesize(Netlist& n, const Bus& a, const Bus& b)
+{
+  static const CompressorTree tree(widePartialProducts(N), Tree::reduction);
+
+  Bus inputs(tree.inputs());
+  for (auto i = 0; i < N; ++i)
+  {
+    for (auto j = 0; j < N; ++j)
+    {
+      inputs.at(channel(tree, i, j)) = AND::synthesize(n, a.at(N-1-i), b.at(N-1-j));
+    }
+  }
+
+  Bus reduced = tree.synthesize(n, inputs);
+  Bus row0(2*N), row1(2*N);
+  for (auto w = 0; w < 2*N; ++w)
+  {
+    row0.at(2*N-1-w) = reduced.at(w);
+    row1.at(2*N-1-w) = reduced.at(2*N + w);
+  }
+
+  return WordAdder<2*N, Final>::synthesize(n, row0, row1);
+}
+
+template <int N, int Threshold>
+Bus KaratsubaMultiplier<N, Threshold>::synthesize(Netlist& n, const Bus& a, const Bus& b)
+{
+  if constexpr (!split)
+  {
+    return Low::synthesize(n, a, b);
+  }
+  else
+  {
+    // Big-endian, so the high half is at the front
+    Bus a1(a.begin(), a.begin() + H), a0(a.begin() + H, a.end());
+    Bus b1(b.begin(), b.begin() + H), b0(b.begin() + H, b.end());
+
+    auto extend = [&](const Bus& bus)
+    {
+      Bus x(H + 1 - bus.size(), n.constant(0));
+      x.insert(x.end(), bus.begin(), bus.end());
+      return x;
+    };
+
+    Bus z0 = Low::synthesize(n, a0, b0);
+    Bus z2 = High::synthesize(n, a1, b1);
+    Bus zm = Middle::synthesize(n,
+      Sum::synthesize(n, extend(a0), extend(a1)),
+      Sum::synthesize(n, extend(b0), extend(b1)));
+
+    const Layout& l = layout();
+    static const CompressorTree tree(l.heights, Reduction::Dadda);
+    Bus inputs(tree.inputs());
+
+    auto feed = [&](const std::vector<int>& channels, const Bus& z, bool invert)
+    {
+      int width = z.size();
+      for (auto w = 0; w < width; ++w)
+      {
+        int channel = channels.at(w);
+        if (channel < 0) continue;
+
+        Net bit = z.at(width-1-w);
+        inputs.at(channel) = invert ? Inverter::synthesize(n, bit) : bit;
+      }
+    };
+
+    feed(l.z0, z0, false);
+    feed(l.z2, z2, false);
+    feed(l.zm, zm, false);
+    feed(l.notZ0, z0, true);
+    feed(l.notZ2, z2, true);
+    for (auto channel : l.ones) inputs.at(channel) = n.constant(1);
+
+    Bus reduced = tree.synthesize(n, inputs);
+    Bus row0(2*N), row1(2*N);
+    for (auto w = 0; w < 2*N; ++w)
+    {
+      row0.at(2*N-1-w) = reduced.at(w);
+      row1.at(2*N-1-w) = reduced.at(2*N + w);
+    }
+
+    return Final::synthesize(n, row0, row1);
+  }
+}
+
+
+template <int N, int AccBits, typename Tree, typename Final>
+Bus MAC<N, AccBits, Tree, Final>::synthesize(Netlist& n, const Bus& a, const Bus& b,
+                                             const Bus& accumulator)
+{
+  static const CompressorTree tree(heights(1), Tree::reduction);
+
+  Bus inputs(tree.inputs());
+  for (auto i = 0; i < N; ++i)
+  {
+    for (auto j = 0; j < N && i + j < AccBits; ++j)
+    {
+      inputs.at(channel(tree, i, j)) = AND::synthesize(n, a.at(N-1-i), b.at(N-1-j));
+    }
+  }
+
+  for (auto w = 0; w < AccBits; ++w)
+  {
+    int top = w < 2*N - 1 ? std::min(w + 1, 2*N - 1 - w) : 0;
+    inputs.at(tree.channel(w, top)) = accumulator.at(AccBits-1-w);
+  }
+
+  Bus reduced = tree.synthesize(n, inputs);
+  Bus row0(AccBits), row1(AccBits);
+  for (auto w = 0; w < AccBits; ++w)
+  {
+    row0.at(AccBits-1-w) = reduced.at(w);
+    row1.at(AccBits-1-w) = reduced.at(AccBits + w);
+  }
+
+  return WordAdder<AccBits, Final>::synthesize(n, row0, row1);
+}
+
+
+// BATCH DEFINITIONS
+
+
+template <int N, typename Tree, typename Final>
+void BoothMultiplier<N, Tree, Final>::processBatch(const std::vector<Word<N>>& a,
+                                                   const std::vector<Word<N>>& b,
+                                                   std::vector<Word<N>>& low) const
+{
+  static const BatchCircuit<N> circuit(0,
+    [](Netlist& n, const Bus& a, const Bus& b, const Bus&)
+    {
+      Bus product = synthesize(n, a, b);
+      return Bus(product.begin() + N, product.end());
+    });
+
+  circuit.run(a, b, {}, low);
+}
+
+template <int N, typename Tree, typename Final>
+void BoothMultiplier<N, Tree, Final>::processBatch(const std::vector<Word<N>>& a,
+                                                   const std::vector<Word<N>>& b,
+                                                   std::vector<Word<N>>& low,
+                                                   std::vector<Word<N>>& high) const
+{
+  static const BatchCircuit<N> circuit(0,
+    [](Netlist& n, const Bus& a, const Bus& b, const Bus&)
+    {
+      Bus product = synthesize(n, a, b);
+      return Bus(product.begin(), product.begin() + N);
+    });
+
+  processBatch(a, b, low);
+  circuit.run(a, b, {}, high);
+}
+
+
+template <int N, typename Tree, typename Final>
+void WideMultiplier<N, Tree, Final>::processBatch(const std::vector<Word<N>>& a,
+                                                  const std::vector<Word<N>>& b,
+                                                  std::vector<Word<N>>& low,
+                                                  std::vector<Word<N>>& high) const
+{
+  static const BatchCircuit<N> lowCircuit(0,
+    [](Netlist& n, const Bus& a, const Bus& b, const Bus&)
+    {
+      Bus product = synthesize(n, a, b);
+      return Bus(product.begin() + N, product.end());
+    });
+
+  static const BatchCircuit<N> highCircuit(0,
+    [](Netlist& n, const Bus& a, const Bus& b, const Bus&)
+    {
+      Bus product = synthesize(n, a, b);
+      return Bus(product.begin(), product.begin() + N);
+    });
+
+  lowCircuit.run(a, b, {}, low);
+  highCircuit.run(a, b, {}, high);
+}
+
+
+// MULTIPLY TESTS
+
+
+void testBoothEncoder()
+{
+  // (high, middle, low) -> digit
+  const int digits[8] = {0, 1, 1, 2, -2, -1, -1, 0};
+  BoothEncoder e;
+
+  for (auto i = 0; i < 8; ++i)
+  {
+    e.input(0, (i >> 2) & 1);
+    e.input(1, (i >> 1) & 1);
+    e.input(2, i & 1);
+    e.process();
+
+    int magnitude = e.output(2) ? (e.output(1) ? 2 : 1) : 0;
+    assert((e.output(0) ? -magnitude : magnitude) == digits[i]);
+  }
+}
+
+template <int N>
+void testBoothMultiplier()
+{
+  BoothMultiplier<N> m;
+  Netlist n;
+  Bus a = n.input(N);
+  Bus b = n.input(N);
+  Bus out = BoothMultiplier<N>::synthesize(n, a, b);
+  NetlistSimulator s(n);
+
+  // Sign extend the low N bits
+  auto value = [](uint64_t x)
+  {
+    return (int64_t) (x << (64 - N)) >> (64 - N);
+  };
+
+  auto check = [&](uint64_t x, uint64_t y)
+  {
+    uint64_t product = (uint64_t) (value(x) * value(y));
+    uint64_t mask = (1ull << N) - 1;
+
+    m.input(0, Word<N>::fromInt(x));
+    m.input(1, Word<N>::fromInt(y));
+    m.process();
+    assert(m.output(0).toInt() == (product & mask));
+    assert(m.output(1).toInt() == ((product >> N) & mask));
+
+    s.set(a, Word<N>::fromInt(x));
+    s.set(b, Word<N>::fromInt(y));
+    s.evaluate();
+    assert(s.get<2*N>(out).toInt() == (N == 32 ? product : product & ((1ull << 2*N) - 1)));
+  };
+
+  if (N <= 5)
+  {
+    for (uint64_t x = 0; x < (1u << N); ++x)
+    {
+      for (uint64_t y = 0; y < (1u << N); ++y) check(x, y);
+    }
+  }
+  else
+  {
+    uint64_t top = 1ull << (N - 1);
+    check(top, top);
+    check(top, top - 1);
+    check(top - 1, top - 1);
+    check(~0ull, top);
+
+    // rand() never sets bit 31, so build operands from two calls to
+    // get both signs at every width
+    srand(N);
+    for (auto i = 0; i < 200; ++i)
+    {
+      uint64_t x = ((uint64_t) rand() << 16) ^ rand();
+      uint64_t y = ((uint64_t) rand() << 16) ^ rand();
+      check(x, y);
+    }
+  }
+}
+
+void testBoothBatch()
+{
+  BoothMultiplier<16> m;
+  std::vector<Word<16>> a, b, low, high;
+
+  srand(16);
+  for (auto i = 0; i < 100; ++i)
+  {
+    a.push_back(Word<16>::fromInt(rand()));
+    b.push_back(Word<16>::fromInt(rand()));
+  }
+
+  m.processBatch(a, b, low, high);
+  for (auto i = 0; i < 100; ++i)
+  {
+    m.input(0, a.at(i));
+    m.input(1, b.at(i));
+    m.process();
+    assert(low.at(i) == m.output(0));
+    assert(high.at(i) == m.output(1));
+  }
+}
+
+// Unsigned full products of two multipliers with the same interface
+template <typename M, int N>
+void testFullProduct()
+{
+  M m;
+  Netlist n;
+  Bus a = n.input(N);
+  Bus b = n.input(N);
+  Bus out = M::synthesize(n, a, b);
+  NetlistSimulator s(n);
+
+  // Products as 32-bit limbs, low first
+  auto check = [&](const std::vector<uint32_t>& x, const std::vector<uint32_t>& y)
+  {
+    int limbs = (N + 31) / 32;
+    std::vector<uint64_t> product(2 * limbs + 1, 0);
+    for (auto i = 0; i < limbs; ++i)
+    {
+      uint64_t carry = 0;
+      for (auto j = 0; j < limbs; ++j)
+      {
+        uint64_t t = (uint64_t) x.at(i) * y.at(j) + product.at(i + j) + carry;
+        product.at(i + j) = t & 0xFFFFFFFF;
+        carry = t >> 32;
+      }
+      product.at(i + limbs) += carry;
+    }
+
+    Word<N> wx, wy;
+    for (auto w = 0; w < N; ++w)
+    {
+      wx.bit(N-1-w) = (x.at(w / 32) >> (w % 32)) & 1;
+      wy.bit(N-1-w) = (y.at(w / 32) >> (w % 32)) & 1;
+    }
+
+    m.input(0, wx);
+    m.input(1, wy);
+    m.process();
+
+    s.set(a, wx);
+    s.set(b, wy);
+    s.evaluate();
+    Word<2*N> netlist = s.get<2*N>(out);
+
+    for (auto w = 0; w < 2*N; ++w)
+    {
+      Signal expected = (product.at(w / 32) >> (w % 32)) & 1;
+      assert(productBit(m.output(0), m.output(1), w) == expected);
+      assert(netlist.bit(2*N-1-w) == expected);
+    }
+  };
+
+  int limbs = (N + 31) / 32;
+  auto operand = [&](uint32_t fill)
+  {
+    std::vector<uint32_t> x(limbs, fill);
+    if (N % 32) x.back() &= (1u << (N % 32)) - 1;
+    return x;
+  };
+
+  check(operand(0), operand(0));
+  check(operand(~0u), operand(~0u));
+  check(operand(~0u), operand(1));
+
+  srand(N);
+  for (auto i = 0; i < 20; ++i)
+  {
+    std::vector<uint32_t> x = operand(0), y = operand(0);
+    for (auto j = 0; j < limbs; ++j)
+    {
+      x.at(j) = ((uint32_t) rand() << 16) ^ rand();
+      y.at(j) = ((uint32_t) rand() << 16) ^ rand();
+    }
+    if (N % 32)
+    {
+      x.back() &= (1u << (N % 32)) - 1;
+      y.back() &= (1u << (N % 32)) - 1;
+    }
+    check(x, y);
+  }
+}
+
+void testWideMultiplier()
+{
+  testFullProduct<WideMultiplier<1>, 1>();
+  testFullProduct<WideMultiplier<5>, 5>();
+  testFullProduct<WideMultiplier<16>, 16>();
+  testFullProduct<WideMultiplier<32, Wallace>, 32>();
+  testFullProduct<WideMultiplier<40>, 40>();
+
+  // Exhaustive for a small one
+  WideMultiplier<4> m;
+  for (auto x = 0; x < 16; ++x)
+  {
+    for (auto y = 0; y < 16; ++y)
+    {
+      m.input(0, Word<4>::fromInt(x));
+      m.input(1, Word<4>::fromInt(y));
+      m.process();
+      assert((m.output(1).toInt() << 4 | m.output(0).toInt()) == (uint64_t) x * y);
+    }
+  }
+}
+
+void testKaratsuba()
+{
+  // Small thresholds so the recursion is deep at testable sizes
+  testFullProduct<KaratsubaMultiplier<8, 4>, 8>();
+  testFullProduct<KaratsubaMultiplier<13, 4>, 13>();
+  testFullProduct<KaratsubaMultiplier<64, 8>, 64>();
+  testFullProduct<KaratsubaMultiplier<96, 16>, 96>();
+
+  // Three products instead of four pays off past the threshold
+  auto gates = [](auto synthesize, int width)
+  {
+    Netlist n;
+    Bus a = n.input(width);
+    Bus b = n.input(width);
+    synthesize(n, a, b);
+    return n.gates();
+  };
+
+  int schoolbook = gates(WideMultiplier<128>::synthesize, 128);
+  int karatsuba = gates(KaratsubaMultiplier<128, 16>::synthesize, 128);
+  assert(karatsuba < schoolbook);
+}
+
+template <int N, int AccBits>
+void testMACDotProduct()
+{
+  MAC<N, AccBits> mac;
+  uint64_t mask = AccBits == 64 ? ~0ull : (1ull << AccBits) - 1;
+  assert(mac.accumulator().toInt() == 0);
+
+  srand(N + AccBits);
+  uint64_t expected = 0;
+  for (auto i = 0; i < 200; ++i)
+  {
+    uint64_t x = rand() & ((1ull << N) - 1);
+    uint64_t y = rand() & ((1ull << N) - 1);
+
+    mac.input(0, Word<N>::fromInt(x));
+    mac.input(1, Word<N>::fromInt(y));
+
+    // Every fifth element is held, every 50th starts again
+    bool clear = i % 50 == 0;
+    bool enable = i % 5 != 4;
+    mac.control(0, enable);
+    mac.control(1, clear);
+    mac.process();
+
+    if (enable) expected = ((clear ? 0 : expected) + x * y) & mask;
+    assert(mac.accumulator().toInt() == expected);
+  }
+}
+
+void testMAC()
+{
+  testMACDotProduct<8, 24>();
+  testMACDotProduct<16, 40>();
+
+  // Narrower than the product, so it wraps
+  testMACDotProduct<12, 16>();
+
+  // The combinational datapath adds like the component
+  Netlist n;
+  Bus a = n.input(8);
+  Bus b = n.input(8);
+  Bus acc = n.input(20);
+  Bus out = MAC<8, 20>::synthesize(n, a, b, acc);
+  NetlistSimulator s(n);
+
+  srand(20);
+  for (auto i = 0; i < 100; ++i)
+  {
+    uint64_t x = rand() & 0xFF, y = rand() & 0xFF, z = rand() & 0xFFFFF;
+    s.set(a, Word<8>::fromInt(x));
+    s.set(b, Word<8>::fromInt(y));
+    s.set(acc, Word<20>::fromInt(z));
+    s.evaluate();
+    assert(s.get<20>(out).toInt() == ((z + x * y) & 0xFFFFF));
+  }
+}
+
+// Run all tests on multipliers beyond WordMultiplier
+void testMultiply()
+{
+  testBoothEncoder();
+  testBoothMultiplier<2>();
+  testBoothMultiplier<3>();
+  testBoothMultiplier<4>();
+  testBoothMultiplier<5>();
+  testBoothMultiplier<8>();
+  testBoothMultiplier<13>();
+  testBoothMultiplier<32>();
+  testBoothBatch();
+  testWideMultiplier();
+  testKaratsuba();
+  testMAC();
+}
+
+
+#endif // MULTIPLY_HPP
@@ -1,6 +1,7 @@
 #ifndef MUXES_HPP
 #define MUXES_HPP
 
+#include <algorithm>
 #include <cmath>
 #include "Gates.hpp"
 
@@ -14,6 +15,9 @@ class Multiplexer : public ControlComponent
     
     void process();
 
+    // Add the same gates to a netlist, returning the output net
+    static Net synthesize(Netlist& n, Net data0, Net data1, Net control);
+
   private:
     Inverter _gate0; 
     NAND _gate1, _gate2, _gate3;
@@ -33,6 +37,9 @@ class WordMultiplexer : public WordControlComponent<N>
     
     void process();
 
+    static Bus synthesize(Netlist& n, const Bus& data0, const Bus& data1,
+                          Net control);
+
   private:
     std::vector<Multiplexer> _multiplexers;
 };
@@ -69,6 +76,15 @@ class Nto1WordMultiplexer : public WordControlComponent<N>
 
     void process();
 
+    // Only evaluate the muxes between the selected input and the output.
+    // Every other mux in the tree would be passing along a value
+    // that gets thrown away.
+    void processPath();
+
+    // Inputs are 2^M buses, controls are M nets
+    static Bus synthesize(Netlist& n, const std::vector<Bus>& data,
+                          const Bus& controls);
+
   private:
     // Tree of multiplexers stored in a vector
     std::vector<WordMultiplexer<N>> _muxes;
@@ -119,6 +135,10 @@ class OnetoNDemultiplexer : public ControlComponent
     
     void process();
 
+    // Only evaluate the demultiplexers between the input and the
+    // selected output. Other outputs keep their old values.
+    void processPath();
+
   private:
     std::vector<Demultiplexer> _demultiplexers;
 };
@@ -134,11 +154,36 @@ class OnetoNWordDemultiplexer : public WordControlComponent<N>
     
     void process();
 
+    // Only evaluate the demultiplexers between the input and the
+    // selected output. Other outputs keep their old values.
+    void processPath();
+
   private:
     std::vector<WordDemultiplexer<N>> _demultiplexers;
 };
 
 
+// 2^M to M priority encoder.
+// Outputs 0..M-1 are the index of the lowest numbered input that is
+// high, most significant bit first. Output M is high if any input is.
+// Built as a tree: each node takes the left half's index unless the
+// left half is empty.
+
+template <int M>
+class PriorityEncoder : public Component
+{
+  public:
+    PriorityEncoder() : Component(pow(2, M), M + 1) {}
+
+    void process();
+
+  private:
+    Inverter _empty;
+    OR _any;
+    Multiplexer _select;
+};
+
+
 // PROCESS DEFINITIONS
 
 void Multiplexer::process()
@@ -249,6 +294,44 @@ void Nto1WordMultiplexer<M, N>::process()
 }
 
 
+template <int M, int N>
+void Nto1WordMultiplexer<M, N>::processPath()
+{
+  // Walk down to find the path: control 0 picks the left child
+  std::vector<int> path;
+  for (auto i = 0, height = 0; height < M; ++height)
+  {
+    path.push_back(i);
+    i = 2 * i + 1 + this->_controls.at(height);
+  }
+
+  // Then evaluate it bottom up, same wiring as process()
+  for (auto height = M-1; height >= 0; --height)
+  {
+    int i = path.at(height);
+    auto& m = _muxes.at(i);
+
+    if (height == M-1)
+    {
+      int x = 2 * (i - (pow(2, height) - 1));
+      m.input(0, this->_inputs.at(x));
+      m.input(1, this->_inputs.at(x+1));
+    }
+    else
+    {
+      int x = 2 * (i + 1);
+      m.input(0, _muxes.at(x-1).output());
+      m.input(1, _muxes.at(x).output());
+    }
+
+    m.control(0, this->_controls.at(height));
+    m.process();
+  }
+
+  this->_outputs.at(0) = _muxes.at(0).output();
+}
+
+
 void Demultiplexer::process()
 {
   _gate0.input(0, _controls.at(0));
@@ -316,6 +399,39 @@ void OnetoNDemultiplexer<M>::process()
   }     
 }
 
+
+template <int M>
+void OnetoNDemultiplexer<M>::processPath()
+{
+  // Control 1 sends the signal to the left child, which is output 1
+  int i = 0;
+  for (auto height = 0; height < M; ++height)
+  {
+    Demultiplexer& d = _demultiplexers.at(i);
+
+    if (i == 0)
+    {
+      d.input(0, this->_inputs.at(0));
+    }
+    else
+    {
+      auto& parent = _demultiplexers.at((i-1)/2);
+      d.input(0, parent.output(i%2));
+    }
+
+    d.control(0, this->_controls.at(height));
+    d.process();
+
+    if (height < M-1) i = 2 * i + 2 - this->_controls.at(height);
+  }
+
+  // Both outputs of the last demultiplexer, numbered as in process()
+  Demultiplexer& d = _demultiplexers.at(i);
+  int first = 2 * (i - (pow(2, M-1) - 1));
+  this->_outputs.at(pow(2, M) - 1 - first) = d.output(1);
+  this->_outputs.at(pow(2, M) - 2 - first) = d.output(0);
+}
+
 template <int M, int N>
 void OnetoNWordDemultiplexer<M, N>::process()
 {
@@ -348,6 +464,131 @@ void OnetoNWordDemultiplexer<M, N>::process()
   }     
 }
 
+
+template <int M, int N>
+void OnetoNWordDemultiplexer<M, N>::processPath()
+{
+  // Control 1 sends the signal to the left child, which is output 1
+  int i = 0;
+  for (auto height = 0; height < M; ++height)
+  {
+    WordDemultiplexer<N>& d = _demultiplexers.at(i);
+
+    if (i == 0)
+    {
+      d.input(0, this->_inputs.at(0));
+    }
+    else
+    {
+      auto& parent = _demultiplexers.at((i-1)/2);
+      d.input(0, parent.output(i%2));
+    }
+
+    d.control(0, this->_controls.at(height));
+    d.process();
+
+    if (height < M-1) i = 2 * i + 2 - this->_controls.at(height);
+  }
+
+  // Both outputs of the last demultiplexer, numbered as in process()
+  WordDemultiplexer<N>& d = _demultiplexers.at(i);
+  int first = 2 * (i - (pow(2, M-1) - 1));
+  this->_outputs.at(pow(2, M) - 1 - first) = d.output(1);
+  this->_outputs.at(pow(2, M) - 2 - first) = d.output(0);
+}
+
+template <int M>
+void PriorityEncoder<M>::process()
+{
+  // valid[j] and index bits j*M .. j*M + level - 1 describe node j
+  // of the current level, leaves first
+  std::vector<Signal> valid(_inputs);
+  std::vector<Signal> index(valid.size() * M, 0);
+  std::vector<Signal> bits(M);
+
+  for (auto level = 0; level < M; ++level)
+  {
+    for (size_t j = 0; j < (valid.size() >> (level + 1)); ++j)
+    {
+      Signal left = valid.at(2*j), right = valid.at(2*j + 1);
+
+      // Take the right half only when the left is empty
+      _empty.input(0, left);
+      _empty.process();
+      Signal useRight = _empty.output();
+
+      bits.at(0) = useRight;
+      for (auto b = 0; b < level; ++b)
+      {
+        _select.input(0, index.at(2*j*M + b));
+        _select.input(1, index.at((2*j + 1)*M + b));
+        _select.control(0, useRight);
+        _select.process();
+        bits.at(b + 1) = _select.output();
+      }
+
+      _any.input(0, left);
+      _any.input(1, right);
+      _any.process();
+
+      valid.at(j) = _any.output();
+      std::copy(bits.begin(), bits.begin() + level + 1, index.begin() + j*M);
+    }
+  }
+
+  for (auto b = 0; b < M; ++b) _outputs.at(b) = index.at(b);
+  _outputs.at(M) = valid.at(0);
+}
+
+
+// NETLIST DEFINITIONS
+
+Net Multiplexer::synthesize(Netlist& n, Net data0, Net data1, Net control)
+{
+  Net gate0 = Inverter::synthesize(n, control);
+  Net gate1 = n.nand(data0, gate0);
+  Net gate2 = n.nand(control, data1);
+  return n.nand(gate1, gate2);
+}
+
+
+template <int N>
+Bus WordMultiplexer<N>::synthesize(Netlist& n, const Bus& data0,
+                                   const Bus& data1, Net control)
+{
+  Bus out(N);
+  for (auto i = 0; i < N; ++i)
+  {
+    out.at(i) = Multiplexer::synthesize(n, data0.at(i), data1.at(i), control);
+  }
+  return out;
+}
+
+
+template <int M, int N>
+Bus Nto1WordMultiplexer<M, N>::synthesize(Netlist& n,
+                                          const std::vector<Bus>& data,
+                                          const Bus& controls)
+{
+  // Same tree as process(): control 0 picks at the root,
+  // control M-1 picks between neighbouring inputs at the leaves.
+  std::vector<Bus> layer(data);
+
+  for (auto height = M-1; height >= 0; --height)
+  {
+    std::vector<Bus> next;
+    for (auto i = 0; i < (int) layer.size(); i += 2)
+    {
+      next.push_back(WordMultiplexer<N>::synthesize(
+        n, layer.at(i), layer.at(i+1), controls.at(height)));
+    }
+    layer = next;
+  }
+
+  return layer.at(0);
+}
+
+
 // MULTIPLEXER TESTS
 
 void testMultiplexer()
@@ -630,6 +871,62 @@ void testNto1WordMultiplexer()
 }
 
 
+void testProcessPath()
+{
+  // Evaluating just the selected path gives the same selected output
+  // as evaluating the whole tree, for every address
+  Nto1WordMultiplexer<3, 4> m;
+  OnetoNWordDemultiplexer<3, 4> dw;
+  OnetoNDemultiplexer<3> d;
+
+  for (auto i = 0; i < 8; ++i) m.input(i, Word<4>::fromInt(i + 5));
+  dw.input(0, Word<4>({1,0,1,1}));
+  d.input(0, 1);
+
+  for (auto address = 0; address < 8; ++address)
+  {
+    for (auto b = 0; b < 3; ++b)
+    {
+      Signal c = (address >> (2-b)) & 1;
+      m.control(b, c);
+      dw.control(b, c);
+      d.control(b, c);
+    }
+
+    m.processPath();
+    assert(m.output() == Word<4>::fromInt(address + 5));
+
+    dw.processPath();
+    assert(dw.output(address) == Word<4>({1,0,1,1}));
+    assert(dw.output(address ^ 1) == Word<4>());
+
+    d.processPath();
+    assert(d.output(address) == 1);
+    assert(d.output(address ^ 1) == 0);
+  }
+}
+
+
+void testPriorityEncoder()
+{
+  PriorityEncoder<3> e;
+
+  // Nothing high
+  for (auto i = 0; i < 8; ++i) e.input(i, 0);
+  e.process();
+  assert(e.output(3) == 0);
+
+  // Lowest high input wins
+  for (auto first = 0; first < 8; ++first)
+  {
+    for (auto i = 0; i < 8; ++i) e.input(i, i >= first && (i == first || i % 2));
+    e.process();
+    assert(e.output(3) == 1);
+    assert((e.output(0) << 2 | e.output(1) << 1 | e.output(2)) == first);
+  }
+}
+
+
 // Run all tests
 void testMultiplexers()
 {
@@ -641,6 +938,8 @@ void testMultiplexers()
   testWordDemultiplexer();
   testOnetoNDemultiplexer();
   testOnetoNWordDemultiplexer();
+  testProcessPath();
+  testPriorityEncoder();
 }
 
 
@@ -0,0 +1,677 @@
+#ifndef NETLIST_HPP
+#define NETLIST_HPP
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "Components.hpp"
+#include "ThreadPool.hpp"
+
+
+// A flattened view of a design.
+// Components synthesize themselves into a netlist of NAND gates, which
+// can be levelized and evaluated without any per-gate objects.
+
+// Nets are indices into the netlist
+using Net = int;
+
+// A bus of nets, big-endian like Word
+using Bus = std::vector<Net>;
+
+
+class Netlist
+{
+  public:
+    // Net 0 is tied low and net 1 is tied high
+    Netlist() : _nodes({{-1, -1, 0}, {-1, -1, 0}}) {}
+
+    // Add a primary input
+    Net input();
+
+    // Add a bus of primary inputs
+    Bus input(int width);
+
+    // Tied-off net for a constant signal
+    Net constant(Signal s) const
+    {
+      return s ? 1 : 0;
+    }
+
+    // Add a NAND gate and return its output net
+    Net nand(Net a, Net b);
+
+    // Feedback. loop() makes a net that gates can use before its
+    // driver exists, and close() later ties it to the driver. The
+    // simulator iterates the gates on the cycle until they settle.
+    Net loop();
+    void close(Net loop, Net driver);
+
+    // Each loop net with its driver
+    const std::vector<std::pair<Net, Net>>& loops() const
+    {
+      return _loops;
+    }
+
+    bool isGate(Net net) const
+    {
+      return _nodes.at(net).a >= 0;
+    }
+
+    // Gate input nets
+    Net a(Net gate) const { return _nodes.at(gate).a; }
+    Net b(Net gate) const { return _nodes.at(gate).b; }
+
+    int nets() const
+    {
+      return _nodes.size();
+    }
+
+    int gates() const
+    {
+      return _nodes.size() - _inputs.size() - _loops.size() - 2;
+    }
+
+    // Longest path from an input, in NAND gates
+    int depth() const
+    {
+      return _levels.size();
+    }
+
+    // Gates grouped by logic level. A gate only depends on gates from
+    // earlier levels, so each level can be evaluated in any order.
+    const std::vector<std::vector<Net>>& levels() const
+    {
+      return _levels;
+    }
+
+    const std::vector<Net>& inputs() const
+    {
+      return _inputs;
+    }
+
+  private:
+    friend class NetlistSimulator;
+    friend class BitSlicedSimulator;
+
+    // Inputs and constants have no fan-in and sit at level 0
+    struct Node
+    {
+      Net a, b;
+      int level;
+    };
+
+    std::vector<Node> _nodes;
+    std::vector<Net> _inputs;
+    std::vector<std::pair<Net, Net>> _loops;
+    std::vector<std::vector<Net>> _levels;
+};
+
+
+// Evaluates a netlist one level at a time.
+// Wide levels are split across a thread pool, narrow ones run serially.
+
+class NetlistSimulator
+{
+  public:
+    NetlistSimulator(const Netlist& netlist) :
+      _netlist(netlist), _values(netlist.nets(), 0)
+    {
+      _values.at(1) = 1;
+      if (!netlist.loops().empty()) findFeedback();
+    }
+
+    void set(Net net, Signal s)
+    {
+      _values.at(net) = s;
+    }
+
+    template <int N>
+    void set(const Bus& bus, const Word<N>& w)
+    {
+      for (auto i = 0; i < N; ++i) _values.at(bus.at(i)) = w.bit(i);
+    }
+
+    Signal get(Net net) const
+    {
+      return _values.at(net);
+    }
+
+    template <int N>
+    Word<N> get(const Bus& bus) const
+    {
+      Word<N> w;
+      for (auto i = 0; i < N; ++i) w.bit(i) = _values.at(bus.at(i));
+      return w;
+    }
+
+    // Evaluate every level on the calling thread
+    void evaluate();
+
+    // Evaluate with each level spread across a pool
+    void evaluate(ThreadPool& pool);
+
+    // Smallest slice of a level worth giving to another thread.
+    // A NAND is a couple of nanoseconds, so this needs to be big.
+    static const int grain = 4096;
+
+    // Passes over the feedback gates before calling it an oscillation
+    static const int maxPasses = 64;
+
+  private:
+    void evaluate(const std::vector<Net>& level, int begin, int end);
+
+    // Sort out which gates sit on a cycle, and which only hang off one
+    void findFeedback();
+
+    // Iterate the cycles to a fixed point after a full pass
+    void settle();
+
+    const Netlist& _netlist;
+    std::vector<Signal> _values;
+
+    // Gates on a cycle, and gates after one, in net order
+    std::vector<Net> _cyclic, _downstream;
+};
+
+
+// Evaluates 64 independent copies of a netlist at once.
+// Every net holds one bit per lane, so a NAND is a single
+// bitwise operation on 64 different sets of inputs.
+
+class BitSlicedSimulator
+{
+  public:
+    static const int lanes = 64;
+
+    BitSlicedSimulator(const Netlist& netlist) :
+      _netlist(netlist), _values(netlist.nets(), 0)
+    {
+      if (!netlist.loops().empty())
+      {
+        throw std::invalid_argument("Bit-sliced netlists can't have feedback");
+      }
+      _values.at(1) = ~0ull;
+    }
+
+    // Set a net in every lane at once
+    void set(Net net, uint64_t lanes)
+    {
+      _values.at(net) = lanes;
+    }
+
+    uint64_t get(Net net) const
+    {
+      return _values.at(net);
+    }
+
+    // Load words[k] into lane k, for up to 64 words
+    template <int N>
+    void set(const Bus& bus, const Word<N>* words, int count);
+
+    // Read lane k into words[k], for up to 64 words
+    template <int N>
+    void get(const Bus& bus, Word<N>* words, int count) const;
+
+    // Nets are created in topological order, so one pass
+    // in net order is enough and needs no level bookkeeping.
+    // Netlists with feedback aren't supported.
+    void evaluate();
+
+  private:
+    const Netlist& _netlist;
+    std::vector<uint64_t> _values;
+};
+
+
+// A word component flattened for batch evaluation.
+// Two N-bit operands and some control bits in, one N-bit word out.
+
+template <int N>
+class BatchCircuit
+{
+  public:
+    // build(netlist, a, b, controls) returns the output bus
+    template <typename Build>
+    BatchCircuit(int controls, Build build)
+    {
+      _a = _netlist.input(N);
+      _b = _netlist.input(N);
+      _controls = _netlist.input(controls);
+      _out = build(_netlist, _a, _b, _controls);
+    }
+
+    // Run out[i] = f(a[i], b[i]) for every operand pair.
+    // Pairs go through the bit-sliced engine 64 at a time,
+    // and groups of passes are spread across the thread pool.
+    void run(const std::vector<Word<N>>& a, const std::vector<Word<N>>& b,
+             const std::vector<Signal>& controls,
+             std::vector<Word<N>>& out) const;
+
+    const Netlist& netlist() const
+    {
+      return _netlist;
+    }
+
+  private:
+    Netlist _netlist;
+    Bus _a, _b, _controls, _out;
+};
+
+
+// NETLIST DEFINITIONS
+
+Net Netlist::input()
+{
+  _nodes.push_back({-1, -1, 0});
+  _inputs.push_back(_nodes.size() - 1);
+  return _inputs.back();
+}
+
+Bus Netlist::input(int width)
+{
+  Bus bus(width);
+  for (auto& net : bus) net = input();
+  return bus;
+}
+
+Net Netlist::nand(Net a, Net b)
+{
+  // Nets are created in topological order, so levels are known up front
+  int level = std::max(_nodes.at(a).level, _nodes.at(b).level) + 1;
+  _nodes.push_back({a, b, level});
+
+  Net out = _nodes.size() - 1;
+  if ((int) _levels.size() < level) _levels.resize(level);
+  _levels.at(level-1).push_back(out);
+  return out;
+}
+
+
+Net Netlist::loop()
+{
+  _nodes.push_back({-1, -1, 0});
+  _loops.push_back({(Net) _nodes.size() - 1, -1});
+  return _loops.back().first;
+}
+
+void Netlist::close(Net loop, Net driver)
+{
+  for (auto& l : _loops)
+  {
+    if (l.first != loop) continue;
+    if (l.second >= 0) throw std::logic_error("Loop already closed");
+    l.second = driver;
+    return;
+  }
+  throw std::invalid_argument("Not a loop net");
+}
+
+
+// SIMULATOR DEFINITIONS
+
+void NetlistSimulator::findFeedback()
+{
+  const auto& nodes = _netlist._nodes;
+  int size = nodes.size();
+
+  std::vector<std::vector<Net>> fanout(size);
+  std::vector<Net> driven(size, -1);
+  for (auto g = 2; g < size; ++g)
+  {
+    if (nodes[g].a < 0) continue;
+    fanout[nodes[g].a].push_back(g);
+    fanout[nodes[g].b].push_back(g);
+  }
+  for (auto& l : _netlist._loops)
+  {
+    if (l.second < 0) throw std::logic_error("Loop never closed");
+    driven[l.first] = l.second;
+  }
+
+  // Everything a loop net can reach
+  std::vector<bool> after(size, false);
+  std::vector<Net> stack;
+  for (auto& l : _netlist._loops) stack.push_back(l.first);
+  while (!stack.empty())
+  {
+    Net net = stack.back();
+    stack.pop_back();
+    for (auto g : fanout[net])
+    {
+      if (!after[g]) after[g] = true, stack.push_back(g);
+    }
+  }
+
+  // Everything that can reach a loop driver
+  std::vector<bool> before(size, false);
+  for (auto& l : _netlist._loops) stack.push_back(l.second);
+  while (!stack.empty())
+  {
+    Net net = stack.back();
+    stack.pop_back();
+    if (before[net]) continue;
+    before[net] = true;
+    if (nodes[net].a >= 0)
+    {
+      stack.push_back(nodes[net].a);
+      stack.push_back(nodes[net].b);
+    }
+    else if (driven[net] >= 0)
+    {
+      stack.push_back(driven[net]);
+    }
+  }
+
+  // Both means the gate is on a cycle
+  for (auto g = 2; g < size; ++g)
+  {
+    if (!after[g]) continue;
+    if (before[g]) _cyclic.push_back(g);
+    else _downstream.push_back(g);
+  }
+}
+
+void NetlistSimulator::settle()
+{
+  Signal* v = _values.data();
+
+  for (auto pass = 0; pass < maxPasses; ++pass)
+  {
+    bool changed = false;
+    for (auto& l : _netlist._loops)
+    {
+      if (v[l.first] != v[l.second])
+      {
+        v[l.first] = v[l.second];
+        changed = true;
+      }
+    }
+
+    if (!changed)
+    {
+      // Gates past the cycles only need the settled values
+      if (pass > 0) evaluate(_downstream, 0, _downstream.size());
+      return;
+    }
+
+    evaluate(_cyclic, 0, _cyclic.size());
+  }
+
+  throw std::runtime_error("Netlist feedback did not settle");
+}
+
+void NetlistSimulator::evaluate(const std::vector<Net>& level,
+                                int begin, int end)
+{
+  Signal* v = _values.data();
+  auto* nodes = _netlist._nodes.data();
+
+  for (auto i = begin; i < end; ++i)
+  {
+    Net g = level[i];
+    v[g] = !(v[nodes[g].a] && v[nodes[g].b]);
+  }
+}
+
+void NetlistSimulator::evaluate()
+{
+  for (auto& level : _netlist.levels())
+  {
+    evaluate(level, 0, level.size());
+  }
+
+  if (!_cyclic.empty()) settle();
+}
+
+void NetlistSimulator::evaluate(ThreadPool& pool)
+{
+  for (auto& level : _netlist.levels())
+  {
+    pool.parallelFor(level.size(), [&](int begin, int end)
+    {
+      evaluate(level, begin, end);
+    }, grain);
+  }
+
+  if (!_cyclic.empty()) settle();
+}
+
+
+template <int N>
+void BitSlicedSimulator::set(const Bus& bus, const Word<N>* words, int count)
+{
+  for (auto i = 0; i < N; ++i)
+  {
+    uint64_t lanes = 0;
+    for (auto k = 0; k < count; ++k)
+    {
+      lanes |= (uint64_t) words[k].bit(i) << k;
+    }
+    _values.at(bus.at(i)) = lanes;
+  }
+}
+
+template <int N>
+void BitSlicedSimulator::get(const Bus& bus, Word<N>* words, int count) const
+{
+  for (auto i = 0; i < N; ++i)
+  {
+    uint64_t lanes = _values.at(bus.at(i));
+    for (auto k = 0; k < count; ++k)
+    {
+      words[k].bit(i) = (lanes >> k) & 1;
+    }
+  }
+}
+
+void BitSlicedSimulator::evaluate()
+{
+  uint64_t* v = _values.data();
+  auto* nodes = _netlist._nodes.data();
+  int size = _values.size();
+
+  for (auto g = 2; g < size; ++g)
+  {
+    if (nodes[g].a >= 0) v[g] = ~(v[nodes[g].a] & v[nodes[g].b]);
+  }
+}
+
+
+// BATCH DEFINITIONS
+
+template <int N>
+void BatchCircuit<N>::run(const std::vector<Word<N>>& a,
+                          const std::vector<Word<N>>& b,
+                          const std::vector<Signal>& controls,
+                          std::vector<Word<N>>& out) const
+{
+  if (a.size() != b.size())
+  {
+    throw std::invalid_argument("Operand arrays differ in length");
+  }
+
+  const int lanes = BitSlicedSimulator::lanes;
+  int count = a.size();
+  int passes = (count + lanes - 1) / lanes;
+  out.resize(count);
+
+  // Give each thread at least a few hundred thousand NANDs of work
+  int grain = std::max(1, (1 << 18) / std::max(1, _netlist.gates()));
+
+  ThreadPool::instance().parallelFor(passes, [&](int begin, int end)
+  {
+    BitSlicedSimulator s(_netlist);
+
+    for (auto i = 0; i < (int) controls.size(); ++i)
+    {
+      s.set(_controls.at(i), controls.at(i) ? ~0ull : 0);
+    }
+
+    for (auto p = begin; p < end; ++p)
+    {
+      int first = p * lanes;
+      int width = std::min(lanes, count - first);
+
+      s.set<N>(_a, &a[first], width);
+      s.set<N>(_b, &b[first], width);
+      s.evaluate();
+      s.get<N>(_out, &out[first], width);
+    }
+  }, grain);
+}
+
+
+// NETLIST TESTS
+
+void testNetlist()
+{
+  Netlist n;
+  Net a = n.input();
+  Net b = n.input();
+  Net x = n.nand(a, b);
+  Net y = n.nand(x, x);
+
+  assert(n.gates() == 2);
+  assert(n.depth() == 2);
+
+  NetlistSimulator s(n);
+  s.set(a, 1);
+  s.set(b, 1);
+  s.evaluate();
+  assert(s.get(x) == 0);
+  assert(s.get(y) == 1);
+  assert(s.get(n.constant(0)) == 0);
+  assert(s.get(n.constant(1)) == 1);
+}
+
+void testParallelNetlist()
+{
+  // Random network wide enough to be split across threads
+  Netlist n;
+  Bus in = n.input(64);
+  std::vector<Net> nets(in);
+
+  srand(1);
+  for (auto i = 0; i < 50000; ++i)
+  {
+    Net a = nets.at(rand() % nets.size());
+    Net b = nets.at(rand() % nets.size());
+    nets.push_back(n.nand(a, b));
+  }
+
+  NetlistSimulator serial(n), parallel(n);
+  for (auto net : in)
+  {
+    Signal s = rand() % 2;
+    serial.set(net, s);
+    parallel.set(net, s);
+  }
+
+  ThreadPool pool(4);
+  serial.evaluate();
+  parallel.evaluate(pool);
+
+  for (auto net : nets) assert(serial.get(net) == parallel.get(net));
+}
+
+
+void testBitSlicedNetlist()
+{
+  // Every lane matches a scalar evaluation
+  Netlist n;
+  Bus in = n.input(16);
+  std::vector<Net> nets(in);
+
+  srand(2);
+  for (auto i = 0; i < 2000; ++i)
+  {
+    Net a = nets.at(rand() % nets.size());
+    Net b = nets.at(rand() % nets.size());
+    nets.push_back(n.nand(a, b));
+  }
+
+  BitSlicedSimulator sliced(n);
+  std::vector<uint64_t> lanes(in.size());
+  for (auto i = 0; i < (int) in.size(); ++i)
+  {
+    lanes.at(i) = ((uint64_t) rand() << 32) ^ rand();
+    sliced.set(in.at(i), lanes.at(i));
+  }
+  sliced.evaluate();
+
+  for (auto k = 0; k < 64; k += 7)
+  {
+    NetlistSimulator scalar(n);
+    for (auto i = 0; i < (int) in.size(); ++i)
+    {
+      scalar.set(in.at(i), (lanes.at(i) >> k) & 1);
+    }
+    scalar.evaluate();
+
+    for (auto net : nets) assert(scalar.get(net) == ((sliced.get(net) >> k) & 1));
+  }
+}
+
+
+void testFeedback()
+{
+  // Cross-coupled NANDs hold their state between evaluations
+  Netlist n;
+  Net set = n.input();
+  Net reset = n.input();
+  Net feedback = n.loop();
+  Net q = n.nand(set, feedback);
+  Net nq = n.nand(reset, q);
+  n.close(feedback, nq);
+  Net out = n.nand(q, q);
+
+  NetlistSimulator sim(n);
+  auto drive = [&](Signal s, Signal r)
+  {
+    sim.set(set, s);
+    sim.set(reset, r);
+    sim.evaluate();
+  };
+
+  drive(0, 1);
+  assert(sim.get(q) == 1 && sim.get(nq) == 0 && sim.get(out) == 0);
+  drive(1, 1);
+  assert(sim.get(q) == 1 && sim.get(nq) == 0 && sim.get(out) == 0);
+  drive(1, 0);
+  assert(sim.get(q) == 0 && sim.get(nq) == 1 && sim.get(out) == 1);
+  drive(1, 1);
+  assert(sim.get(q) == 0 && sim.get(nq) == 1 && sim.get(out) == 1);
+
+  // An odd ring of inverters never settles
+  Netlist ring;
+  Net x = ring.loop();
+  ring.close(x, ring.nand(x, ring.constant(1)));
+
+  NetlistSimulator oscillator(ring);
+  bool thrown = false;
+  try
+  {
+    oscillator.evaluate();
+  }
+  catch (const std::runtime_error&)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+}
+
+
+// Run all netlist tests
+void testNetlists()
+{
+  testNetlist();
+  testParallelNetlist();
+  testBitSlicedNetlist();
+  testFeedback();
+}
+
+
+#endif // NETLIST_HPP
@@ -0,0 +1,652 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "ALU.hpp"
+#include "Memory.hpp"
+#include "Netlist.hpp"
+
+
+// Base class so a simulation can close channels of any type
+
+class ChannelBase
+{
+  public:
+    virtual ~ChannelBase() {}
+
+    // Wake up anyone blocked on the channel with an exception
+    void close()
+    {
+      _closed = true;
+    }
+
+  protected:
+    // Back off while blocked, bailing out if the channel was closed
+    void wait() const
+    {
+      if (_closed) throw std::runtime_error("Channel closed");
+      std::this_thread::yield();
+    }
+
+    std::atomic<bool> _closed{false};
+};
+
+
+// Lock-free single-producer, single-consumer ring buffer.
+// The capacity is how many cycles the producer may run ahead.
+
+template <typename T>
+class Channel : public ChannelBase
+{
+  public:
+    // Capacity is rounded up to a power of two
+    Channel(int capacity) : _head(0), _tail(0)
+    {
+      size_t size = 1;
+      while ((int) size < capacity) size *= 2;
+      _slots.resize(size);
+      _mask = size - 1;
+    }
+
+    // Non-blocking, false if the ring is full
+    bool tryPut(const T& value)
+    {
+      size_t tail = _tail.load(std::memory_order_relaxed);
+      if (tail - _head.load(std::memory_order_acquire) == _slots.size())
+      {
+        return false;
+      }
+
+      _slots[tail & _mask] = value;
+      _tail.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Non-blocking, false if the ring is empty
+    bool tryTake(T& value)
+    {
+      size_t head = _head.load(std::memory_order_relaxed);
+      if (head == _tail.load(std::memory_order_acquire)) return false;
+
+      value = _slots[head & _mask];
+      _head.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Block until there's room
+    void put(const T& value)
+    {
+      while (!tryPut(value)) wait();
+    }
+
+    // Block until there's a value
+    T take()
+    {
+      T value;
+      take(value);
+      return value;
+    }
+
+    // Block until there's a value, reusing the caller's storage
+    void take(T& value)
+    {
+      while (!tryTake(value)) wait();
+    }
+
+  private:
+    std::vector<T> _slots;
+    size_t _mask;
+
+    // Producer and consumer indices live on separate cache lines
+    alignas(64) std::atomic<size_t> _head;
+    alignas(64) std::atomic<size_t> _tail;
+};
+
+
+// Simulates a design split into partitions, each on its own thread.
+//
+// A partition is a step function called once per clock cycle. Values
+// that cross between partitions go through channels, so a partition
+// only waits when it needs a value that hasn't been produced yet, or
+// when it's a full channel's worth of cycles ahead of its consumer.
+// Feedback channels need an initial value put() before running, just
+// like the register that breaks the loop in hardware.
+//
+// Cut partitions along component boundaries: the only nets crossing
+// them are the component's word ports, which is as narrow as a cut gets.
+// A flattened design can be cut automatically with partitionNetlist().
+
+class PartitionedSimulation
+{
+  public:
+    using Step = std::function<void(uint64_t cycle)>;
+
+    // Create a channel owned by the simulation
+    template <typename T>
+    Channel<T>& channel(int capacity = 16)
+    {
+      auto c = std::make_shared<Channel<T>>(capacity);
+      _channels.push_back(c);
+      return *c;
+    }
+
+    void partition(Step step)
+    {
+      _partitions.push_back(step);
+    }
+
+    int partitions() const
+    {
+      return _partitions.size();
+    }
+
+    // Cycles simulated so far
+    uint64_t cycle() const
+    {
+      return _cycle;
+    }
+
+    // Run every partition for a number of cycles.
+    // If a partition throws, the rest are stopped and the error rethrown.
+    void run(uint64_t cycles);
+
+  private:
+    std::vector<Step> _partitions;
+    std::vector<std::shared_ptr<ChannelBase>> _channels;
+    uint64_t _cycle = 0;
+};
+
+
+void PartitionedSimulation::run(uint64_t cycles)
+{
+  std::vector<std::thread> threads;
+  std::exception_ptr error;
+  std::mutex errorLock;
+  uint64_t first = _cycle;
+
+  for (auto& step : _partitions)
+  {
+    threads.emplace_back([&, first]
+    {
+      try
+      {
+        for (auto c = first; c < first + cycles; ++c) step(c);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lk(errorLock);
+        if (!error) error = std::current_exception();
+        for (auto& ch : _channels) ch->close();
+      }
+    });
+  }
+
+  for (auto& t : threads) t.join();
+
+  _cycle += cycles;
+  if (error) std::rethrow_exception(error);
+}
+
+
+// A netlist cut into partitions that run one after another.
+// Partition p evaluates gates.at(p), in net order. It reads cuts.at(p)
+// from the partition before it and hands cuts.at(p+1) to the next, so
+// cuts.at(0) is every primary input and cuts.back() is the outputs.
+// A net used further down is passed along by every partition between.
+
+struct NetlistPartitions
+{
+  std::vector<std::vector<Net>> gates;
+  std::vector<Bus> cuts;
+
+  int parts() const
+  {
+    return gates.size();
+  }
+
+  // Nets crossing between partitions, not counting inputs and outputs
+  int cutNets() const
+  {
+    int total = 0;
+    for (auto p = 1; p < parts(); ++p) total += cuts.at(p).size();
+    return total;
+  }
+};
+
+
+// Split a netlist into up to parts partitions with as few nets crossing
+// between them as possible. Gates keep their net order, which is
+// topological, so values only ever flow forwards. Each boundary is the
+// narrowest cut within slack of an even split of the gates, chosen one
+// boundary at a time.
+// Netlists with feedback can't be split this way.
+
+NetlistPartitions partitionNetlist(const Netlist& netlist, const Bus& outputs,
+                                   int parts, double slack = 0.25);
+
+
+// One partition of a netlist, with its own copy of the net values
+
+class NetlistStage
+{
+  public:
+    NetlistStage(const Netlist& netlist, const NetlistPartitions& partitions, int index);
+
+    // Values of the incoming cut in, values of the outgoing cut out
+    void step(const std::vector<Signal>& in, std::vector<Signal>& out);
+
+  private:
+    struct Gate
+    {
+      Net out, a, b;
+    };
+
+    std::vector<Gate> _gates;
+    Bus _in, _out;
+    std::vector<Signal> _values;
+};
+
+
+// Evaluates a netlist once per input vector with its partitions on
+// separate threads, pipelined through channels: partition p works on
+// one vector while partition p+1 is still on the one before.
+
+class PipelinedNetlist
+{
+  public:
+    PipelinedNetlist(const Netlist& netlist, const Bus& outputs, int parts,
+                     int capacity = 16);
+
+    const NetlistPartitions& partitions() const
+    {
+      return _partitions;
+    }
+
+    // Each input vector holds the netlist's inputs in order, and gets
+    // back the outputs in order
+    std::vector<std::vector<Signal>> run(const std::vector<std::vector<Signal>>& stimulus);
+
+  private:
+    NetlistPartitions _partitions;
+    std::vector<NetlistStage> _stages;
+    int _capacity;
+};
+
+
+// PIPELINED SIMULATION DEFINITIONS
+
+
+
+NetlistPartitions partitionNetlist(const Netlist& netlist, const Bus& outputs,
+                                   int parts, double slack)
+{
+  if (parts < 1) throw std::invalid_argument("Need at least one partition");
+  if (!netlist.loops().empty())
+  {
+    throw std::invalid_argument("Can't partition a netlist with feedback");
+  }
+
+  int size = netlist.nets();
+
+  // Position of each gate in net order. Inputs come before them all.
+  std::vector<Net> order;
+  std::vector<int> position(size, -1);
+  for (auto g = 0; g < size; ++g)
+  {
+    if (!netlist.isGate(g)) continue;
+    position.at(g) = order.size();
+    order.push_back(g);
+  }
+
+  int gates = order.size();
+  parts = std::max(1, std::min(parts, gates));
+
+  // Last position that reads each net, past the end for outputs
+  std::vector<int> lastUse(size, -1);
+  for (auto p = 0; p < gates; ++p)
+  {
+    Net g = order.at(p);
+    lastUse.at(netlist.a(g)) = p;
+    lastUse.at(netlist.b(g)) = p;
+  }
+  for (auto o : outputs) lastUse.at(o) = gates;
+
+  // A net crosses the boundary in front of position b if it's made
+  // before b and read at or after it. Constants never cross.
+  std::vector<int> crossing(gates + 2, 0);
+  for (auto n = 2; n < size; ++n)
+  {
+    if (lastUse.at(n) < 0) continue;
+    int made = position.at(n) + 1;
+    if (made > lastUse.at(n)) continue;
+    ++crossing.at(made);
+    --crossing.at(lastUse.at(n) + 1);
+  }
+  for (auto b = 1; b <= gates; ++b) crossing.at(b) += crossing.at(b - 1);
+
+  std::vector<int> bounds = {0};
+  for (auto p = 1; p < parts; ++p)
+  {
+    int ideal = (int64_t) gates * p / parts;
+    int window = std::max(0, (int) (slack * gates / parts));
+    int low = std::max(bounds.back() + 1, ideal - window);
+    int high = std::min(gates - (parts - p), ideal + window);
+
+    int best = std::max(low, std::min(ideal, high));
+    for (auto b = low; b <= high; ++b)
+    {
+      bool narrower = crossing.at(b) < crossing.at(best);
+      bool closer = crossing.at(b) == crossing.at(best)
+                    && std::abs(b - ideal) < std::abs(best - ideal);
+      if (narrower || closer) best = b;
+    }
+    bounds.push_back(best);
+  }
+  bounds.push_back(gates);
+
+  NetlistPartitions result;
+  result.gates.resize(parts);
+  result.cuts.resize(parts + 1);
+
+  for (auto p = 0; p < parts; ++p)
+  {
+    result.gates.at(p).assign(order.begin() + bounds.at(p),
+                              order.begin() + bounds.at(p + 1));
+  }
+
+  result.cuts.front() = netlist.inputs();
+  result.cuts.back() = outputs;
+  for (auto n = 2; n < size; ++n)
+  {
+    for (auto p = 1; p < parts; ++p)
+    {
+      int b = bounds.at(p);
+      if (position.at(n) < b && lastUse.at(n) >= b) result.cuts.at(p).push_back(n);
+    }
+  }
+
+  return result;
+}
+
+NetlistStage::NetlistStage(const Netlist& netlist, const NetlistPartitions& partitions,
+                           int index) :
+  _in(partitions.cuts.at(index)),
+  _out(partitions.cuts.at(index + 1)),
+  _values(netlist.nets(), 0)
+{
+  _values.at(1) = 1;
+  for (auto g : partitions.gates.at(index))
+  {
+    _gates.push_back({g, netlist.a(g), netlist.b(g)});
+  }
+}
+
+void NetlistStage::step(const std::vector<Signal>& in, std::vector<Signal>& out)
+{
+  Signal* v = _values.data();
+
+  for (size_t i = 0; i < _in.size(); ++i) v[_in[i]] = in.at(i);
+  for (auto& g : _gates) v[g.out] = !(v[g.a] && v[g.b]);
+
+  out.resize(_out.size());
+  for (size_t i = 0; i < _out.size(); ++i) out[i] = v[_out[i]];
+}
+
+PipelinedNetlist::PipelinedNetlist(const Netlist& netlist, const Bus& outputs,
+                                   int parts, int capacity) :
+  _partitions(partitionNetlist(netlist, outputs, parts)),
+  _capacity(capacity)
+{
+  for (auto p = 0; p < _partitions.parts(); ++p)
+  {
+    _stages.emplace_back(netlist, _partitions, p);
+  }
+}
+
+std::vector<std::vector<Signal>>
+PipelinedNetlist::run(const std::vector<std::vector<Signal>>& stimulus)
+{
+  using Values = std::vector<Signal>;
+
+  int parts = _stages.size();
+  std::vector<Values> results(stimulus.size());
+
+  PartitionedSimulation sim;
+  std::vector<Channel<Values>*> links;
+  for (auto p = 0; p + 1 < parts; ++p) links.push_back(&sim.channel<Values>(_capacity));
+
+  for (auto p = 0; p < parts; ++p)
+  {
+    // Each partition keeps its buffers, so steady state doesn't allocate
+    auto in = std::make_shared<Values>();
+    auto out = std::make_shared<Values>();
+
+    sim.partition([this, p, parts, in, out, &links, &stimulus, &results](uint64_t c)
+    {
+      if (p == 0) *in = stimulus.at(c);
+      else links.at(p - 1)->take(*in);
+
+      _stages.at(p).step(*in, *out);
+
+      if (p == parts - 1) results.at(c) = *out;
+      else links.at(p)->put(*out);
+    });
+  }
+
+  sim.run(stimulus.size());
+  return results;
+}
+
+
+// PIPELINE TESTS
+
+void testChannel()
+{
+  Channel<int> c(3);
+
+  // Capacity rounds up to 4
+  assert(c.tryPut(1));
+  assert(c.tryPut(2));
+  assert(c.tryPut(3));
+  assert(c.tryPut(4));
+  assert(!c.tryPut(5));
+
+  int v;
+  assert(c.tryTake(v) && v == 1);
+  assert(c.take() == 2);
+  assert(c.take() == 3);
+  assert(c.take() == 4);
+  assert(!c.tryTake(v));
+
+  // Values arrive in order across threads
+  Channel<int> d(8);
+  std::thread producer([&] { for (auto i = 0; i < 10000; ++i) d.put(i); });
+  for (auto i = 0; i < 10000; ++i) assert(d.take() == i);
+  producer.join();
+}
+
+void testPartitionedSimulation()
+{
+  // ALU -> RAM -> checker, with the RAM's read port feeding back
+  // into the ALU as its second operand one cycle later.
+  ALU<8> alu;
+  RAM<5, 8> ram;
+  std::vector<uint64_t> seen;
+
+  PartitionedSimulation sim;
+  auto& sums = sim.channel<Word<8>>(4);
+  auto& reads = sim.channel<Word<8>>(4);
+  auto& feedback = sim.channel<Word<8>>(4);
+
+  // Reset value of the feedback register
+  feedback.put(Word<8>());
+
+  sim.partition([&](uint64_t c)
+  {
+    alu.input(0, Word<8>::fromInt(c));
+    alu.input(1, feedback.take());
+    alu.control(0, 0);
+    alu.control(1, 0);
+    alu.process();
+    sums.put(alu.output());
+  });
+
+  sim.partition([&](uint64_t c)
+  {
+    // Write to address c, then read it back
+    ram.input(0, sums.take());
+    ram.control(0, 1);
+    for (auto i = 1; i < 5; ++i) ram.control(i, (c >> (4-i)) & 1);
+    ram.process();
+    ram.control(0, 0);
+    ram.process();
+
+    reads.put(ram.output());
+    feedback.put(ram.output());
+  });
+
+  sim.partition([&](uint64_t)
+  {
+    seen.push_back(reads.take().toInt());
+  });
+
+  sim.run(20);
+  sim.run(12);
+  assert(sim.cycle() == 32);
+
+  // Running total of 0..c, modulo 256
+  uint64_t total = 0;
+  for (auto c = 0; c < 32; ++c)
+  {
+    total = (total + c) % 256;
+    assert(seen.at(c) == total);
+  }
+
+  // A failing partition stops the others instead of hanging them
+  PartitionedSimulation broken;
+  auto& never = broken.channel<int>();
+  broken.partition([&](uint64_t) { never.take(); });
+  broken.partition([&](uint64_t) { throw std::logic_error("boom"); });
+
+  bool thrown = false;
+  try
+  {
+    broken.run(1);
+  }
+  catch (const std::logic_error&)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+}
+
+
+void testNetlistPartitions()
+{
+  // Two adders side by side, then one adding their sums. The only
+  // narrow place to cut is between the two halves' sums and the rest.
+  Netlist n;
+  Bus a = n.input(16), b = n.input(16), c = n.input(16), d = n.input(16);
+  Bus left = WordAdder<16>::synthesize(n, a, b);
+  Bus right = WordAdder<16>::synthesize(n, c, d);
+  Bus sum = WordAdder<16>::synthesize(n, left, right);
+
+  auto one = partitionNetlist(n, sum, 1);
+  assert(one.parts() == 1);
+  assert(one.cutNets() == 0);
+  assert((int) one.gates.at(0).size() == n.gates());
+
+  // Every gate lands in exactly one partition, in net order
+  auto three = partitionNetlist(n, sum, 3);
+  assert(three.parts() == 3);
+  Net previous = -1;
+  int total = 0;
+  for (auto& part : three.gates)
+  {
+    assert(!part.empty());
+    for (auto g : part)
+    {
+      assert(g > previous);
+      previous = g;
+    }
+    total += part.size();
+  }
+  assert(total == n.gates());
+
+  // No slack means even splits, and that's never narrower
+  auto even = partitionNetlist(n, sum, 3, 0);
+  assert(three.cutNets() <= even.cutNets());
+
+  // Cut nets are all made before the partition that receives them
+  for (auto p = 1; p < 3; ++p)
+  {
+    Net first = three.gates.at(p).front();
+    for (auto net : three.cuts.at(p)) assert(net < first);
+  }
+
+  // Feedback can't be cut in net order
+  Netlist latch;
+  Net q = latch.loop();
+  latch.close(q, latch.nand(latch.input(), q));
+  bool thrown = false;
+  try
+  {
+    partitionNetlist(latch, {q}, 2);
+  }
+  catch (const std::invalid_argument&)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+}
+
+void testPipelinedNetlist()
+{
+  // Random vectors through a partitioned multiplier match a plain run
+  Netlist n;
+  Bus a = n.input(8), b = n.input(8);
+  Bus product = WordMultiplier<8>::synthesize(n, a, b);
+
+  PipelinedNetlist pipeline(n, product, 4, 4);
+  assert(pipeline.partitions().parts() == 4);
+
+  srand(27);
+  std::vector<std::vector<Signal>> stimulus(100);
+  for (auto& v : stimulus)
+  {
+    for (auto i = 0; i < 16; ++i) v.push_back(rand() & 1);
+  }
+
+  auto results = pipeline.run(stimulus);
+  assert(results.size() == stimulus.size());
+
+  NetlistSimulator sim(n);
+  for (size_t k = 0; k < stimulus.size(); ++k)
+  {
+    for (auto i = 0; i < 16; ++i) sim.set(n.inputs().at(i), stimulus.at(k).at(i));
+    sim.evaluate();
+    for (auto i = 0; i < 8; ++i) assert(results.at(k).at(i) == sim.get(product.at(i)));
+  }
+
+  // Nothing carries over between runs
+  assert(pipeline.run(stimulus) == results);
+}
+
+
+// Run all pipeline tests
+void testPipeline()
+{
+  testChannel();
+  testPartitionedSimulation();
+  testNetlistPartitions();
+  testPipelinedNetlist();
+}
+
+
+#endif // PIPELINE_HPP
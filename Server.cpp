@@ -0,0 +1,84 @@
+#include <assert.h>
+#include <csignal>
+#include <iostream>
+
+#include <pthread.h>
+
+#include "Server.hpp"
+
+/*
+
+             --loob--
+
+        Simulation server
+
+*/
+
+
+void usage()
+{
+  std::cerr << "usage: loob-server [--socket PATH] [--cache DESIGNS] [--threads N]"
+            << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  std::string path = "/tmp/loob.sock";
+  int cache = 32;
+  int threads = 1;
+
+  for (auto i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+
+    if (arg == "--socket" && i + 1 < argc) path = argv[++i];
+    else if (arg == "--cache" && i + 1 < argc) cache = std::stoi(argv[++i]);
+    else if (arg == "--threads" && i + 1 < argc) threads = std::stoi(argv[++i]);
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+
+  // Handle SIGINT and SIGTERM on a thread of their own, since a signal
+  // handler can't safely stop the server. Block them before any other
+  // thread starts, pool workers included, so only that thread gets them.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  // Connections already run in parallel, so components stay serial
+  // by default rather than fighting over the pool
+  ThreadPool::instance().resize(threads);
+
+  try
+  {
+    Server server(path, cache);
+
+    std::thread waiter([&]
+    {
+      int signal;
+      sigwait(&signals, &signal);
+      server.stop();
+    });
+
+    std::cerr << "loob-server: listening on " << path << std::endl;
+    server.serve();
+
+    // A client may have shut us down instead, so wake the waiter up
+    // before the server goes away under it
+    pthread_kill(waiter.native_handle(), SIGTERM);
+    waiter.join();
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "loob-server: " << e.what() << std::endl;
+    return 1;
+  }
+}
+
+
+// END
@@ -0,0 +1,684 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Sweep.hpp"
+
+
+// Wire format for the simulation server.
+//
+// Every message is a 12-byte header followed by a payload:
+//   u32 magic "LOOB", u32 type, u32 payload length
+// All integers are little-endian.
+//
+// Run payload:      str design, u64 seed, u64 cycles,
+//                   u16 count + i8 controls, u16 count + u16 observe
+// Result payload:   u64 digest, u64 cycles, f64 seconds,
+//                   u16 count + u64 outputs
+// Stats payload:    u64 jobs, u64 hits, u64 misses, u64 evictions
+// Error payload:    str message
+// Strings are a u16 length followed by the bytes.
+
+namespace Protocol
+{
+  const uint32_t magic = 0x424F4F4C; // "LOOB"
+
+  enum Type : uint32_t { Run = 1, Result = 2, Stats = 3, Error = 4, Shutdown = 5 };
+
+  class Writer
+  {
+    public:
+      template <typename T>
+      void put(T value)
+      {
+        uint64_t bits = 0;
+        memcpy(&bits, &value, sizeof(T));
+        for (size_t i = 0; i < sizeof(T); ++i) bytes.push_back(bits >> (8*i));
+      }
+
+      void put(const std::string& s)
+      {
+        put<uint16_t>(s.size());
+        bytes.insert(bytes.end(), s.begin(), s.end());
+      }
+
+      std::vector<uint8_t> bytes;
+  };
+
+  class Reader
+  {
+    public:
+      Reader(const std::vector<uint8_t>& bytes) : _bytes(bytes), _at(0) {}
+
+      template <typename T>
+      T get()
+      {
+        if (_at + sizeof(T) > _bytes.size()) throw std::runtime_error("Short message");
+
+        uint64_t bits = 0;
+        for (size_t i = 0; i < sizeof(T); ++i) bits |= (uint64_t) _bytes[_at++] << (8*i);
+
+        T value;
+        memcpy(&value, &bits, sizeof(T));
+        return value;
+      }
+
+      std::string string()
+      {
+        size_t size = get<uint16_t>();
+        if (_at + size > _bytes.size()) throw std::runtime_error("Short message");
+
+        std::string s(_bytes.begin() + _at, _bytes.begin() + _at + size);
+        _at += size;
+        return s;
+      }
+
+    private:
+      const std::vector<uint8_t>& _bytes;
+      size_t _at;
+  };
+
+  // False on a closed or broken connection
+  bool send(int socket, Type type, const std::vector<uint8_t>& payload);
+  bool receive(int socket, Type& type, std::vector<uint8_t>& payload);
+}
+
+
+// Least recently used cache of constructed designs.
+// A design is checked out while a job runs on it, so two clients can
+// never share one. If both want the same design at once, the second
+// gets a fresh instance, and both are cached when they come back.
+
+class DesignCache
+{
+  public:
+    DesignCache(int capacity, const Registry& registry = Registry::instance()) :
+      _capacity(capacity), _registry(registry) {}
+
+    std::unique_ptr<Design> acquire(const std::string& name);
+    void release(const std::string& name, std::unique_ptr<Design> d);
+
+    // Safe to read while other threads use the cache
+    uint64_t hits() const { return _hits; }
+    uint64_t misses() const { return _misses; }
+    uint64_t evictions() const { return _evictions; }
+
+  private:
+    using Entry = std::pair<std::string, std::unique_ptr<Design>>;
+
+    int _capacity;
+    const Registry& _registry;
+    std::list<Entry> _entries; // Most recently used first
+    std::mutex _lock;
+    std::atomic<uint64_t> _hits{0}, _misses{0}, _evictions{0};
+};
+
+
+// Long-running simulation server on a Unix domain socket.
+// Each connection gets its own thread and may send any number of jobs.
+// Threads of closed connections are joined on the next accept, so a
+// server that runs for months only holds on to live connections.
+
+class Server
+{
+  public:
+    Server(const std::string& path, int cacheCapacity = 32);
+    ~Server();
+
+    // Accept connections until a client sends Shutdown or stop() is called
+    void serve();
+
+    void stop();
+
+    const DesignCache& cache() const
+    {
+      return _cache;
+    }
+
+    // Connections whose threads haven't been joined yet
+    int connections() const
+    {
+      std::lock_guard<std::mutex> lk(_lock);
+      return _connections.size();
+    }
+
+  private:
+    struct Connection
+    {
+      std::thread thread;
+      int socket;
+    };
+
+    void handle(uint64_t id, int socket);
+    std::vector<uint8_t> run(Protocol::Reader& in);
+
+    // Join the threads of connections that have closed. Needs _lock.
+    void reap();
+
+    std::string _path;
+    int _listener;
+    DesignCache _cache;
+    std::atomic<bool> _stopping;
+    std::atomic<uint64_t> _jobs;
+
+    mutable std::mutex _lock;
+    std::map<uint64_t, Connection> _connections;
+    std::vector<uint64_t> _finished;
+    uint64_t _nextConnection = 0;
+};
+
+
+// Client side of the protocol. One connection, used by one thread.
+
+class Client
+{
+  public:
+    Client(const std::string& path);
+    ~Client();
+
+    Result run(const Job& job);
+
+    struct Stats
+    {
+      uint64_t jobs, hits, misses, evictions;
+    };
+
+    Stats stats();
+
+    // Ask the server to exit
+    void shutdown();
+
+  private:
+    std::vector<uint8_t> request(Protocol::Type type,
+                                 const std::vector<uint8_t>& payload,
+                                 Protocol::Type expected);
+
+    int _socket;
+};
+
+
+// PROTOCOL DEFINITIONS
+
+bool sendAll(int socket, const void* data, size_t size)
+{
+  const char* p = (const char*) data;
+  while (size > 0)
+  {
+    ssize_t n = ::send(socket, p, size, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool receiveAll(int socket, void* data, size_t size)
+{
+  char* p = (char*) data;
+  while (size > 0)
+  {
+    ssize_t n = ::recv(socket, p, size, 0);
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool Protocol::send(int socket, Type type, const std::vector<uint8_t>& payload)
+{
+  Writer header;
+  header.put<uint32_t>(magic);
+  header.put<uint32_t>(type);
+  header.put<uint32_t>(payload.size());
+
+  return sendAll(socket, header.bytes.data(), header.bytes.size())
+      && sendAll(socket, payload.data(), payload.size());
+}
+
+bool Protocol::receive(int socket, Type& type, std::vector<uint8_t>& payload)
+{
+  std::vector<uint8_t> bytes(12);
+  if (!receiveAll(socket, bytes.data(), bytes.size())) return false;
+
+  Reader header(bytes);
+  if (header.get<uint32_t>() != magic) return false;
+  type = (Type) header.get<uint32_t>();
+
+  uint32_t size = header.get<uint32_t>();
+  if (size > (1 << 20)) return false;
+
+  payload.resize(size);
+  return receiveAll(socket, payload.data(), size);
+}
+
+
+// CACHE DEFINITIONS
+
+std::unique_ptr<Design> DesignCache::acquire(const std::string& name)
+{
+  {
+    std::lock_guard<std::mutex> lk(_lock);
+
+    for (auto e = _entries.begin(); e != _entries.end(); ++e)
+    {
+      if (e->first != name) continue;
+
+      auto d = std::move(e->second);
+      _entries.erase(e);
+      ++_hits;
+      return d;
+    }
+
+    ++_misses;
+  }
+
+  // Construct outside the lock, it can take a while
+  return _registry.create(name);
+}
+
+void DesignCache::release(const std::string& name, std::unique_ptr<Design> d)
+{
+  std::lock_guard<std::mutex> lk(_lock);
+
+  _entries.emplace_front(name, std::move(d));
+
+  while ((int) _entries.size() > _capacity)
+  {
+    _entries.pop_back();
+    ++_evictions;
+  }
+}
+
+
+// SERVER DEFINITIONS
+
+sockaddr_un socketAddress(const std::string& path)
+{
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+
+  if (path.size() >= sizeof(address.sun_path))
+  {
+    throw std::invalid_argument("Socket path too long: " + path);
+  }
+
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  return address;
+}
+
+Server::Server(const std::string& path, int cacheCapacity) :
+  _path(path), _cache(cacheCapacity), _stopping(false), _jobs(0)
+{
+  sockaddr_un address = socketAddress(path);
+
+  _listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (_listener < 0) throw std::runtime_error("socket failed");
+
+  unlink(path.c_str());
+  if (bind(_listener, (sockaddr*) &address, sizeof(address)) != 0
+      || listen(_listener, 64) != 0)
+  {
+    close(_listener);
+    throw std::runtime_error("Can't listen on " + path);
+  }
+}
+
+Server::~Server()
+{
+  stop();
+
+  // Join outside the lock, handlers take it on their way out
+  std::map<uint64_t, Connection> connections;
+  {
+    std::lock_guard<std::mutex> lk(_lock);
+    connections.swap(_connections);
+  }
+  for (auto& c : connections) c.second.thread.join();
+
+  close(_listener);
+  unlink(_path.c_str());
+}
+
+void Server::serve()
+{
+  while (!_stopping)
+  {
+    int client = accept(_listener, nullptr, nullptr);
+    if (client < 0) continue;
+
+    std::lock_guard<std::mutex> lk(_lock);
+    if (_stopping)
+    {
+      close(client);
+      break;
+    }
+
+    reap();
+
+    uint64_t id = _nextConnection++;
+    _connections[id] = {std::thread(&Server::handle, this, id, client), client};
+  }
+}
+
+void Server::reap()
+{
+  // A finished handler has already let go of the lock we hold, so
+  // all that's left of it is returning
+  for (auto id : _finished)
+  {
+    auto c = _connections.find(id);
+    if (c == _connections.end()) continue;
+    c->second.thread.join();
+    _connections.erase(c);
+  }
+  _finished.clear();
+}
+
+void Server::stop()
+{
+  std::lock_guard<std::mutex> lk(_lock);
+  _stopping = true;
+
+  // Wake up accept() and every connection blocked in recv()
+  ::shutdown(_listener, SHUT_RDWR);
+  for (auto& c : _connections)
+  {
+    if (c.second.socket >= 0) ::shutdown(c.second.socket, SHUT_RDWR);
+  }
+}
+
+std::vector<uint8_t> Server::run(Protocol::Reader& in)
+{
+  Job job;
+  job.design = in.string();
+  job.seed = in.get<uint64_t>();
+  job.cycles = in.get<uint64_t>();
+
+  job.controls.resize(in.get<uint16_t>());
+  for (auto& c : job.controls) c = in.get<int8_t>();
+
+  job.observe.resize(in.get<uint16_t>());
+  for (auto& o : job.observe) o = in.get<uint16_t>();
+
+  auto d = _cache.acquire(job.design);
+  Result r = SweepRunner::run(*d, job);
+  _cache.release(job.design, std::move(d));
+  ++_jobs;
+
+  Protocol::Writer out;
+  out.put<uint64_t>(r.digest);
+  out.put<uint64_t>(r.cycles);
+  out.put<double>(r.seconds);
+  out.put<uint16_t>(r.outputs.size());
+  for (auto o : r.outputs) out.put<uint64_t>(o);
+  return out.bytes;
+}
+
+void Server::handle(uint64_t id, int socket)
+{
+  Protocol::Type type;
+  std::vector<uint8_t> payload;
+
+  while (Protocol::receive(socket, type, payload))
+  {
+    Protocol::Reader in(payload);
+    Protocol::Writer out;
+
+    try
+    {
+      if (type == Protocol::Run)
+      {
+        Protocol::send(socket, Protocol::Result, run(in));
+      }
+      else if (type == Protocol::Stats)
+      {
+        out.put<uint64_t>(_jobs);
+        out.put<uint64_t>(_cache.hits());
+        out.put<uint64_t>(_cache.misses());
+        out.put<uint64_t>(_cache.evictions());
+        Protocol::send(socket, Protocol::Stats, out.bytes);
+      }
+      else if (type == Protocol::Shutdown)
+      {
+        Protocol::send(socket, Protocol::Shutdown, {});
+        stop();
+      }
+      else
+      {
+        throw std::runtime_error("Unknown request type");
+      }
+    }
+    catch (const std::exception& e)
+    {
+      out.bytes.clear();
+      out.put(std::string(e.what()));
+      Protocol::send(socket, Protocol::Error, out.bytes);
+    }
+  }
+
+  std::lock_guard<std::mutex> lk(_lock);
+  auto c = _connections.find(id);
+  if (c != _connections.end()) c->second.socket = -1;
+  _finished.push_back(id);
+  close(socket);
+}
+
+
+// CLIENT DEFINITIONS
+
+Client::Client(const std::string& path)
+{
+  sockaddr_un address = socketAddress(path);
+
+  _socket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (_socket < 0) throw std::runtime_error("socket failed");
+
+  if (connect(_socket, (sockaddr*) &address, sizeof(address)) != 0)
+  {
+    close(_socket);
+    throw std::runtime_error("Can't connect to " + path);
+  }
+}
+
+Client::~Client()
+{
+  close(_socket);
+}
+
+std::vector<uint8_t> Client::request(Protocol::Type type,
+                                     const std::vector<uint8_t>& payload,
+                                     Protocol::Type expected)
+{
+  Protocol::Type reply;
+  std::vector<uint8_t> bytes;
+
+  if (!Protocol::send(_socket, type, payload)
+      || !Protocol::receive(_socket, reply, bytes))
+  {
+    throw std::runtime_error("Lost connection to server");
+  }
+
+  if (reply == Protocol::Error)
+  {
+    Protocol::Reader in(bytes);
+    throw std::runtime_error(in.string());
+  }
+
+  if (reply != expected) throw std::runtime_error("Unexpected reply");
+  return bytes;
+}
+
+Result Client::run(const Job& job)
+{
+  Protocol::Writer out;
+  out.put(job.design);
+  out.put<uint64_t>(job.seed);
+  out.put<uint64_t>(job.cycles);
+  out.put<uint16_t>(job.controls.size());
+  for (auto c : job.controls) out.put<int8_t>(c);
+  out.put<uint16_t>(job.observe.size());
+  for (auto o : job.observe) out.put<uint16_t>(o);
+
+  auto bytes = request(Protocol::Run, out.bytes, Protocol::Result);
+  Protocol::Reader in(bytes);
+
+  Result r = {0, job.design, job.seed, 0, {}, 0, 0};
+  r.digest = in.get<uint64_t>();
+  r.cycles = in.get<uint64_t>();
+  r.seconds = in.get<double>();
+  r.outputs.resize(in.get<uint16_t>());
+  for (auto& o : r.outputs) o = in.get<uint64_t>();
+  return r;
+}
+
+Client::Stats Client::stats()
+{
+  auto bytes = request(Protocol::Stats, {}, Protocol::Stats);
+  Protocol::Reader in(bytes);
+
+  Stats s;
+  s.jobs = in.get<uint64_t>();
+  s.hits = in.get<uint64_t>();
+  s.misses = in.get<uint64_t>();
+  s.evictions = in.get<uint64_t>();
+  return s;
+}
+
+void Client::shutdown()
+{
+  request(Protocol::Shutdown, {}, Protocol::Shutdown);
+}
+
+
+// SERVER TESTS
+
+void testDesignCache()
+{
+  DesignCache c(2);
+
+  auto a = c.acquire("ALU<8>");
+  auto b = c.acquire("ALU<8>"); // Checked out, so a second instance
+  assert(c.misses() == 2);
+
+  c.release("ALU<8>", std::move(a));
+  c.release("ALU<8>", std::move(b));
+  c.acquire("ALU<8>");
+  assert(c.hits() == 1);
+
+  // Least recently used goes first
+  c.release("CA<8>", c.acquire("CA<8>"));
+  c.release("CA<16>", c.acquire("CA<16>"));
+  assert(c.evictions() == 1);
+  c.release("CA<8>", c.acquire("CA<8>"));
+  assert(c.hits() == 2);
+}
+
+void testServer()
+{
+  std::string path = "/tmp/loob-test-" + std::to_string(getpid()) + ".sock";
+  Server server(path, 4);
+  std::thread t(&Server::serve, &server);
+
+  {
+    Client client(path);
+
+    Job job;
+    job.design = "ALU<16>";
+    job.seed = 42;
+    job.cycles = 20;
+    job.controls = {0, 1};
+
+    // Same answer as running the job locally
+    auto local = Registry::instance().create(job.design);
+    Result expected = SweepRunner::run(*local, job);
+
+    for (auto i = 0; i < 3; ++i)
+    {
+      Result r = client.run(job);
+      assert(r.digest == expected.digest);
+      assert(r.outputs == expected.outputs);
+    }
+
+    // Built once, then warm
+    Client::Stats s = client.stats();
+    assert(s.jobs == 3);
+    assert(s.misses == 1);
+    assert(s.hits == 2);
+
+    // Errors come back as exceptions and the connection survives
+    job.design = "ALU<17>";
+    bool thrown = false;
+    try
+    {
+      client.run(job);
+    }
+    catch (const std::runtime_error&)
+    {
+      thrown = true;
+    }
+    assert(thrown);
+
+    // Several clients at once
+    std::vector<std::thread> clients;
+    for (auto k = 0; k < 4; ++k)
+    {
+      clients.emplace_back([&path, k]
+      {
+        Client c(path);
+        Job j;
+        j.design = "RAM<4,8>";
+        j.seed = k;
+        j.cycles = 4;
+        j.controls = {-1, -1, -1, -1};
+        for (auto i = 0; i < 5; ++i) c.run(j);
+      });
+    }
+    for (auto& c : clients) c.join();
+    assert(client.stats().jobs == 23);
+
+    // Closed connections don't pile up. Each accept joins whatever
+    // has finished, so only this client and the newest can be left.
+    for (auto k = 0; k < 50; ++k)
+    {
+      Client c(path);
+      c.stats();
+    }
+    for (auto tries = 0; tries < 100 && server.connections() > 2; ++tries)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      Client c(path);
+      c.stats();
+    }
+    assert(server.connections() <= 2);
+
+    client.shutdown();
+  }
+
+  t.join();
+}
+
+
+// Run all server tests
+void testServers()
+{
+  testDesignCache();
+  testServer();
+}
+
+
+#endif // SERVER_HPP
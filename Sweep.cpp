@@ -0,0 +1,95 @@
+#include <assert.h>
+#include <fstream>
+#include <iostream>
+
+#include "Sweep.hpp"
+
+/*
+
+             --loob--
+
+     Parameter sweep job runner
+
+*/
+
+
+void usage()
+{
+  std::cerr << "usage: loob-sweep [--binary] [--threads N] [--out FILE] JOBS\n"
+            << "       loob-sweep --list\n\n"
+            << "JOBS has one group of jobs per line, e.g.\n"
+            << "  design=ALU<16> seeds=1-100 cycles=1000 controls=0,1\n"
+            << "Use - to read jobs from standard input." << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  bool binary = false;
+  int threads = std::thread::hardware_concurrency();
+  std::string jobsPath, outPath;
+
+  for (auto i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+
+    if (arg == "--list")
+    {
+      for (auto& name : Registry::instance().names()) std::cout << name << "\n";
+      return 0;
+    }
+    else if (arg == "--binary") binary = true;
+    else if (arg == "--threads" && i + 1 < argc) threads = std::stoi(argv[++i]);
+    else if (arg == "--out" && i + 1 < argc) outPath = argv[++i];
+    else if (jobsPath.empty() && (arg == "-" || arg.at(0) != '-')) jobsPath = arg;
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+
+  if (jobsPath.empty())
+  {
+    usage();
+    return 2;
+  }
+
+  try
+  {
+    std::ifstream jobFile;
+    if (jobsPath != "-")
+    {
+      jobFile.open(jobsPath);
+      if (!jobFile) throw std::runtime_error("Can't open " + jobsPath);
+    }
+
+    auto jobs = parseJobs(jobsPath == "-" ? std::cin : jobFile);
+
+    std::ofstream outFile;
+    if (!outPath.empty())
+    {
+      outFile.open(outPath, std::ios::binary);
+      if (!outFile) throw std::runtime_error("Can't open " + outPath);
+    }
+    std::ostream& out = outPath.empty() ? std::cout : outFile;
+
+    std::unique_ptr<ResultSink> sink;
+    if (binary) sink = std::make_unique<BinarySink>(out);
+    else sink = std::make_unique<CsvSink>(out);
+
+    ThreadPool::instance().resize(threads);
+    SweepRunner runner;
+    runner.run(jobs, *sink);
+
+    std::cerr << jobs.size() << " jobs, " << runner.constructed()
+              << " designs constructed" << std::endl;
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "loob-sweep: " << e.what() << std::endl;
+    return 1;
+  }
+}
+
+
+// END
@@ -0,0 +1,733 @@
+#ifndef SWEEP_HPP
+#define SWEEP_HPP
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "ALU.hpp"
+#include "CA.hpp"
+#include "Memory.hpp"
+#include "Multiply.hpp"
+
+
+// A component wrapped so a sweep can drive it without knowing its type.
+// Words go in and out as integers, truncated to 64 bits.
+
+class Design
+{
+  public:
+    Design(int inputs, int controls) : _inputs(inputs), _controls(controls) {}
+    virtual ~Design() {}
+
+    int inputs() const { return _inputs; }
+    int controls() const { return _controls; }
+    virtual int outputs() const = 0;
+
+    virtual void input(int channel, uint64_t value) = 0;
+    virtual void control(int channel, Signal s) = 0;
+    virtual void process() = 0;
+    virtual uint64_t output(int channel) = 0;
+
+    // Return to the power-on state
+    virtual void reset() = 0;
+
+  private:
+    int _inputs, _controls;
+};
+
+
+// Adapter from a WordComponent<N> to a Design.
+// Stateful components keep a pristine copy to reset from. Copying
+// over an existing component reuses all of its storage, which is far
+// cheaper than constructing a new one.
+
+template <typename T, int N>
+class ComponentDesign : public Design
+{
+  public:
+    ComponentDesign(int inputs, int controls, bool stateful) :
+      Design(inputs, controls),
+      _prototype(stateful ? std::make_unique<T>() : nullptr),
+      _component(std::make_unique<T>()) {}
+
+    void input(int channel, uint64_t value)
+    {
+      _component->input(channel, Word<N>::fromInt(value));
+    }
+
+    void control(int channel, Signal s)
+    {
+      if constexpr (std::is_base_of<WordControlComponent<N>, T>::value)
+      {
+        _component->control(channel, s);
+      }
+      else
+      {
+        throw std::out_of_range("Design has no control inputs");
+      }
+    }
+
+    void process()
+    {
+      _component->process();
+    }
+
+    uint64_t output(int channel)
+    {
+      return _component->output(channel).toInt();
+    }
+
+    int outputs() const
+    {
+      return _component->outputs();
+    }
+
+    void reset()
+    {
+      if (_prototype) *_component = *_prototype;
+    }
+
+  private:
+    std::unique_ptr<T> _prototype;
+    std::unique_ptr<T> _component;
+};
+
+
+// Named designs with their template parameters baked in,
+// e.g. "ALU<16>" or "RAM<8,32>".
+
+class Registry
+{
+  public:
+    using Factory = std::function<std::unique_ptr<Design>()>;
+
+    void add(const std::string& name, Factory factory)
+    {
+      _factories[name] = factory;
+    }
+
+    // Convenience for wrapping a word component
+    template <typename T, int N>
+    void add(const std::string& name, int inputs, int controls, bool stateful)
+    {
+      add(name, [=]
+      {
+        return std::make_unique<ComponentDesign<T, N>>(inputs, controls, stateful);
+      });
+    }
+
+    bool contains(const std::string& name) const
+    {
+      return _factories.count(name);
+    }
+
+    std::unique_ptr<Design> create(const std::string& name) const;
+
+    std::vector<std::string> names() const;
+
+    // Registry of the library's own components
+    static const Registry& instance();
+
+  private:
+    template <int N>
+    void addWordSize();
+
+    template <int M>
+    void addRAM();
+
+    std::map<std::string, Factory> _factories;
+};
+
+
+// One simulation: a design driven by seeded random stimulus.
+// Controls holds a fixed value per control input, or -1 for random.
+// Missing controls are held at 0.
+
+struct Job
+{
+  std::string design;
+  uint64_t seed = 0;
+  uint64_t cycles = 1;
+  std::vector<int> controls;
+  std::vector<int> observe = {0};
+};
+
+
+// Outcome of a job: the observed outputs after the last cycle, and an
+// FNV-1a digest of the observed outputs over every cycle.
+
+struct Result
+{
+  int job;
+  std::string design;
+  uint64_t seed;
+  uint64_t cycles;
+  std::vector<uint64_t> outputs;
+  uint64_t digest;
+  double seconds;
+};
+
+
+// Results are streamed to a sink as jobs finish, in no particular order
+
+class ResultSink
+{
+  public:
+    virtual ~ResultSink() {}
+    virtual void write(const Result& r) = 0;
+};
+
+class CsvSink : public ResultSink
+{
+  public:
+    CsvSink(std::ostream& out);
+    void write(const Result& r);
+
+  private:
+    std::ostream& _out;
+};
+
+// Fixed-layout little-endian records after an 8-byte "LOOBSWP1" magic:
+// u32 job, u64 seed, u64 cycles, u64 digest, f64 seconds,
+// u32 output count, then that many u64 outputs.
+// The design name is left out, it's recoverable from the job list.
+
+class BinarySink : public ResultSink
+{
+  public:
+    BinarySink(std::ostream& out);
+    void write(const Result& r);
+
+  private:
+    template <typename T>
+    void put(T value);
+
+    std::ostream& _out;
+};
+
+
+// Spreads jobs across the work-stealing pool. A job checks a design
+// out of a free list and returns it when it's done, so the cost of
+// construction is paid once per design per job running at the same
+// time. Designs aren't tied to threads: components run their own
+// parallel loops on the pool, and a thread may run more than one job.
+
+class SweepRunner
+{
+  public:
+    SweepRunner(const Registry& registry = Registry::instance(),
+                ThreadPool& pool = ThreadPool::instance()) :
+      _registry(registry), _pool(pool) {}
+
+    void run(const std::vector<Job>& jobs, ResultSink& sink);
+
+    // Run a single job on a design
+    static Result run(Design& d, const Job& job);
+
+    // Designs constructed so far, across all workers
+    int constructed() const
+    {
+      return _constructed;
+    }
+
+  private:
+    std::unique_ptr<Design> acquire(const std::string& name);
+    void release(const std::string& name, std::unique_ptr<Design> d);
+
+    const Registry& _registry;
+    ThreadPool& _pool;
+
+    // Designs not in use, by name
+    std::map<std::string, std::vector<std::unique_ptr<Design>>> _free;
+    std::mutex _lock;
+    int _constructed = 0;
+};
+
+
+// Parse a job description, one line per group of jobs:
+//
+//   design=ALU<16> seeds=1-100 cycles=1000 controls=0,1 observe=0
+//
+// seeds is a single seed or an inclusive range, one job per seed.
+// "r" in controls means a random bit each cycle. Blank lines and
+// lines starting with # are ignored.
+
+std::vector<Job> parseJobs(std::istream& in);
+
+
+// REGISTRY DEFINITIONS
+
+template <int N>
+void Registry::addWordSize()
+{
+  std::string n = std::to_string(N);
+
+  add<WordAdder<N>, N>("WordAdder<" + n + ">", 2, 0, false);
+  add<WordAdder<N, CarrySelect>, N>("WordAdder<" + n + ",CarrySelect>", 2, 0, false);
+  add<WordAdder<N, CarryLookahead>, N>("WordAdder<" + n + ",CarryLookahead>", 2, 0, false);
+  add<WordAdder<N, KoggeStone>, N>("WordAdder<" + n + ",KoggeStone>", 2, 0, false);
+  add<WordAdder<N, BrentKung>, N>("WordAdder<" + n + ",BrentKung>", 2, 0, false);
+  add<WordMultiplier<N>, N>("WordMultiplier<" + n + ">", 2, 0, false);
+  add<WordMultiplier<N, Wallace>, N>("WordMultiplier<" + n + ",Wallace>", 2, 0, false);
+  add<WordMultiplier<N, Dadda>, N>("WordMultiplier<" + n + ",Dadda>", 2, 0, false);
+  add<WideMultiplier<N>, N>("WideMultiplier<" + n + ">", 2, 0, false);
+  add<BoothMultiplier<N>, N>("BoothMultiplier<" + n + ">", 2, 0, false);
+  add<ALU<N>, N>("ALU<" + n + ">", 2, 2, false);
+  add<CA<N>, N>("CA<" + n + ">", 0, 9, true);
+}
+
+template <int M>
+void Registry::addRAM()
+{
+  std::string m = std::to_string(M);
+
+  add<RAM<M, 8>, 8>("RAM<" + m + ",8>", 1, M, true);
+  add<RAM<M, 16>, 16>("RAM<" + m + ",16>", 1, M, true);
+  add<RAM<M, 32>, 32>("RAM<" + m + ",32>", 1, M, true);
+}
+
+const Registry& Registry::instance()
+{
+  static const Registry registry = []
+  {
+    Registry r;
+    r.addWordSize<8>();
+    r.addWordSize<16>();
+    r.addWordSize<32>();
+    r.addWordSize<64>();
+    r.addRAM<4>();
+    r.addRAM<6>();
+    r.addRAM<8>();
+    r.addRAM<10>();
+    return r;
+  }();
+
+  return registry;
+}
+
+std::unique_ptr<Design> Registry::create(const std::string& name) const
+{
+  auto f = _factories.find(name);
+  if (f == _factories.end())
+  {
+    throw std::out_of_range("Unknown design: " + name);
+  }
+  return f->second();
+}
+
+std::vector<std::string> Registry::names() const
+{
+  std::vector<std::string> v;
+  for (auto& f : _factories) v.push_back(f.first);
+  return v;
+}
+
+
+// SINK DEFINITIONS
+
+CsvSink::CsvSink(std::ostream& out) : _out(out)
+{
+  _out << "job,design,seed,cycles,digest,seconds,outputs" << std::endl;
+}
+
+void CsvSink::write(const Result& r)
+{
+  _out << r.job << ",\"" << r.design << "\"," << r.seed << "," << r.cycles
+       << "," << r.digest << "," << r.seconds;
+  for (auto o : r.outputs) _out << "," << o;
+  _out << "\n";
+}
+
+BinarySink::BinarySink(std::ostream& out) : _out(out)
+{
+  _out.write("LOOBSWP1", 8);
+}
+
+template <typename T>
+void BinarySink::put(T value)
+{
+  // Serialize byte by byte so the file is little-endian everywhere
+  uint64_t bits = 0;
+  memcpy(&bits, &value, sizeof(T));
+  for (size_t i = 0; i < sizeof(T); ++i) _out.put((bits >> (8*i)) & 0xFF);
+}
+
+void BinarySink::write(const Result& r)
+{
+  put<uint32_t>(r.job);
+  put<uint64_t>(r.seed);
+  put<uint64_t>(r.cycles);
+  put<uint64_t>(r.digest);
+  put<double>(r.seconds);
+  put<uint32_t>(r.outputs.size());
+  for (auto o : r.outputs) put<uint64_t>(o);
+}
+
+
+// RUNNER DEFINITIONS
+
+Result SweepRunner::run(Design& d, const Job& job)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  std::mt19937_64 rng(job.seed);
+  uint64_t digest = 14695981039346656037ull;
+  d.reset();
+
+  for (uint64_t c = 0; c < job.cycles; ++c)
+  {
+    for (auto i = 0; i < d.inputs(); ++i) d.input(i, rng());
+
+    for (auto i = 0; i < d.controls(); ++i)
+    {
+      int s = i < (int) job.controls.size() ? job.controls.at(i) : 0;
+      d.control(i, s < 0 ? rng() & 1 : s);
+    }
+
+    d.process();
+
+    for (auto channel : job.observe)
+    {
+      digest = (digest ^ d.output(channel)) * 1099511628211ull;
+    }
+  }
+
+  std::vector<uint64_t> outputs;
+  for (auto channel : job.observe) outputs.push_back(d.output(channel));
+
+  std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+  return {0, job.design, job.seed, job.cycles, outputs, digest, t.count()};
+}
+
+void SweepRunner::run(const std::vector<Job>& jobs, ResultSink& sink)
+{
+  // Fail fast on typos rather than halfway through a sweep. Checking
+  // outputs needs a design, which goes in the free list for later.
+  std::map<std::string, int> outputs;
+  for (auto i = 0; i < (int) jobs.size(); ++i)
+  {
+    const Job& j = jobs.at(i);
+
+    if (!outputs.count(j.design))
+    {
+      if (!_registry.contains(j.design))
+      {
+        throw std::out_of_range("Unknown design: " + j.design);
+      }
+
+      auto d = acquire(j.design);
+      outputs[j.design] = d->outputs();
+      release(j.design, std::move(d));
+    }
+
+    for (auto channel : j.observe)
+    {
+      if (channel >= 0 && channel < outputs.at(j.design)) continue;
+      throw std::out_of_range("Job " + std::to_string(i) + ": " + j.design
+                              + " has " + std::to_string(outputs.at(j.design))
+                              + " outputs, can't observe " + std::to_string(channel));
+    }
+  }
+
+  _pool.parallelFor(jobs.size(), [&](int begin, int end)
+  {
+    for (auto i = begin; i < end; ++i)
+    {
+      const Job& job = jobs.at(i);
+      auto d = acquire(job.design);
+
+      Result r = run(*d, job);
+      r.job = i;
+      release(job.design, std::move(d));
+
+      std::lock_guard<std::mutex> lk(_lock);
+      sink.write(r);
+    }
+  });
+}
+
+std::unique_ptr<Design> SweepRunner::acquire(const std::string& name)
+{
+  {
+    std::lock_guard<std::mutex> lk(_lock);
+    auto& free = _free[name];
+    if (!free.empty())
+    {
+      auto d = std::move(free.back());
+      free.pop_back();
+      return d;
+    }
+    ++_constructed;
+  }
+
+  // Build outside the lock, big designs take a while
+  return _registry.create(name);
+}
+
+void SweepRunner::release(const std::string& name, std::unique_ptr<Design> d)
+{
+  std::lock_guard<std::mutex> lk(_lock);
+  _free[name].push_back(std::move(d));
+}
+
+
+// PARSER DEFINITIONS
+
+std::vector<int> parseList(const std::string& s)
+{
+  std::vector<int> v;
+  std::stringstream ss(s);
+  std::string item;
+
+  while (std::getline(ss, item, ','))
+  {
+    v.push_back(item == "r" ? -1 : std::stoi(item));
+  }
+
+  return v;
+}
+
+std::vector<Job> parseJobs(std::istream& in)
+{
+  std::vector<Job> jobs;
+  std::string line;
+  int number = 0;
+
+  while (std::getline(in, line))
+  {
+    ++number;
+    std::stringstream ss(line);
+    std::string field;
+
+    Job job;
+    uint64_t first = 0, last = 0;
+
+    while (ss >> field)
+    {
+      if (field.at(0) == '#') break;
+
+      auto eq = field.find('=');
+      if (eq == std::string::npos)
+      {
+        throw std::invalid_argument("Line " + std::to_string(number)
+                                    + ": expected key=value, got " + field);
+      }
+
+      std::string key = field.substr(0, eq);
+      std::string value = field.substr(eq + 1);
+
+      if (key == "design") job.design = value;
+      else if (key == "cycles") job.cycles = std::stoull(value);
+      else if (key == "controls") job.controls = parseList(value);
+      else if (key == "observe") job.observe = parseList(value);
+      else if (key == "seeds")
+      {
+        auto dash = value.find('-');
+        first = std::stoull(value.substr(0, dash));
+        last = dash == std::string::npos ? first : std::stoull(value.substr(dash + 1));
+
+        if (last < first)
+        {
+          throw std::invalid_argument("Line " + std::to_string(number)
+                                      + ": seed range " + value + " runs backwards");
+        }
+      }
+      else
+      {
+        throw std::invalid_argument("Line " + std::to_string(number)
+                                    + ": unknown key " + key);
+      }
+    }
+
+    if (job.design.empty()) continue;
+
+    // Stop on the last seed rather than past it, which could wrap
+    for (auto seed = first; ; ++seed)
+    {
+      job.seed = seed;
+      jobs.push_back(job);
+      if (seed == last) break;
+    }
+  }
+
+  return jobs;
+}
+
+
+// SWEEP TESTS
+
+// Keeps results in job order for comparison
+class VectorSink : public ResultSink
+{
+  public:
+    void write(const Result& r)
+    {
+      if ((int) results.size() <= r.job) results.resize(r.job + 1);
+      results.at(r.job) = r;
+    }
+
+    std::vector<Result> results;
+};
+
+void testParseJobs()
+{
+  std::stringstream in(
+    "# Comment line\n"
+    "design=ALU<8> seeds=3-5 cycles=10 controls=0,1\n"
+    "\n"
+    "design=RAM<4,8> seeds=7 cycles=2 controls=r,r,r,r observe=0\n");
+
+  auto jobs = parseJobs(in);
+  assert(jobs.size() == 4);
+  assert(jobs.at(0).design == "ALU<8>");
+  assert(jobs.at(0).seed == 3);
+  assert(jobs.at(2).seed == 5);
+  assert(jobs.at(2).cycles == 10);
+  assert(jobs.at(1).controls == std::vector<int>({0, 1}));
+  assert(jobs.at(3).controls == std::vector<int>({-1, -1, -1, -1}));
+  assert(jobs.at(3).seed == 7);
+
+  // Ranges can end at the largest seed, but can't run backwards
+  std::stringstream top("design=ALU<8> seeds=18446744073709551614-18446744073709551615\n");
+  assert(parseJobs(top).size() == 2);
+
+  std::stringstream backwards("\ndesign=ALU<8> seeds=5-3\n");
+  bool thrown = false;
+  try
+  {
+    parseJobs(backwards);
+  }
+  catch (const std::invalid_argument& e)
+  {
+    thrown = std::string(e.what()).find("Line 2") == 0;
+  }
+  assert(thrown);
+}
+
+void testSweepRunner()
+{
+  // Sum of the last random operands, checked against native arithmetic
+  Job add;
+  add.design = "ALU<8>";
+  add.cycles = 5;
+  add.controls = {0, 0};
+
+  for (uint64_t seed = 0; seed < 4; ++seed)
+  {
+    add.seed = seed;
+    auto d = Registry::instance().create(add.design);
+    Result r = SweepRunner::run(*d, add);
+
+    std::mt19937_64 rng(seed);
+    uint64_t x = 0, y = 0;
+    for (auto c = 0; c < 5; ++c) x = rng(), y = rng();
+    assert(r.outputs.at(0) == ((x + y) & 0xFF));
+  }
+
+  // Same results on one thread and many, and reused designs are reset
+  std::vector<Job> jobs;
+  for (uint64_t seed = 0; seed < 24; ++seed)
+  {
+    Job j;
+    j.design = seed % 2 ? "RAM<4,8>" : "CA<16>";
+    j.seed = seed % 3;
+    j.cycles = 8;
+    j.controls = seed % 2 ? std::vector<int>({-1, -1, -1, -1})
+                          : std::vector<int>({0, 1, 1, 1, 1, 0, 0, 0, 1});
+    jobs.push_back(j);
+  }
+
+  ThreadPool serialPool(1), parallelPool(4);
+  SweepRunner serial(Registry::instance(), serialPool);
+  SweepRunner parallel(Registry::instance(), parallelPool);
+  VectorSink a, b;
+
+  serial.run(jobs, a);
+  parallel.run(jobs, b);
+
+  assert(serial.constructed() == 2);
+  for (auto i = 0; i < (int) jobs.size(); ++i)
+  {
+    assert(a.results.at(i).digest == b.results.at(i).digest);
+    assert(a.results.at(i).outputs == b.results.at(i).outputs);
+  }
+
+  // Observing an output that isn't there fails before anything runs
+  Job missing = jobs.at(0);
+  missing.observe = {7};
+  bool thrown = false;
+  try
+  {
+    serial.run({jobs.at(1), missing}, a);
+  }
+  catch (const std::out_of_range& e)
+  {
+    thrown = std::string(e.what()).find("Job 1: CA<16>") == 0;
+  }
+  assert(thrown);
+
+  // Jobs with the same seed see the same stimulus, so they must agree
+  assert(a.results.at(1).digest == a.results.at(7).digest);
+  assert(a.results.at(0).digest == a.results.at(6).digest);
+
+  // Same again on the shared pool, with designs whose process() runs
+  // its own parallel loops on that pool while the sweep is using it
+  std::vector<Job> nested;
+  const std::vector<std::string> designs = {"ALU<64>", "WordMultiplier<64,Dadda>",
+                                            "BoothMultiplier<32>", "WideMultiplier<32>"};
+  for (uint64_t seed = 0; seed < 32; ++seed)
+  {
+    Job j;
+    j.design = designs.at(seed % designs.size());
+    j.seed = seed;
+    j.cycles = 3;
+    j.controls = {-1, -1};
+    nested.push_back(j);
+  }
+
+  auto& pool = ThreadPool::instance();
+  std::vector<VectorSink> sinks(2);
+  for (auto t : {1, 8})
+  {
+    pool.resize(t);
+    SweepRunner runner;
+    runner.run(nested, sinks.at(t == 1 ? 0 : 1));
+  }
+  pool.resize(std::thread::hardware_concurrency());
+
+  for (auto i = 0; i < (int) nested.size(); ++i)
+  {
+    assert(sinks.at(0).results.at(i).digest == sinks.at(1).results.at(i).digest);
+  }
+
+  // CSV has a header plus a row per job
+  std::stringstream csv;
+  CsvSink sink(csv);
+  serial.run(jobs, sink);
+  std::string line;
+  int lines = 0;
+  while (std::getline(csv, line)) ++lines;
+  assert(lines == (int) jobs.size() + 1);
+}
+
+
+// Run all sweep tests
+void testSweep()
+{
+  testParseJobs();
+  testSweepRunner();
+}
+
+
+#endif // SWEEP_HPP
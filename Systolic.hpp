@@ -0,0 +1,333 @@
+#ifndef SYSTOLIC_HPP
+#define SYSTOLIC_HPP
+
+#include <stdexcept>
+#include <vector>
+
+#include "Clock.hpp"
+#include "Multiply.hpp"
+
+
+// Output-stationary systolic array for matrix multiply.
+// A Rows x Cols grid of processing elements, each a MAC holding one
+// element of the result. Rows of A come in from the left, one word per
+// row per cycle on inputs 0..Rows-1, and columns of B from the top on
+// inputs Rows..Rows+Cols-1. Each element registers what it was given
+// and passes it right or down the next cycle, so both arrive skewed by
+// one cycle per element. Control i marks the first word of a new tile
+// on row i; the mark travels with it and restarts each accumulator.
+//
+// process() is one clock cycle. Every element reads its neighbours'
+// registers and runs its MAC, then every register latches together.
+// In fast mode the same cycle runs on integers, which needs AccBits
+// of 64 or less; switching modes carries the state across.
+
+template <int Rows, int Cols, int N, int AccBits = 2*N + 8>
+class SystolicArray : public WordControlComponent<N>
+{
+  public:
+    SystolicArray() :
+      WordControlComponent<N>(Rows + Cols, Rows, 0),
+      _elements(Rows * Cols),
+      _state(Rows * Cols),
+      _next(Rows * Cols) {}
+
+    void process();
+
+    Word<AccBits> result(int row, int col);
+
+    bool fast() const
+    {
+      return _fast;
+    }
+
+    void fast(bool on);
+
+    // Stream a Rows x K tile of A and a K x Cols tile of B through,
+    // skewed and padded with zeros, and return A B by row
+    std::vector<std::vector<uint64_t>> multiply(const std::vector<std::vector<uint64_t>>& a,
+                                                const std::vector<std::vector<uint64_t>>& b);
+
+    // Cycles simulated so far
+    uint64_t cycles() const
+    {
+      return _cycles;
+    }
+
+  private:
+    struct Element
+    {
+      MAC<N, AccBits> mac;
+      Register<N> a, b;
+      Register<1> first;
+    };
+
+    struct State
+    {
+      uint64_t a = 0, b = 0, accumulator = 0;
+      Signal first = 0;
+    };
+
+    void processGates();
+    void processFast();
+
+    std::vector<Element> _elements;
+    std::vector<State> _state, _next;
+    bool _fast = false;
+    uint64_t _cycles = 0;
+};
+
+
+// PROCESS DEFINITIONS
+
+
+template <int Rows, int Cols, int N, int AccBits>
+void SystolicArray<Rows, Cols, N, AccBits>::process()
+{
+  if (_fast) processFast();
+  else processGates();
+  ++_cycles;
+}
+
+template <int Rows, int Cols, int N, int AccBits>
+void SystolicArray<Rows, Cols, N, AccBits>::processGates()
+{
+  auto& pool = ThreadPool::instance();
+
+  // Every element reads registers only, so any order will do
+  pool.parallelFor(Rows * Cols, [this](int begin, int end)
+  {
+    for (auto p = begin; p < end; ++p)
+    {
+      int i = p / Cols, j = p % Cols;
+      Element& e = _elements.at(p);
+
+      Word<N> a = j == 0 ? this->_inputs.at(i) : _elements.at(p - 1).a.q();
+      Word<N> b = i == 0 ? this->_inputs.at(Rows + j) : _elements.at(p - Cols).b.q();
+      Signal first = j == 0 ? this->_controls.at(i) : _elements.at(p - 1).first.q().bit(0);
+
+      e.mac.input(0, a);
+      e.mac.input(1, b);
+      e.mac.control(0, 1);
+      e.mac.control(1, first);
+      e.mac.process();
+
+      e.a.d(a);
+      e.b.d(b);
+      e.first.d(Word<1>({first}));
+    }
+  }, 4);
+
+  pool.parallelFor(Rows * Cols, [this](int begin, int end)
+  {
+    for (auto p = begin; p < end; ++p)
+    {
+      Element& e = _elements.at(p);
+      e.a.commit();
+      e.b.commit();
+      e.first.commit();
+    }
+  }, 64);
+}
+
+template <int Rows, int Cols, int N, int AccBits>
+void SystolicArray<Rows, Cols, N, AccBits>::processFast()
+{
+  const uint64_t word = N >= 64 ? ~0ull : (1ull << N) - 1;
+  const uint64_t mask = AccBits >= 64 ? ~0ull : (1ull << AccBits) - 1;
+
+  for (auto p = 0; p < Rows * Cols; ++p)
+  {
+    int i = p / Cols, j = p % Cols;
+    const State& s = _state.at(p);
+    State& n = _next.at(p);
+
+    n.a = j == 0 ? this->_inputs.at(i).toInt() & word : _state.at(p - 1).a;
+    n.b = i == 0 ? this->_inputs.at(Rows + j).toInt() & word : _state.at(p - Cols).b;
+    n.first = j == 0 ? this->_controls.at(i) : _state.at(p - 1).first;
+    n.accumulator = ((n.first ? 0 : s.accumulator) + n.a * n.b) & mask;
+  }
+
+  _state.swap(_next);
+}
+
+template <int Rows, int Cols, int N, int AccBits>
+Word<AccBits> SystolicArray<Rows, Cols, N, AccBits>::result(int row, int col)
+{
+  int p = row * Cols + col;
+  if (_fast) return Word<AccBits>::fromInt(_state.at(p).accumulator);
+  return _elements.at(p).mac.accumulator();
+}
+
+template <int Rows, int Cols, int N, int AccBits>
+void SystolicArray<Rows, Cols, N, AccBits>::fast(bool on)
+{
+  if (on == _fast) return;
+  if (on && (AccBits > 64 || N > 32))
+  {
+    throw std::invalid_argument("Fast mode needs products and accumulators in 64 bits");
+  }
+
+  for (auto p = 0; p < Rows * Cols; ++p)
+  {
+    Element& e = _elements.at(p);
+    State& s = _state.at(p);
+
+    if (on)
+    {
+      s.a = e.a.q().toInt();
+      s.b = e.b.q().toInt();
+      s.first = e.first.q().bit(0);
+      s.accumulator = e.mac.accumulator().toInt();
+    }
+    else
+    {
+      e.a.d(Word<N>::fromInt(s.a));
+      e.a.commit();
+      e.b.d(Word<N>::fromInt(s.b));
+      e.b.commit();
+      e.first.d(Word<1>({s.first}));
+      e.first.commit();
+      e.mac.load(Word<AccBits>::fromInt(s.accumulator));
+    }
+  }
+
+  _fast = on;
+}
+
+template <int Rows, int Cols, int N, int AccBits>
+std::vector<std::vector<uint64_t>>
+SystolicArray<Rows, Cols, N, AccBits>::multiply(const std::vector<std::vector<uint64_t>>& a,
+                                               const std::vector<std::vector<uint64_t>>& b)
+{
+  int k = b.size();
+
+  // The last product reaches the far corner Rows + Cols - 2 cycles
+  // after the last word goes in
+  for (auto t = 0; t < k + Rows + Cols - 2; ++t)
+  {
+    for (auto i = 0; i < Rows; ++i)
+    {
+      int step = t - i;
+      bool live = step >= 0 && step < k;
+      this->input(i, Word<N>::fromInt(live ? a.at(i).at(step) : 0));
+      this->control(i, step == 0);
+    }
+
+    for (auto j = 0; j < Cols; ++j)
+    {
+      int step = t - j;
+      bool live = step >= 0 && step < k;
+      this->input(Rows + j, Word<N>::fromInt(live ? b.at(step).at(j) : 0));
+    }
+
+    process();
+  }
+
+  std::vector<std::vector<uint64_t>> c(Rows, std::vector<uint64_t>(Cols));
+  for (auto i = 0; i < Rows; ++i)
+  {
+    for (auto j = 0; j < Cols; ++j) c.at(i).at(j) = result(i, j).toInt();
+  }
+  return c;
+}
+
+
+// SYSTOLIC TESTS
+
+
+std::vector<std::vector<uint64_t>> randomMatrix(int rows, int cols, int bits)
+{
+  std::vector<std::vector<uint64_t>> m(rows, std::vector<uint64_t>(cols));
+  for (auto& row : m)
+  {
+    for (auto& x : row) x = rand() & ((1 << bits) - 1);
+  }
+  return m;
+}
+
+std::vector<std::vector<uint64_t>> matrixProduct(const std::vector<std::vector<uint64_t>>& a,
+                                                 const std::vector<std::vector<uint64_t>>& b,
+                                                 int bits)
+{
+  uint64_t mask = bits >= 64 ? ~0ull : (1ull << bits) - 1;
+  std::vector<std::vector<uint64_t>> c(a.size(), std::vector<uint64_t>(b.at(0).size(), 0));
+
+  for (size_t i = 0; i < a.size(); ++i)
+  {
+    for (size_t j = 0; j < b.at(0).size(); ++j)
+    {
+      for (size_t k = 0; k < b.size(); ++k) c.at(i).at(j) += a.at(i).at(k) * b.at(k).at(j);
+      c.at(i).at(j) &= mask;
+    }
+  }
+  return c;
+}
+
+void testSystolicArray()
+{
+  srand(50);
+  SystolicArray<4, 3, 8> array;
+
+  // Back to back tiles, gates then fast then gates
+  for (auto mode : {false, true, false})
+  {
+    array.fast(mode);
+    auto a = randomMatrix(4, 6, 8);
+    auto b = randomMatrix(6, 3, 8);
+    assert(array.multiply(a, b) == matrixProduct(a, b, 24));
+  }
+
+  // A tile long enough to wrap a narrow accumulator
+  SystolicArray<2, 2, 8, 12> narrow;
+  auto a = randomMatrix(2, 40, 8);
+  auto b = randomMatrix(40, 2, 8);
+  assert(narrow.multiply(a, b) == matrixProduct(a, b, 12));
+}
+
+void testSystolicSwitch()
+{
+  // Switch modes every cycle in the middle of a tile
+  srand(51);
+  SystolicArray<3, 3, 6> gates, mixed;
+  auto a = randomMatrix(3, 5, 6);
+  auto b = randomMatrix(5, 3, 6);
+
+  for (auto t = 0; t < 5 + 3 + 3 - 2; ++t)
+  {
+    mixed.fast(t % 2);
+    for (auto* array : {&gates, &mixed})
+    {
+      for (auto i = 0; i < 3; ++i)
+      {
+        int step = t - i;
+        bool live = step >= 0 && step < 5;
+        array->input(i, Word<6>::fromInt(live ? a.at(i).at(step) : 0));
+        array->control(i, step == 0);
+        array->input(3 + i, Word<6>::fromInt(live ? b.at(step).at(i) : 0));
+      }
+      array->process();
+    }
+
+    for (auto i = 0; i < 3; ++i)
+    {
+      for (auto j = 0; j < 3; ++j) assert(gates.result(i, j) == mixed.result(i, j));
+    }
+  }
+
+  auto c = matrixProduct(a, b, 20);
+  for (auto i = 0; i < 3; ++i)
+  {
+    for (auto j = 0; j < 3; ++j) assert(mixed.result(i, j).toInt() == c.at(i).at(j));
+  }
+  assert(mixed.cycles() == 9);
+}
+
+void testSystolic()
+{
+  testSystolicArray();
+  testSystolicSwitch();
+}
+
+
+#endif // SYSTOLIC_HPP
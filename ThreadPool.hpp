@@ -0,0 +1,368 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+
+// Work-stealing thread pool.
+// Every worker owns a deque of tasks. Workers pop work from the back
+// of their own deque and steal from the front of the others.
+// The thread that calls parallelFor() works through its own loop until
+// every range has been claimed, so nested parallel loops can't deadlock
+// the pool: a nested loop never waits on anything but its own ranges.
+
+class ThreadPool
+{
+  public:
+    // Total threads including the caller, so ThreadPool(1) is serial
+    ThreadPool(int threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    int threads() const
+    {
+      return _threads;
+    }
+
+    // Stop all workers and restart with a new thread count
+    void resize(int threads);
+
+    // Call body(begin, end) over disjoint ranges covering [0, count).
+    // Grain is the smallest range worth handing to another thread.
+    // Ranges narrower than two grains run serially on the caller.
+    // While it waits, the caller only runs ranges of this same loop,
+    // so a body never finds another loop's body started underneath it
+    // on its own thread.
+    void parallelFor(int count, const std::function<void(int, int)>& body,
+                     int grain = 1);
+
+    // Pool shared by all components
+    static ThreadPool& instance();
+
+  private:
+    using Task = std::function<void()>;
+
+    struct Queue
+    {
+      std::mutex lock;
+      std::deque<Task> tasks;
+    };
+
+    // One call to parallelFor()
+    struct Batch
+    {
+      int chunks = 0;
+      std::atomic<int> next{0};
+      std::atomic<int> remaining{0};
+      std::exception_ptr error;
+      std::mutex errorLock;
+
+      // The last chunk to finish wakes a caller that stopped spinning
+      std::mutex doneLock;
+      std::condition_variable done;
+    };
+
+    // How long a caller spins on other threads' chunks before sleeping
+    static constexpr std::chrono::microseconds spin{50};
+
+    void start(int threads);
+    void stop();
+    void work(int index);
+    void push(int index, Task task);
+    bool pop(int index, Task& task);
+    bool steal(int index, Task& task);
+
+    int _threads;
+    pid_t _owner;
+    std::vector<std::thread> _workers;
+    std::vector<std::unique_ptr<Queue>> _queues;
+
+    std::atomic<int> _pending;
+    std::atomic<bool> _stopping;
+    std::mutex _sleepLock;
+    std::condition_variable _wake;
+};
+
+
+ThreadPool::ThreadPool(int threads) :
+  _threads(1), _pending(0), _stopping(false)
+{
+  start(threads);
+}
+
+ThreadPool::~ThreadPool()
+{
+  stop();
+}
+
+void ThreadPool::resize(int threads)
+{
+  stop();
+  start(threads);
+}
+
+ThreadPool& ThreadPool::instance()
+{
+  static ThreadPool pool;
+  return pool;
+}
+
+void ThreadPool::start(int threads)
+{
+  _threads = std::max(1, threads);
+  _owner = getpid();
+  _stopping = false;
+
+  // Queue 0 belongs to whichever thread is calling parallelFor()
+  for (auto i = 0; i < _threads; ++i)
+  {
+    _queues.push_back(std::make_unique<Queue>());
+  }
+
+  for (auto i = 1; i < _threads; ++i)
+  {
+    _workers.emplace_back(&ThreadPool::work, this, i);
+  }
+}
+
+void ThreadPool::stop()
+{
+  {
+    std::lock_guard<std::mutex> lk(_sleepLock);
+    _stopping = true;
+  }
+  _wake.notify_all();
+
+  for (auto& w : _workers) w.join();
+
+  _workers.clear();
+  _queues.clear();
+  _pending = 0;
+}
+
+void ThreadPool::work(int index)
+{
+  while (true)
+  {
+    Task task;
+
+    if (pop(index, task) || steal(index, task))
+    {
+      task();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lk(_sleepLock);
+    _wake.wait(lk, [this] { return _stopping || _pending > 0; });
+    if (_stopping) return;
+  }
+}
+
+void ThreadPool::push(int index, Task task)
+{
+  {
+    std::lock_guard<std::mutex> lk(_queues.at(index)->lock);
+    _queues.at(index)->tasks.push_back(std::move(task));
+  }
+
+  // Taking the sleep lock orders this against a worker about to wait
+  {
+    std::lock_guard<std::mutex> lk(_sleepLock);
+    ++_pending;
+  }
+  _wake.notify_one();
+}
+
+bool ThreadPool::pop(int index, Task& task)
+{
+  Queue& q = *_queues.at(index);
+  std::lock_guard<std::mutex> lk(q.lock);
+
+  if (q.tasks.empty()) return false;
+
+  task = std::move(q.tasks.back());
+  q.tasks.pop_back();
+  --_pending;
+  return true;
+}
+
+bool ThreadPool::steal(int index, Task& task)
+{
+  for (auto i = 1; i < _threads; ++i)
+  {
+    Queue& q = *_queues.at((index + i) % _threads);
+    std::lock_guard<std::mutex> lk(q.lock);
+
+    if (q.tasks.empty()) continue;
+
+    task = std::move(q.tasks.front());
+    q.tasks.pop_front();
+    --_pending;
+    return true;
+  }
+
+  return false;
+}
+
+void ThreadPool::parallelFor(int count,
+                             const std::function<void(int, int)>& body,
+                             int grain)
+{
+  grain = std::max(1, grain);
+
+  // Narrow loops aren't worth waking anybody up for.
+  // A forked child inherits the pool but not its workers, so it's serial.
+  if (_threads == 1 || count < 2 * grain || getpid() != _owner)
+  {
+    if (count > 0) body(0, count);
+    return;
+  }
+
+  // Enough chunks to balance uneven work, but none smaller than grain
+  int chunks = std::min(count / grain, 4 * _threads);
+  int size = (count + chunks - 1) / chunks;
+  chunks = (count + size - 1) / size;
+
+  // Queued tasks don't name a chunk, they claim the next one. A task
+  // that runs after every chunk is claimed does nothing, so it only
+  // needs the batch to still exist, not the caller's loop.
+  auto batch = std::make_shared<Batch>();
+  batch->chunks = chunks;
+  batch->remaining = chunks;
+
+  auto claim = [&body, size, count](Batch& b)
+  {
+    int c = b.next++;
+    if (c >= b.chunks) return false;
+
+    try
+    {
+      body(c * size, std::min(count, (c + 1) * size));
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lk(b.errorLock);
+      if (!b.error) b.error = std::current_exception();
+    }
+    if (--b.remaining == 0)
+    {
+      std::lock_guard<std::mutex> lk(b.doneLock);
+      b.done.notify_all();
+    }
+    return true;
+  };
+
+  // One ticket per chunk but the one we run ourselves, dealt round-robin
+  for (auto c = 1; c < chunks; ++c)
+  {
+    push(c % _threads, [batch, claim] { claim(*batch); });
+  }
+
+  // Help only with our own chunks. Running somebody else's task here
+  // would start unrelated work, perhaps an outer loop's next chunk, on
+  // a thread that is still in the middle of the body that called us.
+  while (claim(*batch)) {}
+
+  // Chunks still running elsewhere are usually about to finish, so
+  // spin briefly, then sleep rather than hold a core they could use
+  auto until = std::chrono::steady_clock::now() + spin;
+  while (batch->remaining > 0 && std::chrono::steady_clock::now() < until)
+  {
+    std::this_thread::yield();
+  }
+
+  if (batch->remaining > 0)
+  {
+    std::unique_lock<std::mutex> lk(batch->doneLock);
+    batch->done.wait(lk, [&] { return batch->remaining == 0; });
+  }
+
+  if (batch->error) std::rethrow_exception(batch->error);
+}
+
+
+// THREAD POOL TESTS
+
+void testThreadPool()
+{
+  ThreadPool p(4);
+
+  // Every index is visited exactly once
+  std::vector<int> hits(10000, 0);
+  p.parallelFor(hits.size(), [&](int begin, int end)
+  {
+    for (auto i = begin; i < end; ++i) ++hits.at(i);
+  }, 64);
+  for (auto h : hits) assert(h == 1);
+
+  // Narrow loops run serially on the caller
+  std::thread::id caller = std::this_thread::get_id();
+  p.parallelFor(10, [&](int begin, int end)
+  {
+    assert(begin == 0 && end == 10);
+    assert(std::this_thread::get_id() == caller);
+  }, 64);
+
+  // Nested loops complete
+  std::atomic<int> total(0);
+  p.parallelFor(16, [&](int begin, int end)
+  {
+    for (auto i = begin; i < end; ++i)
+    {
+      p.parallelFor(256, [&](int b, int e) { total += e - b; }, 16);
+    }
+  });
+  assert(total == 16 * 256);
+
+  // A caller waiting on a nested loop never picks up the outer loop's
+  // next range, so no thread is ever inside two outer bodies at once
+  static thread_local int depth = 0;
+  std::atomic<int> overlaps(0);
+  p.parallelFor(64, [&](int begin, int end)
+  {
+    for (auto i = begin; i < end; ++i)
+    {
+      if (++depth > 1) ++overlaps;
+      p.parallelFor(64, [](int b, int e)
+      {
+        volatile int spin = 0;
+        for (auto k = 0; k < 1000 * (e - b); ++k) spin = spin + k;
+      });
+      --depth;
+    }
+  });
+  assert(overlaps == 0);
+
+  // Exceptions reach the caller
+  bool thrown = false;
+  try
+  {
+    p.parallelFor(1000, [](int begin, int)
+    {
+      if (begin == 0) throw std::runtime_error("fail");
+    }, 10);
+  }
+  catch (const std::runtime_error&)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+
+  p.resize(1);
+  assert(p.threads() == 1);
+}
+
+
+#endif // THREADPOOL_HPP
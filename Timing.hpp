@@ -0,0 +1,430 @@
+#ifndef TIMING_HPP
+#define TIMING_HPP
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "ALU.hpp"
+#include "Netlist.hpp"
+
+
+// Propagation delays for an event-driven run of a netlist.
+// Netlists are all NAND, so the gate types are a plain NAND and a NAND
+// with its inputs tied, used as an inverter. Any gate can be given its
+// own delay, e.g. every gate a component synthesized.
+
+struct Delays
+{
+  int nand = 1;
+  int inverter = 1;
+  std::unordered_map<Net, int> gates;
+
+  void set(Net gate, int delay)
+  {
+    gates[gate] = delay;
+  }
+
+  void set(const Bus& gates, int delay)
+  {
+    for (auto g : gates) set(g, delay);
+  }
+};
+
+
+// Discrete-event simulation of a netlist with transport delays.
+// Events sit on a two-level timing wheel: 256 slots of one time unit
+// for the current page, 256 slots of a page each behind that, and an
+// overflow list for anything further out. Watched nets record every
+// transition, so a run reports when each one settled and how many
+// glitches it produced on the way.
+
+class EventSimulator
+{
+  public:
+    EventSimulator(const Netlist& netlist, const Delays& delays = Delays());
+
+    // Change a net at the current time. Takes effect in run().
+    void set(Net net, Signal s);
+
+    template <int N>
+    void set(const Bus& bus, const Word<N>& w)
+    {
+      for (auto i = 0; i < N; ++i) set(bus.at(i), w.bit(i));
+    }
+
+    Signal get(Net net) const
+    {
+      return _values.at(net);
+    }
+
+    template <int N>
+    Word<N> get(const Bus& bus) const
+    {
+      Word<N> w;
+      for (auto i = 0; i < N; ++i) w.bit(i) = _values.at(bus.at(i));
+      return w;
+    }
+
+    void watch(Net net);
+    void watch(const Bus& bus);
+
+    // Process events until the netlist is quiet, or throw if it is
+    // still switching limit time units from now. Returns how long the
+    // watched nets took to settle.
+    uint64_t run(uint64_t limit = 1 << 20);
+
+    struct Activity
+    {
+      uint64_t transitions = 0;
+      uint64_t settle = 0;
+      int glitches = 0;
+    };
+
+    // What a watched net did during the last run
+    const Activity& activity(Net net) const;
+
+    uint64_t now() const
+    {
+      return _now;
+    }
+
+    // Events processed so far
+    uint64_t events() const
+    {
+      return _events;
+    }
+
+  private:
+    struct Event
+    {
+      uint64_t time;
+      Net net;
+      Signal value;
+    };
+
+    static const int slotBits = 8;
+    static const int slots = 1 << slotBits;
+
+    void schedule(const Event& e);
+    void evaluate(Net net);
+    void advance();
+
+    std::vector<Signal> _values;
+
+    // Value each gate will have once its pending events are done
+    std::vector<Signal> _projected;
+    std::vector<int> _delay;
+
+    // Fanout of every net, flattened
+    std::vector<int> _fanoutStart;
+    std::vector<Net> _fanout;
+    const Netlist& _netlist;
+
+    std::vector<std::vector<Event>> _near, _far;
+    std::vector<Event> _overflow;
+    uint64_t _pending = 0;
+    uint64_t _now = 0;
+    uint64_t _events = 0;
+
+    std::vector<Net> _changed;
+    std::unordered_map<Net, Activity> _watched;
+    std::unordered_map<Net, Signal> _initial;
+};
+
+
+// EVENT SIMULATOR DEFINITIONS
+
+
+EventSimulator::EventSimulator(const Netlist& netlist, const Delays& delays) :
+  _values(netlist.nets(), 0),
+  _projected(netlist.nets(), 0),
+  _delay(netlist.nets(), 0),
+  _fanoutStart(netlist.nets() + 1, 0),
+  _netlist(netlist),
+  _near(slots),
+  _far(slots)
+{
+  if (!netlist.loops().empty())
+  {
+    throw std::invalid_argument("Event simulation doesn't support feedback");
+  }
+
+  int size = netlist.nets();
+
+  for (auto g = 0; g < size; ++g)
+  {
+    if (!netlist.isGate(g)) continue;
+
+    auto found = delays.gates.find(g);
+    if (found != delays.gates.end()) _delay.at(g) = found->second;
+    else _delay.at(g) = netlist.a(g) == netlist.b(g) ? delays.inverter : delays.nand;
+
+    if (_delay.at(g) < 1) throw std::invalid_argument("Delays must be positive");
+
+    ++_fanoutStart.at(netlist.a(g) + 1);
+    if (netlist.b(g) != netlist.a(g)) ++_fanoutStart.at(netlist.b(g) + 1);
+  }
+
+  for (auto n = 0; n < size; ++n) _fanoutStart.at(n + 1) += _fanoutStart.at(n);
+
+  _fanout.resize(_fanoutStart.at(size));
+  std::vector<int> next(_fanoutStart.begin(), _fanoutStart.end() - 1);
+  for (auto g = 0; g < size; ++g)
+  {
+    if (!netlist.isGate(g)) continue;
+    _fanout.at(next.at(netlist.a(g))++) = g;
+    if (netlist.b(g) != netlist.a(g)) _fanout.at(next.at(netlist.b(g))++) = g;
+  }
+
+  // Start from the zero-delay steady state
+  NetlistSimulator steady(netlist);
+  steady.evaluate();
+  for (auto n = 0; n < size; ++n) _values.at(n) = _projected.at(n) = steady.get(n);
+}
+
+void EventSimulator::set(Net net, Signal s)
+{
+  if (_netlist.isGate(net)) throw std::invalid_argument("Can only set inputs");
+  if (_values.at(net) == s) return;
+
+  _values.at(net) = _projected.at(net) = s;
+  _changed.push_back(net);
+}
+
+void EventSimulator::watch(Net net)
+{
+  _watched[net] = Activity();
+}
+
+void EventSimulator::watch(const Bus& bus)
+{
+  for (auto net : bus) watch(net);
+}
+
+const EventSimulator::Activity& EventSimulator::activity(Net net) const
+{
+  return _watched.at(net);
+}
+
+void EventSimulator::schedule(const Event& e)
+{
+  // Same page as now goes on the near wheel, the next 255 pages on
+  // the far wheel, and the rest waits in overflow
+  if ((e.time >> slotBits) == (_now >> slotBits))
+  {
+    _near[e.time & (slots - 1)].push_back(e);
+  }
+  else if ((e.time >> (2 * slotBits)) == (_now >> (2 * slotBits)))
+  {
+    _far[(e.time >> slotBits) & (slots - 1)].push_back(e);
+  }
+  else
+  {
+    _overflow.push_back(e);
+  }
+  ++_pending;
+}
+
+void EventSimulator::evaluate(Net net)
+{
+  const Signal* v = _values.data();
+
+  for (auto i = _fanoutStart[net]; i < _fanoutStart[net + 1]; ++i)
+  {
+    Net g = _fanout[i];
+    Signal out = !(v[_netlist.a(g)] && v[_netlist.b(g)]);
+
+    if (out != _projected[g])
+    {
+      _projected[g] = out;
+      schedule({_now + _delay[g], g, out});
+    }
+  }
+}
+
+void EventSimulator::advance()
+{
+  ++_now;
+  if (_now & (slots - 1)) return;
+
+  // New page: pull in whatever was waiting for it
+  if ((_now & ((1 << (2 * slotBits)) - 1)) == 0)
+  {
+    std::vector<Event> waiting;
+    waiting.swap(_overflow);
+    _pending -= waiting.size();
+    for (auto& e : waiting) schedule(e);
+  }
+
+  auto& page = _far[(_now >> slotBits) & (slots - 1)];
+  _pending -= page.size();
+  for (auto& e : page) schedule(e);
+  page.clear();
+}
+
+uint64_t EventSimulator::run(uint64_t limit)
+{
+  uint64_t start = _now;
+
+  for (auto& w : _watched)
+  {
+    w.second = Activity();
+    _initial[w.first] = _values.at(w.first);
+  }
+
+  for (auto net : _changed) evaluate(net);
+  _changed.clear();
+
+  uint64_t settle = 0;
+
+  while (_pending)
+  {
+    advance();
+    if (_now - start > limit) throw std::runtime_error("Netlist did not settle");
+
+    auto& slot = _near[_now & (slots - 1)];
+    if (slot.empty()) continue;
+
+    // Anything scheduled from here lands in a later slot
+    for (size_t i = 0; i < slot.size(); ++i)
+    {
+      Event e = slot[i];
+      --_pending;
+      ++_events;
+
+      _values[e.net] = e.value;
+
+      auto w = _watched.find(e.net);
+      if (w != _watched.end())
+      {
+        ++w->second.transitions;
+        w->second.settle = _now - start;
+        settle = std::max(settle, _now - start);
+      }
+
+      evaluate(e.net);
+    }
+    slot.clear();
+  }
+
+  for (auto& w : _watched)
+  {
+    int needed = _values.at(w.first) != _initial.at(w.first);
+    w.second.glitches = (w.second.transitions - needed) / 2;
+  }
+
+  return settle;
+}
+
+
+// TIMING TESTS
+
+
+void testEventSimulator()
+{
+  // Static hazard: x NAND ~x is always 1, except for the moment the
+  // inverter is catching up
+  Netlist n;
+  Net x = n.input();
+  Net nx = Inverter::synthesize(n, x);
+  Net z = n.nand(x, nx);
+
+  EventSimulator sim(n);
+  sim.watch(z);
+  assert(sim.get(z) == 1);
+
+  sim.set(x, 1);
+  assert(sim.run() == 2);
+  assert(sim.get(z) == 1);
+  assert(sim.activity(z).transitions == 2);
+  assert(sim.activity(z).glitches == 1);
+
+  // Falling edge has no hazard
+  sim.set(x, 0);
+  sim.run();
+  assert(sim.activity(z).transitions == 0);
+
+  // A slower inverter widens the pulse
+  Delays slow;
+  slow.inverter = 3;
+  EventSimulator wide(n, slow);
+  wide.watch(z);
+  wide.set(x, 1);
+  assert(wide.run() == 4);
+
+  // Per-gate override beats the type
+  Delays one;
+  one.inverter = 3;
+  one.set(nx, 1);
+  EventSimulator narrow(n, one);
+  narrow.watch(z);
+  narrow.set(x, 1);
+  assert(narrow.run() == 2);
+}
+
+void testEventAdder()
+{
+  // Ripple carry: a carry through every bit takes longest, and every
+  // run ends where the zero-delay simulation does
+  Netlist n;
+  Bus a = n.input(16);
+  Bus b = n.input(16);
+  Bus sum = WordAdder<16>::synthesize(n, a, b);
+
+  EventSimulator sim(n);
+  NetlistSimulator steady(n);
+  sim.watch(sum);
+
+  auto add = [&](uint64_t x, uint64_t y)
+  {
+    sim.set(a, Word<16>::fromInt(x));
+    sim.set(b, Word<16>::fromInt(y));
+    uint64_t settle = sim.run();
+
+    steady.set(a, Word<16>::fromInt(x));
+    steady.set(b, Word<16>::fromInt(y));
+    steady.evaluate();
+    assert(sim.get<16>(sum) == steady.get<16>(sum));
+    assert(sim.get<16>(sum).toInt() == ((x + y) & 0xFFFF));
+    return settle;
+  };
+
+  add(0, 0);
+  uint64_t shortCarry = add(0x0000, 0x0001);
+  add(0, 0);
+  uint64_t longCarry = add(0xFFFF, 0x0001);
+  assert(longCarry > shortCarry);
+
+  // Every bit settles after the one below it
+  uint64_t previous = 0;
+  for (auto i = 15; i >= 0; --i)
+  {
+    assert(sim.activity(sum.at(i)).settle >= previous);
+    previous = sim.activity(sum.at(i)).settle;
+  }
+
+  srand(12);
+  for (auto i = 0; i < 100; ++i) add(rand() & 0xFFFF, rand() & 0xFFFF);
+  assert(sim.events() > 0);
+
+  // A time wheel page is 256 units, so long delays go the far way
+  Delays slow;
+  slow.nand = 100;
+  slow.inverter = 70000;
+  EventSimulator far(n, slow);
+  far.set(a, Word<16>::fromInt(0xFFFF));
+  far.set(b, Word<16>::fromInt(1));
+  far.run(1 << 24);
+  assert(far.get<16>(sum).toInt() == 0);
+}
+
+void testTiming()
+{
+  testEventSimulator();
+  testEventAdder();
+}
+
+
+#endif // TIMING_HPP